@@ -0,0 +1,50 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+#include "typedefs.h"	// typedefs
+
+#include <stdio.h>	// FILE
+
+
+/*! One run of a ROM, from a manifest line or a fork-server request */
+typedef struct batch_job_t
+{
+	unsigned int id;		/*! Manifest order */
+	char *rom;
+	uint64_t frames;		/*! 0 for no frame limit */
+	uint64_t cycles;		/*! 0 for no clock limit */
+	const char *input;
+	const char *audio;
+	const char *audio_hashes;
+	const char *serial;
+	const char *log;
+	const char *state_in;
+	const char *state_out;
+	const char *movie;		/*! Input movie to play */
+	const char *movie_out;		/*! Record the job's input to */
+	char *line;			/*! Owns all the strings above */
+} batch_job;
+
+/*! How a job ended */
+typedef struct batch_result_t
+{
+	const char *reason;		/*! limit, pass, fail, or an error */
+	int exit_code;			/*! From the serial verdict */
+	uint64_t frames;		/*! Frames run by the job */
+	uint64_t cycles;		/*! Clocks run by the job */
+	uint32_t frame_hash;		/*! Hash of the last frame drawn */
+	bool frame_hashed;		/*! The job drew a frame near its end */
+} batch_result;
+
+#define BATCH_HASH_TEXT	9		/*! "%08X" or "-", and the NUL */
+
+bool batch_parse_options(batch_job *, char *, const char *, unsigned int);
+void batch_open_outputs(const batch_job *, FILE **, FILE **);
+void batch_close_outputs(FILE *, FILE *);
+void batch_execute(emu_state *restrict, const batch_job *, batch_result *);
+const char * batch_hash_text(const batch_result *, char [BATCH_HASH_TEXT]);
+
+int forkserver_main(const char *, const char *, uint64_t);
+
+#endif /*__BATCH_H__*/
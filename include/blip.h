@@ -0,0 +1,67 @@
+#ifndef __BLIP_H__
+#define __BLIP_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include <stddef.h>	// size_t
+
+
+/*!
+ * Band-limited step synthesis.
+ *
+ * Instead of producing a sample every clock, a channel records each change
+ * in its output level as a delta at the (fractional) sample it happened on.
+ * The delta is spread over a few samples with a windowed sinc kernel, and
+ * integrating the buffer at the end of the frame gives clean steps.
+ */
+
+#define BLIP_PHASES		32	/*! Sub-sample positions in the kernel */
+#define BLIP_TAPS		16	/*! Samples each delta is spread across */
+#define BLIP_KERNEL_BITS	12	/*! Each kernel phase sums to 1 << this */
+#define BLIP_FRAC_BITS		16	/*! Fixed point bits in a sample position */
+#define BLIP_BUF_SIZE		2048	/*! Most samples in one frame */
+
+typedef struct blip_buffer_t
+{
+	int32_t buf[BLIP_BUF_SIZE + BLIP_TAPS];	/*! Deltas, spread out */
+	int32_t integrator;			/*! Running sum while reading */
+	int32_t level;				/*! Last level given */
+	uint8_t busy;				/*! Frames until buf is clear */
+} blip_buffer;
+
+extern const int16_t blip_kernel[BLIP_PHASES][BLIP_TAPS];
+
+/*!
+ * @brief	Change the level of a buffer at a point in the frame.
+ * @param	blip	The buffer to change.
+ * @param	pos	Sample position, in BLIP_FRAC_BITS fixed point.
+ * @param	level	The new level.
+ */
+static inline void blip_set_level(blip_buffer *restrict blip, uint32_t pos,
+		int32_t level)
+{
+	int32_t delta = level - blip->level;
+	uint32_t index = pos >> BLIP_FRAC_BITS;
+	const int16_t *kernel;
+	int32_t *out;
+
+	if(delta == 0 || unlikely(index >= BLIP_BUF_SIZE))
+	{
+		return;
+	}
+
+	blip->level = level;
+	blip->busy = 2;	// this frame, and the tail in the next
+
+	kernel = blip_kernel[(pos >> (BLIP_FRAC_BITS - 5)) & (BLIP_PHASES - 1)];
+	out = blip->buf + index;
+
+	for(uint8_t i = 0; i < BLIP_TAPS; i++)
+	{
+		out[i] += kernel[i] * delta;
+	}
+}
+
+void blip_end_frame(blip_buffer *restrict, int16_t *restrict, size_t);
+
+#endif /*__BLIP_H__*/
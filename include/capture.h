@@ -0,0 +1,17 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+#include "typedefs.h"	// typedefs
+
+#include <stddef.h>	// size_t
+
+
+#define CAPTURE_BLOCK_SIZE	65536	/*! Bytes handed to the writer at once */
+#define CAPTURE_BLOCKS		32	/*! Blocks in flight (under RING_SIZE) */
+
+bool capture_open(emu_state *restrict, const char *, const char *);
+void capture_write(emu_state *restrict, const int16_t *, size_t);
+bool capture_close(emu_state *restrict);
+
+#endif /*__CAPTURE_H__*/
@@ -5,6 +5,8 @@
 #include "typedefs.h"	// typedefs
 #include "input.h"	// input_key
 
+#include <stddef.h>	// size_t
+
 struct frontend_input_return_t
 {
 	input_key key;
@@ -24,7 +26,8 @@ struct frontend_audio_t
 {
 	bool (*init)(emu_state *);		/*! Initalise the audio output */
 	void (*finish)(emu_state *);		/*! Deinitalise the audio output */
-	void (*output_sample)(emu_state *);	/*! Output an audio sample */
+	/*! Output a frame of interleaved stereo samples */
+	void (*output_sample)(emu_state *, const int16_t *, size_t);
 
 	void *data;				/*! Opaque data */
 };
@@ -46,6 +49,8 @@ struct frontend_t
 
 	int (*event_loop)(emu_state *);		/*! Event loop function (for use with toolkits) */
 
+	unsigned int null_noticed;		/*! Null frontend messages shown */
+
 	void *data;				/*! Opaque data */
 };
 
@@ -94,6 +99,7 @@ extern const frontend_event_loop frontend_set_event_loop[];
 // Helpers to call functions
 #define CALL_FRONTEND_0(state, type, fn) ((*(state->front.type.fn))(state))
 #define CALL_FRONTEND_1(state, type, fn, _1) ((*(state->front.type.fn))(state, _1))
+#define CALL_FRONTEND_2(state, type, fn, _1, _2) ((*(state->front.type.fn))(state, _1, _2))
 #define EVENT_LOOP(state) ((*(state->front.event_loop))(state))
 
 #define FRONTEND_INIT_INPUT(state) CALL_FRONTEND_0(state, input, init)
@@ -118,7 +124,7 @@ extern const frontend_event_loop frontend_set_event_loop[];
 	}
 
 #define BLIT_CANVAS(state) CALL_FRONTEND_0(state, video, blit_canvas)
-#define OUTPUT_SAMPLE(state) CALL_FRONTEND_0(state, audio, output_sample)
+#define OUTPUT_SAMPLE(state, samples, count) CALL_FRONTEND_2(state, audio, output_sample, samples, count)
 #define GET_KEY(state, ret) CALL_FRONTEND_1(state, input, get_key, ret)
 
 #endif /*__FRONTEND_H__*/
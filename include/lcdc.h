@@ -5,6 +5,35 @@
 #include "typedefs.h"	// typedefs
 
 
+/*! Screen dimensions */
+#define LCDC_WIDTH		160
+#define LCDC_HEIGHT		144
+
+/*! Clocks spent in each mode of a visible line */
+#define LCDC_OAM_CLOCKS		80
+#define LCDC_XFER_CLOCKS	172
+#define LCDC_HBLANK_CLOCKS	204
+
+/*! Clocks per line and per frame (154 lines) */
+#define LCDC_LINE_CLOCKS	456
+#define LCDC_FRAME_CLOCKS	(LCDC_LINE_CLOCKS * 154)
+
+/*! next_event while the LCD is switched off */
+#define LCDC_NEVER		UINT64_MAX
+
+
+/*! When the LCD controller bothers drawing frames
+ * Timing and interrupts are the same whichever is picked.
+ */
+typedef enum
+{
+	RENDER_ALWAYS = 0,	/*! Draw every frame */
+	RENDER_SKIP,		/*! Draw one frame in every render_skip */
+	RENDER_ON_DEMAND,	/*! Draw the next frame after request_frame */
+	RENDER_NEVER,		/*! Never draw anything */
+} render_policy;
+
+
 struct oam_t
 {
 	uint8_t y;
@@ -32,24 +61,35 @@ struct oam_t
 
 struct cps_t
 {
+	union
+	{
+		uint8_t reg;
+		struct
+		{
 #ifdef LITTLE_ENDIAN
-	bool pal_sel:1;			/*! Palette changes on next write */
-	unsigned int notused:1;		/*! Not used */
-	unsigned int pal_num:3;		/*! Select palette number */
-	unsigned int pal_data_num:2;	/*! Select palette data number */
-	bool hl:1;			/*! Specify H/L */
+			bool hl:1;			/*! Specify H/L */
+			unsigned int pal_data_num:2;	/*! Select palette data number */
+			unsigned int pal_num:3;		/*! Select palette number */
+			unsigned int notused:1;		/*! Not used */
+			bool pal_sel:1;			/*! Index increments on write */
 #else
-	bool hl:1;			/*! Specify H/L */
-	unsigned int pal_data_num:2;	/*! Select palette data number */
-	unsigned int pal_num:3;		/*! Select palette number */
-	unsigned int notused:1;		/*! Not used */
-	bool pal_sel:1;			/*! Palette changes on next write */
+			bool pal_sel:1;			/*! Index increments on write */
+			unsigned int notused:1;		/*! Not used */
+			unsigned int pal_num:3;		/*! Select palette number */
+			unsigned int pal_data_num:2;	/*! Select palette data number */
+			bool hl:1;			/*! Specify H/L */
 #endif
+		} params;
+	};
 };
 
 struct lcdc_state_t
 {
-	uint_fast16_t curr_clk;		/*! current clock */
+	uint64_t next_event;		/*! cycle of the next mode change */
+	bool stat_line;			/*! STAT interrupt line (for edges) */
+
+	uint32_t frames;		/*! Frames finished since power on */
+	bool render_frame;		/*! Drawing the present frame */
 	uint_fast8_t curr_h_blk;	/*! last H block to be written */
 
 	uint_fast8_t vram_bank;		/*! Present VRAM bank */
@@ -128,52 +168,23 @@ struct lcdc_state_t
 		} params;
 	} stat;
 
-	union
-	{
-		/*! CGB only (FIXME palette RAM) */
-		struct
-		{
-			cps bcps;
-			uint8_t bcpd;	/*! BG data write */
+	/*! DMG palettes (BGP, OBP0, OBP1); 2 bits per colour number */
+	uint8_t bgp;
+	uint8_t obp[2];
 
-			cps ocps;
-			uint8_t ocpd;	/*! OBJ data write */
-		};
+	/*! CGB palette selection (BCPS, OCPS) */
+	cps bcps;
+	cps ocps;
 
-		/*! DMG only */
-		struct
-		{
-			struct
-			{
-#ifdef LITTLE_ENDIAN
-				unsigned int shade_4:2;
-				unsigned int shade_3:2;
-				unsigned int shade_2:2;
-				unsigned int shade_1:2;
-#else
-				unsigned int shade_1:2;
-				unsigned int shade_2:2;
-				unsigned int shade_3:2;
-				unsigned int shade_4:2;
-#endif
-			} dmg_pal;
+	/*! CGB palette RAM: 8 palettes of 4 colours, RGB555 little endian */
+	uint8_t bg_pal[64];
+	uint8_t obj_pal[64];
 
-			struct
-			{
-#ifdef LITTLE_ENDIAN
-				unsigned int notused:2;
-				unsigned int shade_3:2;
-				unsigned int shade_2:2;
-				unsigned int shade_1:2;
-#else
-				unsigned int shade_1:2;
-				unsigned int shade_2:2;
-				unsigned int shade_3:2;
-				unsigned int notused:2;
-#endif
-			} obp[2];
-		};
-	};
+	/*! Palettes in screen buffer format (BG 0..31, OBJ 32..63)
+	 * DMG: shade numbers, CGB: RGB555.  Only updated on palette
+	 * writes, so the renderer never converts.
+	 */
+	uint16_t pal_out[64];
 
 	uint_fast8_t scroll_y;	/*! Y position in scrolling map */
 	uint_fast8_t scroll_x;	/*! X position in scrolling map */
@@ -184,12 +195,44 @@ struct lcdc_state_t
 	uint_fast8_t ly;	/*! Present line being transferred (144-153 = V-Blank) */
 	uint_fast8_t lyc;	/*! LY comparison (set stat.lyc_state when == ly) */
 
-	uint32_t out[144][160];	/*! Simulated LCD screen buffer */
+	/*
+	 * Everything below is output for the frontend, not machine state;
+	 * save states stop here (see savestate.c).
+	 */
+
+	/*! Simulated LCD screen buffer
+	 * Colours are only converted when a frontend consumes a frame;
+	 * see lcdc_line_to_argb and lcdc_line_to_index.
+	 */
+	union
+	{
+		/*! DMG: 2-bit shades, four pixels a byte, leftmost highest */
+		uint8_t dmg[LCDC_HEIGHT][LCDC_WIDTH / 4];
+		/*! CGB: RGB555 */
+		uint16_t cgb[LCDC_HEIGHT][LCDC_WIDTH];
+	} out;
+
+	/*! Lines changed since the frontend last cleared them */
+	uint32_t dirty[(LCDC_HEIGHT + 31) / 32];
+	bool frame_changed;		/*! A line changed this frame */
+	uint32_t line_hash[LCDC_HEIGHT];	/*! Hash of each line */
+	uint32_t frame_hash;		/*! Hash of the last drawn frame */
 };
 
 void init_lcdc(emu_state *restrict);
 void lcdc_tick(emu_state *restrict);
 
+extern const uint32_t lcdc_dmg_shades[4];
+
+void lcdc_line_to_argb(const emu_state *restrict, uint8_t, uint32_t *restrict);
+void lcdc_line_to_index(const emu_state *restrict, uint8_t, uint8_t *restrict);
+
+uint8_t lcdc_dirty_run(const emu_state *restrict, uint8_t *);
+void lcdc_clear_dirty(emu_state *restrict);
+
+void set_render_policy(emu_state *restrict, render_policy, unsigned int);
+void request_frame(emu_state *restrict);
+
 uint8_t lcdc_read(emu_state *restrict, uint16_t);
 uint8_t vram_read(emu_state *restrict, uint16_t);
 uint8_t lcdc_control_read(emu_state *restrict, uint16_t);
@@ -198,6 +241,7 @@ uint8_t lcdc_scroll_read(emu_state *restrict, uint16_t);
 uint8_t lcdc_ly_read(emu_state *restrict, uint16_t);
 uint8_t lcdc_lyc_read(emu_state *restrict, uint16_t);
 uint8_t lcdc_window_read(emu_state *restrict, uint16_t);
+uint8_t dmg_pal_read(emu_state *restrict, uint16_t);
 uint8_t bg_pal_ind_read(emu_state *restrict, uint16_t);
 uint8_t bg_pal_data_read(emu_state *restrict, uint16_t);
 uint8_t sprite_pal_ind_read(emu_state *restrict, uint16_t);
@@ -211,6 +255,7 @@ void lcdc_scroll_write(emu_state *restrict, uint16_t, uint8_t);
 void lcdc_ly_write(emu_state *restrict, uint16_t, uint8_t);
 void lcdc_lyc_write(emu_state *restrict, uint16_t, uint8_t);
 void lcdc_window_write(emu_state *restrict, uint16_t, uint8_t);
+void dmg_pal_write(emu_state *restrict, uint16_t, uint8_t);
 void bg_pal_ind_write(emu_state *restrict, uint16_t, uint8_t);
 void bg_pal_data_write(emu_state *restrict, uint16_t, uint8_t);
 void sprite_pal_ind_write(emu_state *restrict, uint16_t, uint8_t);
@@ -0,0 +1,21 @@
+#ifndef __LINK_H__
+#define __LINK_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+#include "typedefs.h"	// typedefs
+
+
+#define LINK_XFER_CLOCKS	4096	/*! 8 bits at 8192Hz */
+#define LINK_POLL_CLOCKS	1024	/*! How often the peer is checked */
+#define LINK_NEVER		UINT64_MAX	/*! Not linked */
+
+bool link_pair(emu_state *restrict, emu_state *restrict);
+bool link_open_shm(emu_state *restrict, const char *, unsigned int);
+bool link_connect(emu_state *restrict, const char *);
+void link_close(emu_state *restrict);
+
+void link_start(emu_state *restrict, uint8_t);
+uint8_t link_finish(emu_state *restrict);
+void link_poll(emu_state *restrict);
+
+#endif /*__LINK_H__*/
@@ -0,0 +1,31 @@
+#ifndef __MIXER_H__
+#define __MIXER_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include <stddef.h>	// size_t
+
+
+#define MIXER_CHANNELS	4	/*! Channels mixed into each output */
+#define MIXER_SHIFT	3	/*! Gains are eighths */
+
+#define RESAMPLE_TAPS	16	/*! Input samples per output sample */
+#define RESAMPLE_FRAC	20	/*! Fixed point bits in the resampler step */
+
+/*! Polyphase resampler; planar history so the taps are contiguous */
+typedef struct resampler_t
+{
+	uint32_t step;			/*! Input samples per output (fixed point) */
+	uint32_t pos;			/*! Position in the input (fixed point) */
+	uint16_t hist_len;		/*! Input samples kept from last time */
+	int16_t hist[2][RESAMPLE_TAPS];	/*! Those samples (L, R) */
+} resampler;
+
+void mix_channels(int16_t *restrict, const int16_t *const [MIXER_CHANNELS],
+		const int16_t [MIXER_CHANNELS], const int16_t [MIXER_CHANNELS],
+		size_t);
+void resampler_set_rate(resampler *restrict, uint32_t, uint32_t, int32_t);
+size_t resample(resampler *restrict, const int16_t *restrict, size_t,
+		int16_t *restrict, size_t);
+
+#endif /*__MIXER_H__*/
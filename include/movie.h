@@ -0,0 +1,22 @@
+#ifndef __MOVIE_H__
+#define __MOVIE_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+#include "typedefs.h"	// typedefs
+#include "input.h"	// input_key
+
+
+#define MOVIE_VERSION	1		/*! Bump if the format changes */
+#define MOVIE_NEVER	UINT64_MAX	/*! No movie event is due */
+
+bool movie_record(emu_state *restrict, const char *);
+bool movie_play(emu_state *restrict, const char *);
+void movie_close(emu_state *restrict);
+
+bool movie_input(emu_state *restrict, input_key, bool);
+void movie_poll(emu_state *restrict);
+
+bool movie_finished(const emu_state *restrict);
+uint64_t movie_length(const emu_state *restrict);
+
+#endif /*__MOVIE_H__*/
@@ -20,4 +20,11 @@
 #define likely(x) (!!__builtin_expect((x), 1))
 #define alignment(x) __attribute__((aligned(x)))
 
+// Atomics for structures shared between threads (or processes)
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define atomic_inc(p) __atomic_add_fetch((p), 1, __ATOMIC_ACQ_REL)
+#define atomic_dec(p) __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#define atomic_cas(p, old, new) __sync_bool_compare_and_swap((p), (old), (new))
+
 #endif /*__PLATFORM_COMPILER_GCC_H__*/
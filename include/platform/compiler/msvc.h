@@ -19,6 +19,23 @@
 #define likely(x) (x)
 #define alignment(x) __declspec(align(x))
 
+// Atomics for structures shared between threads (or processes)
+// Aligned 32-bit accesses are atomic; the barrier stops reordering
+#include <intrin.h>
+#define load_acquire(p) _load_acquire_32((volatile long *)(p))
+#define store_release(p, v) (_ReadWriteBarrier(), *(volatile long *)(p) = (long)(v))
+#define atomic_inc(p) _InterlockedIncrement((volatile long *)(p))
+#define atomic_dec(p) _InterlockedDecrement((volatile long *)(p))
+#define atomic_cas(p, old, new) (_InterlockedCompareExchange((volatile long *)(p), \
+		(long)(new), (long)(old)) == (long)(old))
+
+static __inline long _load_acquire_32(volatile long *p)
+{
+	long v = *p;
+	_ReadWriteBarrier();
+	return v;
+}
+
 #if (_MSC_VER >= 1400)
 #	define restrict __restrict
 #else
@@ -13,6 +13,28 @@
 #	define likely(x) (x)
 #endif
 
+// No barriers; sharing state between threads may not be safe
+#ifndef load_acquire
+#	define load_acquire(p) (*(p))
+#endif
+
+#ifndef store_release
+#	define store_release(p, v) (*(p) = (v))
+#endif
+
+#ifndef atomic_inc
+#	define atomic_inc(p) (++*(p))
+#endif
+
+#ifndef atomic_dec
+#	define atomic_dec(p) (--*(p))
+#endif
+
+#ifndef atomic_cas
+#	define atomic_cas(p, old, new) \
+		((*(p) == (old)) ? ((*(p) = (new)), true) : false)
+#endif
+
 #warning "Your compiler is unknown to us, but we're trying anyway. Please report your compiler to us."
 #warning "Everything should work out for the most part, but you may get suboptimal results"
 
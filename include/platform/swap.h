@@ -42,6 +42,27 @@ static inline uint16_t le16toh(uint16_t little_endian_16bits)
 #endif /*LITTLE_ENDIAN*/
 }
 
+/*! Swapping is its own inverse */
+static inline uint16_t htole16(uint16_t host_16bits)
+{
+	return le16toh(host_16bits);
+}
+
+static inline uint32_t htole32(uint32_t host_32bits)
+{
+#if defined(LITTLE_ENDIAN)
+	return host_32bits;
+#elif defined(HAVE_BSWAP_32)
+	return __bswap_32(host_32bits);
+#elif defined(HAVE_BYTESWAP_ULONG)
+	return _byteswap_ulong(host_32bits);
+#else
+	// TODO make our own builtins
+	return 0;
+#error "Your platform has no sensible builtins for endianness-swapping"
+#endif /*LITTLE_ENDIAN*/
+}
+
 #endif /*HAVE_ENDIAN_H || HAVE_SYS_ENDIAN_H*/
 
 #endif /*__SWAP_H__*/
@@ -0,0 +1,81 @@
+#ifndef __THREAD_NULL_H__
+#define __THREAD_NULL_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+
+typedef struct thread_t_
+{
+	void (*fn)(void *);
+	void *arg;
+} thread_t;
+
+/*! Only one thread, so nothing to exclude */
+typedef int thread_mutex_t;
+typedef int thread_cond_t;
+
+/*! Nothing to yield to; just spin */
+static inline void thread_yield(void)
+{
+}
+
+/*! No way to sleep; callers spin instead */
+static inline void thread_sleep(unsigned int ms UNUSED)
+{
+}
+
+/*! No threads here; callers must cope without */
+static inline bool thread_create(thread_t *thread UNUSED,
+		void (*fn)(void *) UNUSED, void *arg UNUSED)
+{
+	return false;
+}
+
+static inline void thread_join(thread_t *thread UNUSED)
+{
+}
+
+static inline void thread_mutex_init(thread_mutex_t *mutex UNUSED)
+{
+}
+
+static inline void thread_mutex_destroy(thread_mutex_t *mutex UNUSED)
+{
+}
+
+static inline void thread_mutex_lock(thread_mutex_t *mutex UNUSED)
+{
+}
+
+static inline void thread_mutex_unlock(thread_mutex_t *mutex UNUSED)
+{
+}
+
+static inline void thread_cond_init(thread_cond_t *cond UNUSED)
+{
+}
+
+static inline void thread_cond_destroy(thread_cond_t *cond UNUSED)
+{
+}
+
+/*! Nobody else could wake us; never called with no threads */
+static inline void thread_cond_wait(thread_cond_t *cond UNUSED,
+		thread_mutex_t *mutex UNUSED)
+{
+}
+
+static inline void thread_cond_broadcast(thread_cond_t *cond UNUSED)
+{
+}
+
+static inline unsigned int thread_cpu_count(void)
+{
+	return 1;
+}
+
+static inline bool thread_pin_self(unsigned int cpu UNUSED)
+{
+	return false;
+}
+
+#endif /*__THREAD_NULL_H__*/
@@ -0,0 +1,166 @@
+#ifndef __THREAD_POSIX_H__
+#define __THREAD_POSIX_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include <pthread.h>	// pthread_*
+#include <sched.h>	// sched_yield, cpu_set_t
+#include <time.h>	// nanosleep
+#include <unistd.h>	// sysconf
+
+typedef struct thread_t_
+{
+	pthread_t handle;
+	void (*fn)(void *);
+	void *arg;
+} thread_t;
+
+typedef pthread_mutex_t thread_mutex_t;
+typedef pthread_cond_t thread_cond_t;
+
+/*! Give up the rest of our time slice while waiting on another thread */
+static inline void thread_yield(void)
+{
+	sched_yield();
+}
+
+/*! Sleep for roughly ms milliseconds */
+static inline void thread_sleep(unsigned int ms)
+{
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+	nanosleep(&ts, NULL);
+}
+
+static inline void *thread_start_posix(void *data)
+{
+	thread_t *thread = data;
+
+	thread->fn(thread->arg);
+	return NULL;
+}
+
+/*!
+ * @brief	Start a thread running fn(arg).
+ * @param	thread	Handle to fill in; must stay put until joined.
+ * @returns	false if the thread could not be started.
+ */
+static inline bool thread_create(thread_t *thread, void (*fn)(void *),
+		void *arg)
+{
+	thread->fn = fn;
+	thread->arg = arg;
+
+	return pthread_create(&(thread->handle), NULL, &thread_start_posix,
+			thread) == 0;
+}
+
+/*! Wait for a thread to finish */
+static inline void thread_join(thread_t *thread)
+{
+	pthread_join(thread->handle, NULL);
+}
+
+static inline void thread_mutex_init(thread_mutex_t *mutex)
+{
+	pthread_mutex_init(mutex, NULL);
+}
+
+static inline void thread_mutex_destroy(thread_mutex_t *mutex)
+{
+	pthread_mutex_destroy(mutex);
+}
+
+static inline void thread_mutex_lock(thread_mutex_t *mutex)
+{
+	pthread_mutex_lock(mutex);
+}
+
+static inline void thread_mutex_unlock(thread_mutex_t *mutex)
+{
+	pthread_mutex_unlock(mutex);
+}
+
+static inline void thread_cond_init(thread_cond_t *cond)
+{
+	pthread_cond_init(cond, NULL);
+}
+
+static inline void thread_cond_destroy(thread_cond_t *cond)
+{
+	pthread_cond_destroy(cond);
+}
+
+/*! Unlock mutex and sleep until woken, then lock it again */
+static inline void thread_cond_wait(thread_cond_t *cond,
+		thread_mutex_t *mutex)
+{
+	pthread_cond_wait(cond, mutex);
+}
+
+/*! Wake everything waiting on cond */
+static inline void thread_cond_broadcast(thread_cond_t *cond)
+{
+	pthread_cond_broadcast(cond);
+}
+
+/*!
+ * @brief	Number of CPUs we can run on.
+ * @note	With _GNU_SOURCE defined before anything is included, only the
+ * 		ones in our affinity mask (taskset, cpusets) count.
+ */
+static inline unsigned int thread_cpu_count(void)
+{
+	long count;
+
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(_GNU_SOURCE)
+	cpu_set_t set;
+
+	if(sched_getaffinity(0, sizeof(set), &set) == 0 &&
+		(count = CPU_COUNT(&set)) > 0)
+	{
+		return (unsigned int)count;
+	}
+#endif
+
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count < 1) ? 1 : (unsigned int)count;
+}
+
+/*!
+ * @brief	Keep the calling thread on one CPU.
+ * @param	cpu	Which of the CPUs we can run on (see thread_cpu_count),
+ * 		counting from 0; not a CPU number.
+ * @returns	false if the platform can't (the thread runs anywhere).
+ * @note	Needs _GNU_SOURCE defined before anything is included.  Call
+ * 		it before the thread has been pinned anywhere else.
+ */
+static inline bool thread_pin_self(unsigned int cpu)
+{
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(_GNU_SOURCE)
+	cpu_set_t allowed, set;
+
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+	{
+		return false;
+	}
+
+	CPU_ZERO(&set);
+	for(unsigned int i = 0; i < CPU_SETSIZE; i++)
+	{
+		if(CPU_ISSET(i, &allowed) && cpu-- == 0)
+		{
+			CPU_SET(i, &set);
+			return pthread_setaffinity_np(pthread_self(),
+				sizeof(set), &set) == 0;
+		}
+	}
+
+	return false;
+#else
+	(void)cpu;
+	return false;
+#endif
+}
+
+#endif /*__THREAD_POSIX_H__*/
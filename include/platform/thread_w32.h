@@ -0,0 +1,168 @@
+#ifndef __THREAD_W32_H__
+#define __THREAD_W32_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include <stddef.h>	// size_t
+
+// windows.h chokes on UNUSED; declaring these ourselves is easier
+__declspec(dllimport) int __stdcall SwitchToThread(void);
+__declspec(dllimport) void __stdcall Sleep(unsigned long);
+__declspec(dllimport) void * __stdcall CreateThread(void *, size_t,
+		unsigned long (__stdcall *)(void *), void *, unsigned long,
+		unsigned long *);
+__declspec(dllimport) unsigned long __stdcall WaitForSingleObject(void *,
+		unsigned long);
+__declspec(dllimport) int __stdcall CloseHandle(void *);
+__declspec(dllimport) void __stdcall InitializeSRWLock(void **);
+__declspec(dllimport) void __stdcall AcquireSRWLockExclusive(void **);
+__declspec(dllimport) void __stdcall ReleaseSRWLockExclusive(void **);
+__declspec(dllimport) void __stdcall InitializeConditionVariable(void **);
+__declspec(dllimport) int __stdcall SleepConditionVariableSRW(void **,
+		void **, unsigned long, unsigned long);
+__declspec(dllimport) void __stdcall WakeAllConditionVariable(void **);
+__declspec(dllimport) unsigned long __stdcall GetActiveProcessorCount(
+		unsigned short);
+__declspec(dllimport) void * __stdcall GetCurrentThread(void);
+__declspec(dllimport) size_t __stdcall SetThreadAffinityMask(void *, size_t);
+
+typedef struct thread_t_
+{
+	void *handle;
+	void (*fn)(void *);
+	void *arg;
+} thread_t;
+
+/*! An SRWLOCK; just a pointer, and needs no cleaning up */
+typedef void *thread_mutex_t;
+
+/*! A CONDITION_VARIABLE; likewise */
+typedef void *thread_cond_t;
+
+/*! Give up the rest of our time slice while waiting on another thread */
+static inline void thread_yield(void)
+{
+	SwitchToThread();
+}
+
+/*! Sleep for roughly ms milliseconds */
+static inline void thread_sleep(unsigned int ms)
+{
+	Sleep(ms);
+}
+
+static inline unsigned long __stdcall thread_start_w32(void *data)
+{
+	thread_t *thread = data;
+
+	thread->fn(thread->arg);
+	return 0;
+}
+
+/*!
+ * @brief	Start a thread running fn(arg).
+ * @param	thread	Handle to fill in; must stay put until joined.
+ * @returns	false if the thread could not be started.
+ */
+static inline bool thread_create(thread_t *thread, void (*fn)(void *),
+		void *arg)
+{
+	thread->fn = fn;
+	thread->arg = arg;
+	thread->handle = CreateThread(NULL, 0, &thread_start_w32, thread, 0,
+			NULL);
+
+	return thread->handle != NULL;
+}
+
+/*! Wait for a thread to finish */
+static inline void thread_join(thread_t *thread)
+{
+	WaitForSingleObject(thread->handle, 0xFFFFFFFF);	// INFINITE
+	CloseHandle(thread->handle);
+}
+
+static inline void thread_mutex_init(thread_mutex_t *mutex)
+{
+	InitializeSRWLock(mutex);
+}
+
+static inline void thread_mutex_destroy(thread_mutex_t *mutex UNUSED)
+{
+}
+
+static inline void thread_mutex_lock(thread_mutex_t *mutex)
+{
+	AcquireSRWLockExclusive(mutex);
+}
+
+static inline void thread_mutex_unlock(thread_mutex_t *mutex)
+{
+	ReleaseSRWLockExclusive(mutex);
+}
+
+static inline void thread_cond_init(thread_cond_t *cond)
+{
+	InitializeConditionVariable(cond);
+}
+
+static inline void thread_cond_destroy(thread_cond_t *cond UNUSED)
+{
+}
+
+/*! Unlock mutex and sleep until woken, then lock it again */
+static inline void thread_cond_wait(thread_cond_t *cond,
+		thread_mutex_t *mutex)
+{
+	SleepConditionVariableSRW(cond, mutex, 0xFFFFFFFF, 0);	// INFINITE
+}
+
+/*! Wake everything waiting on cond */
+static inline void thread_cond_broadcast(thread_cond_t *cond)
+{
+	WakeAllConditionVariable(cond);
+}
+
+/*! Number of CPUs we can run on */
+static inline unsigned int thread_cpu_count(void)
+{
+	unsigned long count = GetActiveProcessorCount(0xFFFF);	// all groups
+	DWORD_PTR process, system;
+
+	// Restricted to some of them (in our group, anyway)
+	if(GetProcessAffinityMask(GetCurrentProcess(), &process, &system) &&
+		process != system)
+	{
+		count = 0;
+		for(; process != 0; process &= process - 1)
+		{
+			count++;
+		}
+	}
+
+	return (count < 1) ? 1 : (unsigned int)count;
+}
+
+/*! Keep the calling thread on the cpu'th CPU we may use (first 64 only) */
+static inline bool thread_pin_self(unsigned int cpu)
+{
+	DWORD_PTR process, system;
+
+	if(!GetProcessAffinityMask(GetCurrentProcess(), &process, &system))
+	{
+		return false;
+	}
+
+	for(unsigned int i = 0; i < sizeof(DWORD_PTR) * 8; i++)
+	{
+		if((process & ((DWORD_PTR)1 << i)) && cpu-- == 0)
+		{
+			return SetThreadAffinityMask(GetCurrentThread(),
+				(DWORD_PTR)1 << i) != 0;
+		}
+	}
+
+	return false;
+}
+
+#endif /*__THREAD_W32_H__*/
@@ -6,13 +6,13 @@
 #include "sgherm.h"	// emu_state
 
 /*!
- * @brief	Display an error and quit fast.
+ * @brief	Display an error and stop the instance.
  * @param	state	The state raising the error.  NULL if global.
  * @param	str	The format of the error to print.
- * @result	The error is printed and the program is immediately
- * 		terminated with an error exit code.
- * 		(atexit() methods are still run - use abort if you don't
- * 		like it.)
+ * @result	The error is printed (even if the instance is silenced),
+ * 		state->fatal_code is set and the instance stops at the next
+ * 		chance, as with do_exit.  The process carries on; only the
+ * 		sgherm executable turns this into an exit code.
  */
 void fatal(emu_state *state, const char *str, ...);
 
@@ -47,10 +47,4 @@ void warning(emu_state *state, const char *str, ...);
  */
 void debug(emu_state *state, const char *str, ...);
 
-/*! Where stdout goes with these functions */
-extern FILE *to_stdout;
-
-/*! Where stderr goes with these functions */
-extern FILE *to_stderr;
-
 #endif /*!__PRINT_H_*/
@@ -0,0 +1,19 @@
+#ifndef __REWIND_H__
+#define __REWIND_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+#include "typedefs.h"	// typedefs
+
+#include <stddef.h>	// size_t
+
+
+#define REWIND_MAX_SNAPSHOTS	65536	/*! Most snapshots kept, however small */
+
+rewind_buffer * rewind_create(const emu_state *restrict, size_t, unsigned int,
+		unsigned int);
+void rewind_destroy(rewind_buffer *);
+void rewind_frame(rewind_buffer *restrict, emu_state *restrict);
+bool rewind_back(rewind_buffer *restrict, emu_state *restrict);
+unsigned int rewind_count(const rewind_buffer *restrict);
+
+#endif /*__REWIND_H__*/
@@ -0,0 +1,20 @@
+#ifndef __SAVESTATE_H__
+#define __SAVESTATE_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+#include "typedefs.h"	// typedefs
+
+#include <stddef.h>	// size_t
+
+
+/*! Bump whenever a saved structure changes layout */
+#define SAVESTATE_VERSION	1
+
+uint32_t savestate_rom_id(const emu_state *restrict);
+size_t savestate_size(const emu_state *restrict);
+size_t savestate_save(emu_state *restrict, void *restrict, size_t);
+bool savestate_load(emu_state *restrict, const void *restrict, size_t);
+bool savestate_save_file(emu_state *restrict, const char *);
+bool savestate_load_file(emu_state *restrict, const char *);
+
+#endif /*__SAVESTATE_H__*/
@@ -4,19 +4,56 @@
 #include "config.h"	// macros,  uint[XX]_t
 #include "typedefs.h"	// typedefs
 
+#include <stddef.h>	// size_t
+
+
+#define SERIAL_BIT_CLOCKS	512	/*! Internal clock, 8192Hz */
+#define SERIAL_BIT_CLOCKS_FAST	16	/*! CGB fast internal clock, 262144Hz */
+#define SERIAL_NEVER		UINT64_MAX	/*! No transfer to finish */
+
+#define SERIAL_BUF_SIZE		256	/*! Output held back before flushing */
+#define SERIAL_MATCH_MAX	16	/*! Longest pattern that can be matched */
+
+/*! A byte sequence that decides the outcome of a test ROM */
+typedef struct serial_match_t
+{
+	const char *pattern;		/*! Bytes to look for */
+	size_t len;			/*! Length of pattern */
+	int exit_code;			/*! Exit status when it is seen */
+} serial_match;
 
 struct ser_state_t
 {
-	uint16_t curr_clk;		/*! ticks passed */
+	uint64_t next_event;		/*! cycle the transfer ends at */
 	uint8_t in, out;		/*! in / out values */
-	int8_t cur_bit;			/*! the current bit */
 	bool enabled;			/*! transfer active */
 	bool use_internal;		/*! clock source */
+
+	uint64_t link_next;		/*! cycle to next check the link at */
+	uint64_t link_due;		/*! cycle a linked transfer ends at */
+	bool link_pending;		/*! linked transfer in progress */
+	uint8_t link_in;		/*! byte it will deliver */
+
+	char buf[SERIAL_BUF_SIZE];	/*! bytes not yet written out */
+	uint16_t buf_len;		/*! bytes used in buf */
+	uint8_t tail[SERIAL_MATCH_MAX];	/*! last bytes sent, for matching */
+	bool matched;			/*! a pattern decided the run */
+	int exit_code;			/*! exit status from that pattern */
+
+	// Host side; never saved
+	const serial_match *matches;	/*! patterns to look for */
+	size_t match_count;		/*! number of patterns */
 };
 
+extern const serial_match serial_default_matches[];
+extern const size_t serial_default_match_count;
+
 
+void init_serial(emu_state *restrict);
 uint8_t serial_read(emu_state *restrict, uint16_t);
 void serial_write(emu_state *restrict, uint16_t, uint8_t);
 void serial_tick(emu_state *restrict state);
+void serial_set_matches(emu_state *restrict, const serial_match *, size_t);
+void serial_flush(emu_state *restrict);
 
 #endif /*!__SERIO_H_*/
@@ -12,6 +12,9 @@
 #include "input.h"	// input
 #include "ctl_unit.h"	// interrupts
 #include "frontend.h"	// frontend
+#include "snapshot.h"	// written_pages
+
+#include <stdio.h>	// FILE
 
 
 typedef enum
@@ -82,14 +85,21 @@ struct emu_state_t
 	uint_fast8_t bank;		/*! current ROM bank */
 	uint_fast8_t ram_bank;		/*! current RAM bank */
 
-	uint_fast32_t cycles;		/*! Present cycle count */
+	uint64_t cycles;		/*! Present cycle count */
 	uint64_t start_time;		/*! Time started */
+	uint32_t count_cur_second;	/*! Cycles into the emulated second */
+	uint32_t game_seconds;		/*! Emulated seconds so far */
 
 	system_types system;		/*! Present emulation mode */
 	cpu_freq freq;			/*! CPU frequency */
 
 	interrupt_state interrupts;
 
+	render_policy render;		/*! Which frames get drawn */
+	unsigned int render_skip;	/*! Draw every nth frame (RENDER_SKIP) */
+	bool render_request;		/*! Client wants the next frame */
+	unsigned int run_ahead;		/*! Frames the frontend shows ahead */
+
 	// hardware
 	lcdc_state lcdc;
 	snd_state snd;
@@ -97,7 +107,17 @@ struct emu_state_t
 	input_state input;
 	ser_state ser;
 
+	written_pages written;		/*! For snapshot_reset */
+
 	frontend front;
+	link_state *link;		/*! Link cable, if connected */
+	movie_state *movie;		/*! Input movie, if recording or playing */
+	uint64_t movie_next;		/*! Clock of its next event */
+
+	volatile bool do_exit;		/*! Stop running at the next chance */
+	int fatal_code;			/*! Set by fatal(); 0 if all is well */
+	FILE *to_stdout;		/*! Where our stdout goes (NULL: nowhere) */
+	FILE *to_stderr;		/*! Where our stderr goes (NULL: nowhere) */
 };
 
 
@@ -129,9 +149,13 @@ struct emu_state_t
 
 #define IS_FLAG(state, flag) ((REG_F(state) & (flag)) == flag)
 
+emu_state * create_emulator(frontend_type, frontend_type, frontend_type, frontend_type);
+bool load_rom(emu_state *restrict, const char *);
 emu_state * init_emulator(const char *, frontend_type, frontend_type, frontend_type, frontend_type);
+int run_emulator(emu_state *);
 void finish_emulator(emu_state *restrict state);
 bool step_emulator(emu_state *restrict);
-int main_common(emu_state *state);
+uint64_t run_cycles(emu_state *restrict, uint64_t);
+bool run_until_frame(emu_state *restrict);
 
 #endif /*!__SGHERM_H_*/
@@ -1,8 +1,8 @@
 #ifndef __SGH_SIGNALS_H__
 #define __SGH_SIGNALS_H__
 
-extern volatile bool do_exit;
+#include "typedefs.h"	// emu_state
 
-void register_handlers(void);
+void register_handlers(emu_state *);
 
 #endif
@@ -0,0 +1,33 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+#include "typedefs.h"	// typedefs
+
+
+#define SNAPSHOT_PAGE_SHIFT	8	/*! 256-byte pages */
+#define SNAPSHOT_BANK_SHIFT	13	/*! 8KiB banks, one word of pages each */
+
+/*! Pages written since the instance was last reset to a snapshot */
+struct written_pages_t
+{
+	uint32_t memory[4];		/*! 0x8000 up (below is ROM) */
+	uint32_t vram[2];		/*! Per bank */
+	uint32_t cart_ram[0x10];	/*! Per bank */
+	bool oam;			/*! OAM is under a page anyway */
+	const snapshot *base;		/*! What they were written since */
+};
+
+/*! Note a write to the page holding offset, from the start of the banks */
+static inline void snapshot_mark(uint32_t *restrict pages, uint32_t offset)
+{
+	pages[offset >> SNAPSHOT_BANK_SHIFT] |=
+		1UL << ((offset >> SNAPSHOT_PAGE_SHIFT) & 31);
+}
+
+snapshot * snapshot_take(emu_state *restrict);
+void snapshot_reset(const snapshot *restrict, emu_state *restrict);
+void snapshot_free(snapshot *);
+void snapshot_forget(emu_state *restrict);
+
+#endif /*__SNAPSHOT_H__*/
@@ -3,88 +3,135 @@
 
 #include "config.h"	// Various macros, uint[XX]_t
 #include "typedefs.h"	// typedefs
+#include "blip.h"	// blip_buffer
+#include "mixer.h"	// resampler
 
 
+#define SOUND_RATE		48000	/*! Output sample rate */
+#define SOUND_FRAME_CLOCKS	70224	/*! Clocks per audio frame (one video frame) */
+#define SOUND_FS_CLOCKS		8192	/*! Clocks per frame sequencer step (512Hz) */
+#define SOUND_LEVEL_SHIFT	8	/*! Scale of a 4-bit level in the blip buffers */
+#define SOUND_OUT_SIZE		(BLIP_BUF_SIZE * 2)	/*! Most stereo samples output per frame */
+#define LFSR15_PERIOD		32767	/*! Clocks before the 15-bit noise repeats */
+#define LFSR7_PERIOD		127	/*! Clocks before the 7-bit noise repeats */
+
+/*! Channels 1 and 2 (channel 2 has no sweep) */
+struct snd_square_t
+{
+	/*! channel enabled? */
+	bool enabled;
+	/*! this/128Hz = sweep */
+	uint8_t sweep_time;
+	/*! if true, sweep decreases frequency.
+	 *  otherwise, sweep increases frequency. */
+	bool sweep_dec;
+	/*! number of shift */
+	uint8_t shift;
+	/*! wave pattern duty: 0=12.5%,1=25%,2=50%,3=75% */
+	uint8_t wave_duty;
+	/*! sound length */
+	uint8_t length;
+	/*! initial envelope volume */
+	uint8_t envelope_volume;
+	/*! if true, envelope amplifies.
+	 *  otherwise, envelope attenuates. */
+	bool envelope_amp;
+	/*! number of sweeps (0 = stop) */
+	uint8_t sweep;
+	/*! if true, one-shot.  otherwise, loop */
+	bool counter;
+	/*! 11-bit frequency (higher 5 = nothing) */
+	uint16_t frequency;
+	/*! output to S01 */
+	bool s01;
+	/*! output to S02 */
+	bool s02;
+
+	uint16_t timer;			/*! clocks to the next duty step */
+	uint8_t duty_pos;		/*! position in the duty cycle */
+	uint8_t volume;			/*! current envelope volume */
+	uint8_t env_timer;		/*! envelope steps to the next change */
+	uint16_t length_counter;	/*! length steps left */
+	uint16_t shadow_freq;		/*! sweep's copy of the frequency */
+	uint8_t sweep_timer;		/*! sweep steps to the next change */
+	bool sweep_enabled;		/*! sweep unit running */
+};
+
 struct snd_state_t
 {
-	struct _ch1
-	{
-		/*! channel enabled? */
-		bool enabled;
-		/*! this/128Hz = sweep */
-		uint8_t sweep_time;
-		/*! if true, sweep decreases frequency.
-		 *  otherwise, sweep increases frequency. */
-		bool sweep_dec;
-		/*! number of shift */
-		uint8_t shift;
-		/*! wave pattern duty: 1=12.5%,2=25%,3=50%,4=75% */
-		uint8_t wave_duty;
-		/*! sound length */
-		uint8_t length;
-		/*! initial envelope volume */
-		uint8_t envelope_volume;
-		/*! if true, envelope amplifies.
-		 *  otherwise, envelope attenuates. */
-		bool envelope_amp;
-		/*! number of sweeps (0 = stop) */
-		uint8_t sweep;
-		/*! if true, one-shot.  otherwise, loop */
-		bool counter;
-		/*! 11-bit frequency (higher 5 = nothing) */
-		uint16_t frequency;
-		/*! output to S01 */
-		bool s01;
-		/*! output to S02 */
-		bool s02;
-	} ch1;
-	struct _ch2
-	{
-		/*! channel enabled? */
-		bool enabled;
-		/*! wave pattern duty: 1=12.5%,2=25%,3=50%,4=75% */
-		uint8_t wave_duty;
-		/*! sound length */
-		uint8_t length;
-		/*! initial envelope volume */
-		uint8_t envelope_volume;
-		/*! if true, envelope amplifies.
-		 *  otherwise, envelope attenuates. */
-		bool envelope_amp;
-		/*! number of sweeps (0 = stop) */
-		uint8_t sweep;
-		/*! if true, one-shot.  otherwise, loop */
-		bool counter;
-		/*! 11-bit frequency (higher 5 = nothing) */
-		uint16_t frequency;
-		/*! output to S01 */
-		bool s01;
-		/*! output to S02 */
-		bool s02;
-	} ch2;
+	struct snd_square_t ch1;
+	struct snd_square_t ch2;
 	struct _ch3
 	{
 		bool enabled;		/*! channel enabled? */
+		bool dac;		/*! DAC powered (NR30) */
 		uint8_t wave[16];	/*! waveform data */
+		uint8_t length;		/*! sound length */
+		uint8_t volume;		/*! output level code (NR32) */
+		bool counter;		/*! if true, one-shot */
+		uint16_t frequency;	/*! 11-bit frequency */
 		bool s01;		/*! output to S01 */
 		bool s02;		/*! output to S02 */
+
+		uint16_t timer;		/*! clocks to the next sample */
+		uint8_t pos;		/*! sample (nibble) being played */
+		uint16_t length_counter;	/*! length steps left */
 	} ch3;
 	struct _ch4
 	{
 		bool enabled;		/*! channel enabled? */
+		uint8_t length;		/*! sound length */
+		uint8_t envelope_volume;	/*! initial envelope volume */
+		bool envelope_amp;	/*! envelope amplifies */
+		uint8_t sweep;		/*! envelope period */
+		uint8_t clock_shift;	/*! shift clock frequency */
+		bool width7;		/*! 7-bit LFSR */
+		uint8_t divisor;	/*! dividing ratio code */
+		bool counter;		/*! if true, one-shot */
 		bool s01;		/*! output to S01 */
 		bool s02;		/*! output to S02 */
+
+		uint32_t timer;		/*! clocks to the next LFSR step */
+		uint16_t lfsr_pos;	/*! position in the LFSR sequence */
+		uint8_t volume;		/*! current envelope volume */
+		uint8_t env_timer;	/*! envelope steps to the next change */
+		uint16_t length_counter;	/*! length steps left */
 	} ch4;
 	bool enabled;			/*! sound active? */
 	bool s01;			/*! S01 enabled? */
 	uint8_t s01_volume;		/*! S01 volume */
 	bool s02;			/*! S02 enabled? */
 	uint8_t s02_volume;		/*! S02 volume */
+
+	uint64_t last;			/*! Cycle the channels were caught up to */
+	uint64_t next_event;		/*! Cycle the frame is pushed out at */
+	uint64_t fs_next;		/*! Cycle of the next frame sequencer step */
+	uint8_t fs_step;		/*! Frame sequencer step (0-7) */
+
+	uint64_t frame_start;		/*! Cycle the audio frame began at */
+	uint32_t frame_frac;		/*! Sample position the frame began at */
+	uint32_t rate;			/*! Output sample rate */
+	uint32_t factor;		/*! SOUND_RATE samples per clock (fixed point) */
+	int32_t skew;			/*! Rate adjustment (ppm) */
+	resampler rs;			/*! SOUND_RATE to rate */
+	int32_t dc[2];			/*! DC offset being removed (L, R) */
+
+	blip_buffer blip[4];		/*! One per channel */
+
+	// The last frame's output; save states stop here (see savestate.c)
+	int16_t chan_out[4][BLIP_BUF_SIZE];	/*! Last frame, per channel */
+	int16_t mix[BLIP_BUF_SIZE * 2];	/*! Last frame mixed, at SOUND_RATE */
+	int16_t out[SOUND_OUT_SIZE * 2];	/*! Last frame, stereo interleaved */
+	size_t out_len;			/*! Stereo samples in out */
 };
 
 
+void init_sound(emu_state *restrict);
 uint8_t sound_read(emu_state *restrict, uint16_t);
 void sound_write(emu_state *restrict, uint16_t, uint8_t);
 void sound_tick(emu_state *restrict);
+size_t sound_output(emu_state *restrict, const int16_t **);
+void sound_set_output_rate(emu_state *restrict, uint32_t);
+void sound_set_rate_skew(emu_state *restrict, int32_t);
 
 #endif /*!__SOUND_H_*/
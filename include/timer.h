@@ -7,13 +7,21 @@
 #include <stdio.h>	// perror
 
 
+#define TIMER_DIV_CLOCKS	256		/*! Clocks per DIV increment */
+#define TIMER_NEVER		UINT64_MAX	/*! No overflow pending */
+
+/*!
+ * DIV and TIMA are not stepped; they are worked out from the global cycle
+ * counter when read, and the overflow is scheduled ahead of time.
+ */
 struct timer_state_t
 {
-	uint8_t div;			/*! DIV register */
-	uint8_t tima;			/*! TIMA register */
-	uint8_t rounds;			/*! TMA register */
+	uint64_t div_base;		/*! Cycle DIV was last reset at */
+	uint64_t tima_base;		/*! Cycle tima was last brought up to date */
+	uint64_t next_event;		/*! Cycle TIMA next overflows at */
+	uint8_t tima;			/*! TIMA register as of tima_base */
+	uint8_t tma;			/*! TMA register */
 	uint16_t ticks_per_tima;	/*! ticks per TIMA++ */
-	uint8_t curr_clk;		/*! ticks passed */
 	bool enabled;			/*! timer armed */
 };
 
@@ -25,6 +33,9 @@ typedef enum
 } cpu_freq;
 
 
+extern const uint16_t timer_ticks[4];
+
+void init_timer(emu_state *restrict);
 uint8_t timer_read(emu_state *restrict, uint16_t);
 void timer_write(emu_state *restrict, uint16_t, uint8_t);
 void timer_tick(emu_state *restrict);
@@ -14,11 +14,18 @@ typedef struct emu_state_t emu_state;
 typedef struct interrupt_state_t interrupt_state;
 typedef struct input_state_t input_state;
 typedef struct lcdc_state_t lcdc_state;
+typedef struct link_state_t link_state;
+typedef struct capture_state_t capture_state;
 typedef struct cart_header_t cart_header;
 typedef struct ser_state_t ser_state;
 typedef struct registers_t register_state;
+typedef struct movie_state_t movie_state;
+typedef struct rewind_buffer_t rewind_buffer;
+typedef struct snapshot_t snapshot;
 typedef struct snd_state_t snd_state;
 typedef struct timer_state_t timer_state;
+typedef struct vecenv_t vecenv;
+typedef struct written_pages_t written_pages;
 
 // Depends on emu_state *sigh*
 typedef int (*frontend_event_loop)(emu_state *);
@@ -3,8 +3,14 @@
 
 #include "config.h"		// macros, bool, uint[XX]_t
 
+#include <stddef.h>		// size_t
+
 // Functions
 uint32_t interleave(uint32_t);
 void interleaved_to_buf(uint32_t, uint8_t *);
 
+#define FNV1A_INIT	0x811C9DC5
+
+uint32_t fnv1a(const void *, size_t, uint32_t);
+
 #endif /*__UTIL_H__*/
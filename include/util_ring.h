@@ -0,0 +1,153 @@
+#ifndef __UTIL_RING_H__
+#define __UTIL_RING_H__
+
+#include "config.h"		// macros, bool, uint[XX]_t
+
+#include <stddef.h>		// size_t
+#include <string.h>		// memcpy
+
+/*!
+ * Single-producer, single-consumer ring of 64-bit words.
+ *
+ * No pointers live inside, so it can be placed in memory shared between
+ * processes.  The producer only writes head, the consumer only writes tail.
+ */
+
+#define RING_SIZE	64	/*! Slots in a ring; must be a power of two */
+
+typedef struct spsc_ring_t
+{
+	alignment(64) volatile uint32_t head;	/*! Next slot to write */
+	alignment(64) volatile uint32_t tail;	/*! Next slot to read */
+	alignment(64) uint64_t slots[RING_SIZE];
+} spsc_ring;
+
+/*!
+ * @brief	Add a word to the ring.
+ * @param	ring	The ring to add to (producer side only).
+ * @param	value	The word to add.
+ * @returns	false if the ring is full.
+ */
+static inline bool ring_push(spsc_ring *ring, uint64_t value)
+{
+	uint32_t head = ring->head;
+
+	if(unlikely(head - load_acquire(&(ring->tail)) == RING_SIZE))
+	{
+		return false;
+	}
+
+	ring->slots[head & (RING_SIZE - 1)] = value;
+	store_release(&(ring->head), head + 1);
+
+	return true;
+}
+
+/*!
+ * @brief	Take a word from the ring.
+ * @param	ring	The ring to take from (consumer side only).
+ * @param	value	Where to store the word.
+ * @returns	false if the ring is empty.
+ */
+static inline bool ring_pop(spsc_ring *ring, uint64_t *value)
+{
+	uint32_t tail = ring->tail;
+
+	if(load_acquire(&(ring->head)) == tail)
+	{
+		return false;
+	}
+
+	*value = ring->slots[tail & (RING_SIZE - 1)];
+	store_release(&(ring->tail), tail + 1);
+
+	return true;
+}
+
+/*!
+ * Single-producer, single-consumer ring of samples, moved in bulk.
+ *
+ * Same rules as spsc_ring; the storage is supplied by the owner and its
+ * size must be a power of two.
+ */
+typedef struct sample_ring_t
+{
+	alignment(64) volatile uint32_t head;	/*! Next sample to write */
+	alignment(64) volatile uint32_t tail;	/*! Next sample to read */
+	uint32_t size;				/*! Samples in buf */
+	int16_t *buf;
+} sample_ring;
+
+/*! Samples waiting to be read (either side) */
+static inline uint32_t sample_ring_used(sample_ring *ring)
+{
+	return load_acquire(&(ring->head)) - load_acquire(&(ring->tail));
+}
+
+/*!
+ * @brief	Add samples to the ring.
+ * @param	ring	The ring to add to (producer side only).
+ * @param	data	The samples to add.
+ * @param	count	The number of samples.
+ * @returns	The number of samples added; less than count if full.
+ */
+static inline size_t sample_ring_write(sample_ring *ring, const int16_t *data,
+		size_t count)
+{
+	uint32_t head = ring->head;
+	uint32_t space = ring->size - (head - load_acquire(&(ring->tail)));
+	uint32_t start = head & (ring->size - 1);
+	size_t first;
+
+	if(count > space)
+	{
+		count = space;
+	}
+
+	first = ring->size - start;
+	if(first > count)
+	{
+		first = count;
+	}
+
+	memcpy(ring->buf + start, data, first * sizeof(int16_t));
+	memcpy(ring->buf, data + first, (count - first) * sizeof(int16_t));
+	store_release(&(ring->head), head + (uint32_t)count);
+
+	return count;
+}
+
+/*!
+ * @brief	Take samples from the ring.
+ * @param	ring	The ring to take from (consumer side only).
+ * @param	data	Where to put the samples.
+ * @param	count	The most samples to take.
+ * @returns	The number of samples taken; less than count if empty.
+ */
+static inline size_t sample_ring_read(sample_ring *ring, int16_t *data,
+		size_t count)
+{
+	uint32_t tail = ring->tail;
+	uint32_t used = load_acquire(&(ring->head)) - tail;
+	uint32_t start = tail & (ring->size - 1);
+	size_t first;
+
+	if(count > used)
+	{
+		count = used;
+	}
+
+	first = ring->size - start;
+	if(first > count)
+	{
+		first = count;
+	}
+
+	memcpy(data, ring->buf + start, first * sizeof(int16_t));
+	memcpy(data + first, ring->buf, (count - first) * sizeof(int16_t));
+	store_release(&(ring->tail), tail + (uint32_t)count);
+
+	return count;
+}
+
+#endif /*__UTIL_RING_H__*/
@@ -0,0 +1,50 @@
+#ifndef __UTIL_THREAD_H__
+#define __UTIL_THREAD_H__
+
+#include "config.h"		// macros, bool, uint[XX]_t
+
+// Include the appropriate thread functions
+#ifdef HAVE_POSIX
+#	include "platform/thread_posix.h"
+#elif defined(_WIN32)
+#	include "platform/thread_w32.h"
+#else
+#	include "platform/thread_null.h"
+#endif
+
+/*! Guard for thread_once */
+typedef struct thread_once_t_
+{
+	volatile uint32_t started;
+	volatile uint32_t done;
+} thread_once_t;
+
+#define THREAD_ONCE_INIT	{ 0, 0 }
+
+/*!
+ * @brief	Run fn exactly once, however many threads get here.
+ * @param	once	Guard, initialised with THREAD_ONCE_INIT.
+ * @param	fn	Function to run.
+ * @result	fn has finished by the time any caller returns.
+ */
+static inline void thread_once(thread_once_t *once, void (*fn)(void))
+{
+	if(likely(load_acquire(&(once->done))))
+	{
+		return;
+	}
+
+	if(atomic_inc(&(once->started)) == 1)
+	{
+		fn();
+		store_release(&(once->done), 1);
+		return;
+	}
+
+	while(!load_acquire(&(once->done)))
+	{
+		thread_yield();
+	}
+}
+
+#endif /*__UTIL_THREAD_H__*/
@@ -0,0 +1,33 @@
+#ifndef __VECENV_H__
+#define __VECENV_H__
+
+#include "config.h"	// macros, bool, uint[XX]_t
+#include "typedefs.h"	// typedefs
+
+
+/*! Action bits; an action is the buttons held for the whole step */
+#define VECENV_RIGHT	0x01
+#define VECENV_LEFT	0x02
+#define VECENV_UP	0x04
+#define VECENV_DOWN	0x08
+#define VECENV_A	0x10
+#define VECENV_B	0x20
+#define VECENV_SELECT	0x40
+#define VECENV_START	0x80
+
+#define VECENV_ALL	UINT32_MAX	/*! vecenv_reset: every instance */
+
+vecenv * vecenv_create(const char *, const char *, uint32_t, unsigned int,
+		const uint16_t *, unsigned int);
+void vecenv_destroy(vecenv *);
+
+void vecenv_step(vecenv *restrict, const uint8_t *restrict, unsigned int);
+void vecenv_reset(vecenv *restrict, uint32_t);
+
+const uint8_t * vecenv_observations(const vecenv *restrict);
+const uint8_t * vecenv_probes(const vecenv *restrict);
+const uint8_t * vecenv_done(const vecenv *restrict);
+uint32_t vecenv_count(const vecenv *restrict);
+emu_state * vecenv_instance(vecenv *restrict, uint32_t);
+
+#endif /*__VECENV_H__*/
@@ -0,0 +1,909 @@
+#define _GNU_SOURCE		// pthread_setaffinity_np, via util_thread.h
+
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include "batch.h"	// batch_job, batch_result, forkserver_main
+#include "capture.h"	// capture_open, capture_close
+#include "frontend.h"	// FRONT_NULL
+#include "input.h"	// joypad_signal, input_key
+#include "lcdc.h"	// set_render_policy, LCDC_FRAME_CLOCKS
+#include "movie.h"	// movie_*
+#include "print.h"	// error
+#include "savestate.h"	// savestate_load_file, savestate_save_file
+#include "serio.h"	// serial_set_matches
+#include "sgherm.h"	// emu_state, create_emulator, run_*
+#include "util_thread.h"	// thread_*
+#include "util_time.h"	// get_time
+
+#include <ctype.h>	// isspace
+#include <stdio.h>	// FILE, fopen, fprintf
+#include <stdlib.h>	// calloc, free, strtoull, qsort
+#include <string.h>	// strcmp, strncmp, strchr
+
+
+/*
+ * sgherm-batch: run a manifest of ROM jobs across every core.
+ *
+ * Each manifest line is one job; '#' starts a comment.  The first word is
+ * the ROM, the rest are key=value options:
+ *
+ *	frames=N	stop after N frames
+ *	cycles=N	stop after N clocks (one of frames/cycles/movie is
+ *			required)
+ *	input=FILE	joypad script: "frame key down|up" per line
+ *	audio=FILE	capture audio (.wav, or raw PCM)
+ *	audio_hashes=FILE	one hash per audio frame
+ *	serial=FILE	where serial output goes (default: nowhere)
+ *	log=FILE	where messages go (default: nowhere)
+ *	state_in=FILE	start from a save state
+ *	state_out=FILE	save the state at the end
+ *	movie=FILE	play an input movie; with no limit, runs its length
+ *	movie_out=FILE	record the job's input as a movie
+ *
+ * Test ROMs that report over serial stop early as "pass" or "fail".  A ROM
+ * the emulator gives up on (bad opcode, unsupported mapper) stops early as
+ * "fatal", and one that can't be loaded is a "load-error"; either way the
+ * other jobs carry on.  One tab-separated record is written per job as it
+ * finishes.  Only the last frames before the limit are drawn, so a job that
+ * stops before then has "-" for its frame hash.
+ *
+ * With -S, it's a fork-server for one ROM instead (see forkserver.c).
+ */
+
+
+typedef struct batch_event_t
+{
+	uint64_t frame;
+	unsigned int order;		/*! Script line, to keep ties in order */
+	input_key key;
+	bool press;
+} batch_event;
+
+/*!
+ * One worker's share of the jobs: indices lo to hi-1.  The owner takes
+ * from the bottom; a thief takes the top half.  Jobs never spawn jobs, so
+ * once every deque is empty the work is done.
+ */
+typedef struct batch_deque_t
+{
+	alignment(64) thread_mutex_t lock;
+	unsigned int lo, hi;
+} batch_deque;
+
+typedef struct batch_pool_t batch_pool;
+
+typedef struct batch_worker_t
+{
+	batch_pool *pool;
+	unsigned int index;
+	thread_t thread;
+	bool started;			/*! thread is running (needs joining) */
+	batch_deque deque;
+} batch_worker;
+
+struct batch_pool_t
+{
+	batch_job *jobs;
+	unsigned int job_count;
+
+	batch_worker *workers;
+	unsigned int worker_count;
+	bool pin;			/*! Pin worker n to the nth CPU we may use */
+	unsigned int cpus;		/*! CPUs we may use */
+
+	thread_mutex_t out_lock;	/*! Guards out and the totals */
+	FILE *out;
+	unsigned int failed;		/*! Jobs that didn't reach their limit */
+	uint64_t total_cycles;
+};
+
+static const struct
+{
+	const char *name;
+	input_key key;
+} batch_keys[] =
+{
+	{ "up", INPUT_UP },
+	{ "down", INPUT_DOWN },
+	{ "left", INPUT_LEFT },
+	{ "right", INPUT_RIGHT },
+	{ "a", INPUT_A },
+	{ "b", INPUT_B },
+	{ "select", INPUT_SELECT },
+	{ "start", INPUT_START },
+};
+
+
+/*! Split off the next whitespace-separated word; NULL at the end */
+static char * batch_word(char **cursor)
+{
+	char *p = *cursor, *word;
+
+	while(*p && isspace((unsigned char)*p))
+	{
+		p++;
+	}
+
+	if(*p == '\0' || *p == '#')
+	{
+		*cursor = p;
+		return NULL;
+	}
+
+	word = p;
+	while(*p && !isspace((unsigned char)*p))
+	{
+		p++;
+	}
+
+	if(*p)
+	{
+		*p++ = '\0';
+	}
+
+	*cursor = p;
+	return word;
+}
+
+/*!
+ * @brief	Fill in a job's key=value options.
+ * @param	job	Job to fill in; the strings point into cursor.
+ * @param	cursor	The options, which are split up in place.
+ * @param	where	Name of the source, for messages.
+ * @param	lineno	Line of the source, for messages.
+ * @returns	false if an option is bad or there's no limit.
+ */
+bool batch_parse_options(batch_job *job, char *cursor, const char *where,
+		unsigned int lineno)
+{
+	char *word;
+
+	while((word = batch_word(&cursor)) != NULL)
+	{
+		char *value = strchr(word, '=');
+
+		if(value == NULL)
+		{
+			fprintf(stderr, "%s:%u: expected key=value, got %s\n",
+				where, lineno, word);
+			return false;
+		}
+
+		*value++ = '\0';
+
+		if(strcmp(word, "frames") == 0)
+		{
+			job->frames = strtoull(value, NULL, 0);
+		}
+		else if(strcmp(word, "cycles") == 0)
+		{
+			job->cycles = strtoull(value, NULL, 0);
+		}
+		else if(strcmp(word, "input") == 0)
+		{
+			job->input = value;
+		}
+		else if(strcmp(word, "audio") == 0)
+		{
+			job->audio = value;
+		}
+		else if(strcmp(word, "audio_hashes") == 0)
+		{
+			job->audio_hashes = value;
+		}
+		else if(strcmp(word, "serial") == 0)
+		{
+			job->serial = value;
+		}
+		else if(strcmp(word, "log") == 0)
+		{
+			job->log = value;
+		}
+		else if(strcmp(word, "state_in") == 0)
+		{
+			job->state_in = value;
+		}
+		else if(strcmp(word, "state_out") == 0)
+		{
+			job->state_out = value;
+		}
+		else if(strcmp(word, "movie") == 0)
+		{
+			job->movie = value;
+		}
+		else if(strcmp(word, "movie_out") == 0)
+		{
+			job->movie_out = value;
+		}
+		else
+		{
+			fprintf(stderr, "%s:%u: unknown key %s\n", where,
+				lineno, word);
+			return false;
+		}
+	}
+
+	if(job->frames == 0 && job->cycles == 0 && job->movie == NULL)
+	{
+		fprintf(stderr, "%s:%u: needs frames=, cycles= or movie=\n",
+			where, lineno);
+		return false;
+	}
+
+	return true;
+}
+
+/*! Fill in a job from a (non-blank) manifest line; false if it's bad */
+static bool batch_parse_job(batch_job *job, char *line, unsigned int lineno)
+{
+	char *cursor = line;
+
+	job->rom = batch_word(&cursor);
+	job->line = line;
+
+	return batch_parse_options(job, cursor, "manifest", lineno);
+}
+
+/*! Read every job in a manifest; returns the count, 0 on error */
+static unsigned int batch_read_manifest(const char *path, batch_job **jobs)
+{
+	FILE *f = fopen(path, "r");
+	char buf[4096];
+	unsigned int count = 0, size = 0, lineno = 0;
+
+	*jobs = NULL;
+
+	if(f == NULL)
+	{
+		perror("fopen");
+		return 0;
+	}
+
+	while(fgets(buf, sizeof(buf), f) != NULL)
+	{
+		size_t skip = strspn(buf, " \t\r\n");
+		batch_job job = { 0 };
+		char *line;
+
+		lineno++;
+
+		// Half a line would be read as two bogus jobs
+		if(strchr(buf, '\n') == NULL && !feof(f))
+		{
+			fprintf(stderr, "%s:%u: line is longer than %zu bytes\n",
+				path, lineno, sizeof(buf) - 2);
+			goto fail;
+		}
+
+		if(buf[skip] == '\0' || buf[skip] == '#')
+		{
+			continue;
+		}
+
+		if((line = strdup(buf)) == NULL || !batch_parse_job(&job, line, lineno))
+		{
+			free(line);
+			goto fail;
+		}
+
+		if(count == size)
+		{
+			batch_job *grown = realloc(*jobs,
+				(size ? size * 2 : 64) * sizeof(batch_job));
+
+			if(grown == NULL)
+			{
+				fprintf(stderr, "%s:%u: out of memory\n", path,
+					lineno);
+				free(line);
+				goto fail;
+			}
+
+			*jobs = grown;
+			size = size ? size * 2 : 64;
+		}
+
+		job.id = count;
+		(*jobs)[count++] = job;
+	}
+
+	fclose(f);
+	return count;
+
+fail:
+	for(unsigned int i = 0; i < count; i++)
+	{
+		free((*jobs)[i].line);
+	}
+	free(*jobs);
+	*jobs = NULL;
+
+	fclose(f);
+	return 0;
+}
+
+static int batch_event_cmp(const void *a, const void *b)
+{
+	const batch_event *x = a, *y = b;
+
+	if(x->frame != y->frame)
+	{
+		return (x->frame < y->frame) ? -1 : 1;
+	}
+
+	return (int)x->order - (int)y->order;
+}
+
+/*! Load an input script, sorted by frame; NULL and 0 if there's none */
+static batch_event * batch_read_input(emu_state *state, const char *path,
+		size_t *count)
+{
+	FILE *f;
+	char buf[256];
+	batch_event *events = NULL;
+	size_t size = 0;
+
+	*count = 0;
+
+	if(path == NULL)
+	{
+		return NULL;
+	}
+
+	if((f = fopen(path, "r")) == NULL)
+	{
+		error(state, "batch: can't open input script %s", path);
+		return NULL;
+	}
+
+	while(fgets(buf, sizeof(buf), f) != NULL)
+	{
+		char *cursor = buf, *frame, *key, *action;
+		batch_event ev = { 0 };
+		size_t i;
+
+		if(strchr(buf, '\n') == NULL && !feof(f))
+		{
+			int c;
+
+			error(state, "batch: line too long in %s", path);
+			do
+			{
+				c = fgetc(f);
+			} while(c != EOF && c != '\n');
+			continue;
+		}
+
+		if((frame = batch_word(&cursor)) == NULL)
+		{
+			continue;
+		}
+
+		key = batch_word(&cursor);
+		action = batch_word(&cursor);
+		if(key == NULL || action == NULL)
+		{
+			error(state, "batch: bad line in %s", path);
+			continue;
+		}
+
+		for(i = 0; i < sizeof(batch_keys) / sizeof(*batch_keys); i++)
+		{
+			if(strcmp(key, batch_keys[i].name) == 0)
+			{
+				break;
+			}
+		}
+
+		if(i == sizeof(batch_keys) / sizeof(*batch_keys))
+		{
+			error(state, "batch: unknown key %s in %s", key, path);
+			continue;
+		}
+
+		ev.frame = strtoull(frame, NULL, 0);
+		ev.order = (unsigned int)*count;
+		ev.key = batch_keys[i].key;
+		ev.press = (strcmp(action, "down") == 0);
+
+		if(*count == size)
+		{
+			batch_event *grown = realloc(events,
+				(size ? size * 2 : 64) * sizeof(batch_event));
+
+			if(grown == NULL)
+			{
+				// Go with what there is
+				error(state, "batch: out of memory reading %s", path);
+				break;
+			}
+
+			events = grown;
+			size = size ? size * 2 : 64;
+		}
+
+		events[(*count)++] = ev;
+	}
+
+	fclose(f);
+
+	qsort(events, *count, sizeof(batch_event), &batch_event_cmp);
+	return events;
+}
+
+/*! Write a job's record; called as each one finishes */
+static void batch_report(batch_pool *pool, const batch_job *job,
+		const char *reason, int exit_code, uint64_t frames,
+		uint64_t cycles, uint64_t ns, const char *frame_hash)
+{
+	thread_mutex_lock(&(pool->out_lock));
+
+	fprintf(pool->out, "%u\t%s\t%s\t%d\t%llu\t%llu\t%.6f\t%s\n", job->id,
+		job->rom, reason, exit_code, (unsigned long long)frames,
+		(unsigned long long)cycles, ns / 1e9, frame_hash);
+	fflush(pool->out);
+
+	if(strcmp(reason, "limit") != 0 && strcmp(reason, "pass") != 0)
+	{
+		pool->failed++;
+	}
+	pool->total_cycles += cycles;
+
+	thread_mutex_unlock(&(pool->out_lock));
+}
+
+/*! Open a job's serial and log files; NULL for each one it doesn't want */
+void batch_open_outputs(const batch_job *job, FILE **serial, FILE **log)
+{
+	*serial = *log = NULL;
+
+	if(job->serial != NULL && (*serial = fopen(job->serial, "wb")) == NULL)
+	{
+		perror("batch: serial");
+	}
+	if(job->log != NULL && (*log = fopen(job->log, "w")) == NULL)
+	{
+		perror("batch: log");
+	}
+}
+
+void batch_close_outputs(FILE *serial, FILE *log)
+{
+	if(serial != NULL)
+	{
+		fclose(serial);
+	}
+	if(log != NULL)
+	{
+		fclose(log);
+	}
+}
+
+/*!
+ * @brief	Run a job on a loaded instance until it stops.
+ * @param	state	Instance to run, from wherever it is now.
+ * @param	job	The job; its limits count from where state is.
+ * @param	res	Filled in with how it went.
+ */
+void batch_execute(emu_state *restrict state, const batch_job *job,
+		batch_result *res)
+{
+	uint64_t frames = 0, first = state->cycles, limit = job->cycles;
+	uint32_t drawn_from = 0;
+	bool drawing = false;
+	batch_event *events;
+	size_t event_count, next = 0;
+	bool capturing = false, capture_ok;
+
+	res->reason = "limit";
+	res->exit_code = 0;
+
+	// Only the last frame or two need drawing, for the hash
+	set_render_policy(state, RENDER_NEVER, 0);
+
+	if(job->state_in != NULL && !savestate_load_file(state, job->state_in))
+	{
+		res->reason = "state-error";
+		state->do_exit = true;
+	}
+
+	// A movie may start from its own state
+	if(job->movie != NULL && !state->do_exit)
+	{
+		if(!movie_play(state, job->movie))
+		{
+			res->reason = "movie-error";
+			state->do_exit = true;
+		}
+		else if(job->frames == 0 && limit == 0 &&
+			(limit = movie_length(state)) == 0)
+		{
+			// Nothing to play
+			state->do_exit = true;
+		}
+	}
+	else if(job->movie_out != NULL && !state->do_exit &&
+		!movie_record(state, job->movie_out))
+	{
+		res->reason = "movie-error";
+		state->do_exit = true;
+	}
+	first = state->cycles;
+
+	if(job->audio != NULL || job->audio_hashes != NULL)
+	{
+		if(!(capturing = capture_open(state, job->audio,
+			job->audio_hashes)))
+		{
+			res->reason = "capture-error";
+			state->do_exit = true;
+		}
+	}
+
+	events = batch_read_input(state, job->input, &event_count);
+
+	while(!state->do_exit)
+	{
+		bool near_end;
+		uint64_t left = 0;
+
+		while(next < event_count && events[next].frame <= frames)
+		{
+			joypad_signal(state, events[next].key, events[next].press);
+			next++;
+		}
+
+		if(job->frames != 0 && frames >= job->frames)
+		{
+			break;
+		}
+
+		near_end = (job->frames != 0 && job->frames - frames <= 2);
+
+		if(limit != 0)
+		{
+			if(state->cycles - first >= limit)
+			{
+				break;
+			}
+
+			left = limit - (state->cycles - first);
+			near_end |= (left <= 2 * LCDC_FRAME_CLOCKS);
+		}
+
+		if(near_end && !drawing)
+		{
+			set_render_policy(state, RENDER_ALWAYS, 0);
+			drawn_from = state->lcdc.frames;
+			drawing = true;
+		}
+
+		if(limit != 0 && left <= LCDC_FRAME_CLOCKS)
+		{
+			run_cycles(state, left);
+			continue;
+		}
+
+		if(!run_until_frame(state))
+		{
+			break;
+		}
+
+		frames++;
+	}
+
+	free(events);
+	movie_close(state);
+
+	// A capture with holes in it is no good for comparing
+	capture_ok = !capturing || capture_close(state);
+
+	if(state->ser.matched)
+	{
+		res->exit_code = state->ser.exit_code;
+		res->reason = (res->exit_code == 0) ? "pass" : "fail";
+	}
+
+	// Whatever it said before then doesn't count
+	if(state->fatal_code != 0)
+	{
+		res->exit_code = state->fatal_code;
+		res->reason = "fatal";
+	}
+	else if(!capture_ok)
+	{
+		res->reason = "capture-error";
+	}
+
+	if(job->state_out != NULL && strcmp(res->reason, "state-error") != 0 &&
+		!savestate_save_file(state, job->state_out))
+	{
+		res->reason = "state-error";
+	}
+
+	res->frames = frames;
+	res->cycles = state->cycles - first;
+	res->frame_hash = state->lcdc.frame_hash;
+	res->frame_hashed = drawing && state->lcdc.frames != drawn_from;
+}
+
+/*! A result's frame hash for a record: hex, or "-" if it has none */
+const char * batch_hash_text(const batch_result *res,
+		char text[BATCH_HASH_TEXT])
+{
+	if(!res->frame_hashed)
+	{
+		return "-";
+	}
+
+	snprintf(text, BATCH_HASH_TEXT, "%08X", res->frame_hash);
+	return text;
+}
+
+static void batch_run(batch_pool *pool, const batch_job *job)
+{
+	uint64_t start = get_time();
+	emu_state *state = create_emulator(FRONT_NULL, FRONT_NULL, FRONT_NULL,
+			FRONT_NULL);
+	FILE *serial, *log;
+	batch_result res;
+	char hash[BATCH_HASH_TEXT];
+
+	if(state == NULL)
+	{
+		batch_report(pool, job, "no-memory", -1, 0, 0, 0, "-");
+		return;
+	}
+
+	batch_open_outputs(job, &serial, &log);
+	state->to_stdout = serial;
+	state->to_stderr = log;
+
+	if(!load_rom(state, job->rom))
+	{
+		batch_report(pool, job, "load-error", -1, 0, 0,
+			get_time() - start, "-");
+		free(state->cart_data);
+		free(state);
+		batch_close_outputs(serial, log);
+		return;
+	}
+
+	serial_set_matches(state, serial_default_matches,
+			serial_default_match_count);
+
+	batch_execute(state, job, &res);
+
+	batch_report(pool, job, res.reason, res.exit_code, res.frames,
+		res.cycles, get_time() - start, batch_hash_text(&res, hash));
+
+	finish_emulator(state);
+	batch_close_outputs(serial, log);
+}
+
+/*! Take the next job from our own deque */
+static bool batch_pop(batch_deque *deque, unsigned int *job)
+{
+	bool found = false;
+
+	thread_mutex_lock(&(deque->lock));
+	if(deque->lo < deque->hi)
+	{
+		*job = deque->lo++;
+		found = true;
+	}
+	thread_mutex_unlock(&(deque->lock));
+
+	return found;
+}
+
+/*! Move the top half of someone else's jobs into our (empty) deque */
+static bool batch_steal(batch_worker *self)
+{
+	batch_pool *pool = self->pool;
+
+	for(unsigned int i = 1; i < pool->worker_count; i++)
+	{
+		batch_deque *victim =
+			&(pool->workers[(self->index + i) % pool->worker_count].deque);
+		unsigned int lo = 0, hi = 0;
+
+		thread_mutex_lock(&(victim->lock));
+		if(victim->lo < victim->hi)
+		{
+			unsigned int take = (victim->hi - victim->lo + 1) / 2;
+
+			hi = victim->hi;
+			lo = victim->hi = hi - take;
+		}
+		thread_mutex_unlock(&(victim->lock));
+
+		if(lo < hi)
+		{
+			thread_mutex_lock(&(self->deque.lock));
+			self->deque.lo = lo;
+			self->deque.hi = hi;
+			thread_mutex_unlock(&(self->deque.lock));
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void batch_worker_main(void *data)
+{
+	batch_worker *self = data;
+	batch_pool *pool = self->pool;
+	unsigned int job;
+
+	if(pool->pin)
+	{
+		thread_pin_self(self->index % pool->cpus);
+	}
+
+	for(;;)
+	{
+		while(batch_pop(&(self->deque), &job))
+		{
+			batch_run(pool, &(pool->jobs[job]));
+		}
+
+		if(!batch_steal(self))
+		{
+			return;
+		}
+	}
+}
+
+static void batch_usage(void)
+{
+	fprintf(stderr, "usage: sgherm-batch [-j threads] [-o results] "
+		"[-P] manifest\n"
+		"       sgherm-batch -S socket [-C frames] rom\n"
+		"  -j n\tworkers (default: one per CPU)\n"
+		"  -o f\twrite result records to f (default: stdout)\n"
+		"  -P\tdon't pin workers to CPUs\n"
+		"  -S f\tfork a copy of rom for each job sent to socket f\n"
+		"  -C n\trun rom for n frames before serving jobs\n");
+}
+
+int main(int argc, char *argv[])
+{
+	batch_pool pool = { 0 };
+	const char *out_path = NULL, *socket_path = NULL;
+	unsigned int threads = 0;
+	uint64_t checkpoint = 0;
+	uint64_t start;
+	double taken;
+	int arg;
+
+	pool.pin = true;
+	pool.cpus = thread_cpu_count();
+
+	for(arg = 1; arg < argc && argv[arg][0] == '-'; arg++)
+	{
+		if(strcmp(argv[arg], "-j") == 0 && arg + 1 < argc)
+		{
+			threads = (unsigned int)strtoul(argv[++arg], NULL, 0);
+		}
+		else if(strcmp(argv[arg], "-o") == 0 && arg + 1 < argc)
+		{
+			out_path = argv[++arg];
+		}
+		else if(strcmp(argv[arg], "-P") == 0)
+		{
+			pool.pin = false;
+		}
+		else if(strcmp(argv[arg], "-S") == 0 && arg + 1 < argc)
+		{
+			socket_path = argv[++arg];
+		}
+		else if(strcmp(argv[arg], "-C") == 0 && arg + 1 < argc)
+		{
+			checkpoint = strtoull(argv[++arg], NULL, 0);
+		}
+		else
+		{
+			batch_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(arg + 1 != argc)
+	{
+		batch_usage();
+		return EXIT_FAILURE;
+	}
+
+	if(socket_path != NULL)
+	{
+		return forkserver_main(argv[arg], socket_path, checkpoint);
+	}
+
+	if((pool.job_count = batch_read_manifest(argv[arg], &pool.jobs)) == 0)
+	{
+		fprintf(stderr, "No jobs in %s\n", argv[arg]);
+		return EXIT_FAILURE;
+	}
+
+	if(threads == 0)
+	{
+		threads = pool.cpus;
+	}
+	if(threads > pool.job_count)
+	{
+		threads = pool.job_count;
+	}
+
+	pool.out = stdout;
+	if(out_path != NULL && (pool.out = fopen(out_path, "w")) == NULL)
+	{
+		perror("fopen");
+		return EXIT_FAILURE;
+	}
+
+	fprintf(pool.out, "job\trom\treason\texit\tframes\tcycles\tseconds\t"
+		"frame_hash\n");
+
+	thread_mutex_init(&(pool.out_lock));
+	pool.workers = calloc(threads, sizeof(batch_worker));
+	pool.worker_count = threads;
+
+	// Contiguous shares to start with; stealing evens out the rest
+	for(unsigned int i = 0; i < threads; i++)
+	{
+		batch_worker *w = &(pool.workers[i]);
+
+		w->pool = &pool;
+		w->index = i;
+		thread_mutex_init(&(w->deque.lock));
+		w->deque.lo = (unsigned int)(((uint64_t)pool.job_count * i) / threads);
+		w->deque.hi = (unsigned int)(((uint64_t)pool.job_count * (i + 1)) /
+			threads);
+	}
+
+	start = get_time();
+
+	for(unsigned int i = 0; i < threads; i++)
+	{
+		pool.workers[i].started = thread_create(&(pool.workers[i].thread),
+				&batch_worker_main, &(pool.workers[i]));
+		if(!pool.workers[i].started)
+		{
+			// No threads here; do it all ourselves
+			batch_worker_main(&(pool.workers[i]));
+		}
+	}
+
+	for(unsigned int i = 0; i < threads; i++)
+	{
+		if(pool.workers[i].started)
+		{
+			thread_join(&(pool.workers[i].thread));
+		}
+		thread_mutex_destroy(&(pool.workers[i].deque.lock));
+	}
+
+	taken = (get_time() - start) / 1e9;
+
+	fprintf(stderr, "%u jobs (%u failed) on %u workers in %.3f seconds, "
+		"%.0f cycles/second\n", pool.job_count, pool.failed, threads,
+		taken, pool.total_cycles / taken);
+
+	if(pool.out != stdout)
+	{
+		fclose(pool.out);
+	}
+
+	thread_mutex_destroy(&(pool.out_lock));
+
+	for(unsigned int i = 0; i < pool.job_count; i++)
+	{
+		free(pool.jobs[i].line);
+	}
+	free(pool.jobs);
+	free(pool.workers);
+
+	return pool.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
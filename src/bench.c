@@ -0,0 +1,304 @@
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include "frontend.h"	// FRONT_NULL
+#include "lcdc.h"	// set_render_policy
+#include "rewind.h"	// rewind_*
+#include "savestate.h"	// savestate_size, savestate_save, savestate_load
+#include "sgherm.h"	// emu_state, create_emulator, run_until_frame
+#include "snapshot.h"	// snapshot_*
+#include "util_time.h"	// get_time
+#include "vecenv.h"	// vecenv_*
+
+#include <stdio.h>	// printf, fprintf
+#include <stdlib.h>	// EXIT_*, malloc, free, strtoul
+#include <string.h>	// strcmp
+
+
+/*
+ * sgherm-bench: time the state machinery on one ROM.
+ *
+ * The ROM runs for a while first, so there is something in memory, then
+ * each operation is timed on its own, without the frames run in between,
+ * and reported as microseconds per call:
+ *
+ *	frame		one frame, not drawn (for scale)
+ *	save, load	savestate_save and savestate_load to and from memory
+ *	rewind_frame	rewind_frame, a snapshot every frame
+ *	rewind_back	rewind_back, down the history just made
+ *	reset		snapshot_reset after one frame
+ *	vec_step	vecenv_step of 4 frames, per instance
+ *	vec_dispatch	vecenv_step of no frames (waking the workers)
+ *	vec_reset	vecenv_reset of every instance, per instance
+ *
+ * Numbers vary with the ROM and the machine; compare runs of the same ROM.
+ */
+
+
+#define BENCH_REWIND_BUDGET	(64 << 20)	/*! As in the SDL frontend */
+#define BENCH_REWIND_KEYFRAMES	64
+#define BENCH_VEC_FRAMES	4	/*! Frames per vecenv step */
+
+typedef struct bench_options_t
+{
+	const char *rom_path;
+	unsigned int warmup;		/*! Frames run before timing */
+	unsigned int reps;		/*! Calls timed per operation */
+	uint32_t instances;		/*! vecenv instances */
+	unsigned int threads;		/*! vecenv threads (0: one per CPU) */
+} bench_options;
+
+
+static void bench_report(const char *name, uint64_t ns, unsigned int calls)
+{
+	printf("%-14s%10.2f us\n", name, calls ? ns / 1e3 / calls : 0.0);
+}
+
+static emu_state * bench_start(const bench_options *restrict opt)
+{
+	emu_state *state = create_emulator(FRONT_NULL, FRONT_NULL, FRONT_NULL,
+			FRONT_NULL);
+
+	if(state == NULL)
+	{
+		return NULL;
+	}
+
+	// Quiet, so the results are all there is; fatal() still speaks up
+	state->to_stdout = state->to_stderr = NULL;
+
+	if(!load_rom(state, opt->rom_path))
+	{
+		fprintf(stderr, "Can't load %s\n", opt->rom_path);
+		free(state->cart_data);
+		free(state);
+		return NULL;
+	}
+
+	set_render_policy(state, RENDER_NEVER, 0);
+
+	for(unsigned int i = 0; i < opt->warmup; i++)
+	{
+		if(!run_until_frame(state))
+		{
+			fprintf(stderr, "%s stopped during warm-up\n",
+				opt->rom_path);
+			free(state->cart_data);
+			free(state);
+			return NULL;
+		}
+	}
+
+	return state;
+}
+
+/*! Frames, savestates and snapshot resets on one instance */
+static bool bench_instance(const bench_options *restrict opt)
+{
+	emu_state *state = bench_start(opt);
+	rewind_buffer *rw = NULL;
+	snapshot *snap = NULL;
+	size_t size;
+	void *buf;
+	uint64_t start, ns;
+	unsigned int i, calls;
+	bool ok = false;
+
+	if(state == NULL)
+	{
+		return false;
+	}
+
+	size = savestate_size(state);
+	if((buf = malloc(size)) == NULL)
+	{
+		goto out;
+	}
+
+	start = get_time();
+	for(i = 0; i < opt->reps; i++)
+	{
+		run_until_frame(state);
+	}
+	bench_report("frame", get_time() - start, opt->reps);
+
+	start = get_time();
+	for(i = 0; i < opt->reps; i++)
+	{
+		savestate_save(state, buf, size);
+	}
+	bench_report("save", get_time() - start, opt->reps);
+
+	start = get_time();
+	for(i = 0; i < opt->reps; i++)
+	{
+		if(!savestate_load(state, buf, size))
+		{
+			fprintf(stderr, "savestate_load failed\n");
+			goto out;
+		}
+	}
+	bench_report("load", get_time() - start, opt->reps);
+
+	if((rw = rewind_create(state, BENCH_REWIND_BUDGET, 1,
+		BENCH_REWIND_KEYFRAMES)) == NULL)
+	{
+		goto out;
+	}
+
+	for(i = 0, ns = 0; i < opt->reps; i++)
+	{
+		run_until_frame(state);
+
+		start = get_time();
+		rewind_frame(rw, state);
+		ns += get_time() - start;
+	}
+	bench_report("rewind_frame", ns, opt->reps);
+
+	for(calls = 0, ns = 0; calls < opt->reps; calls++)
+	{
+		bool back;
+
+		start = get_time();
+		back = rewind_back(rw, state);
+		ns += get_time() - start;
+
+		if(!back)
+		{
+			break;
+		}
+	}
+	bench_report("rewind_back", ns, calls);
+
+	if((snap = snapshot_take(state)) == NULL)
+	{
+		goto out;
+	}
+
+	for(i = 0, ns = 0; i < opt->reps; i++)
+	{
+		run_until_frame(state);
+
+		start = get_time();
+		snapshot_reset(snap, state);
+		ns += get_time() - start;
+	}
+	bench_report("reset", ns, opt->reps);
+
+	ok = true;
+
+out:
+	snapshot_free(snap);
+	rewind_destroy(rw);
+	free(buf);
+	free(state->cart_data);
+	free(state);
+	return ok;
+}
+
+/*! vecenv stepping and resets */
+static bool bench_vecenv(const bench_options *restrict opt)
+{
+	vecenv *env = vecenv_create(opt->rom_path, NULL, opt->instances,
+			opt->threads, NULL, 0);
+	uint8_t *actions;
+	uint64_t start;
+	unsigned int i, steps;
+
+	if(env == NULL)
+	{
+		fprintf(stderr, "Can't make %u instances of %s\n",
+			opt->instances, opt->rom_path);
+		return false;
+	}
+
+	if((actions = calloc(opt->instances, 1)) == NULL)
+	{
+		vecenv_destroy(env);
+		return false;
+	}
+
+	// Each step is instances x frames; keep the whole run near reps frames
+	steps = opt->reps / (opt->instances * BENCH_VEC_FRAMES) + 1;
+
+	start = get_time();
+	for(i = 0; i < steps; i++)
+	{
+		vecenv_step(env, actions, BENCH_VEC_FRAMES);
+	}
+	bench_report("vec_step", get_time() - start, steps * opt->instances);
+
+	start = get_time();
+	for(i = 0; i < opt->reps; i++)
+	{
+		vecenv_step(env, actions, 0);
+	}
+	bench_report("vec_dispatch", get_time() - start, opt->reps);
+
+	start = get_time();
+	for(i = 0; i < steps; i++)
+	{
+		vecenv_reset(env, VECENV_ALL);
+	}
+	bench_report("vec_reset", get_time() - start, steps * opt->instances);
+
+	free(actions);
+	vecenv_destroy(env);
+	return true;
+}
+
+static void bench_usage(void)
+{
+	fprintf(stderr, "usage: sgherm-bench [-w frames] [-n reps] "
+		"[-e instances] [-j threads] rom\n"
+		"  -w n\trun n frames before timing (default: 300)\n"
+		"  -n n\ttime each operation n times (default: 1000)\n"
+		"  -e n\tvecenv instances (default: 16)\n"
+		"  -j n\tvecenv threads (default: one per CPU)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	bench_options opt = { NULL, 300, 1000, 16, 0 };
+	int arg;
+
+	for(arg = 1; arg < argc && argv[arg][0] == '-'; arg++)
+	{
+		if(strcmp(argv[arg], "-w") == 0 && arg + 1 < argc)
+		{
+			opt.warmup = (unsigned int)strtoul(argv[++arg], NULL, 0);
+		}
+		else if(strcmp(argv[arg], "-n") == 0 && arg + 1 < argc)
+		{
+			opt.reps = (unsigned int)strtoul(argv[++arg], NULL, 0);
+		}
+		else if(strcmp(argv[arg], "-e") == 0 && arg + 1 < argc)
+		{
+			opt.instances = (uint32_t)strtoul(argv[++arg], NULL, 0);
+		}
+		else if(strcmp(argv[arg], "-j") == 0 && arg + 1 < argc)
+		{
+			opt.threads = (unsigned int)strtoul(argv[++arg], NULL, 0);
+		}
+		else
+		{
+			bench_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(arg + 1 != argc || opt.reps == 0 || opt.instances == 0)
+	{
+		bench_usage();
+		return EXIT_FAILURE;
+	}
+
+	opt.rom_path = argv[arg];
+
+	if(!bench_instance(&opt) || !bench_vecenv(&opt))
+	{
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -1,6 +1,5 @@
 #include "sgherm.h"	// emu_state,
 #include "print.h"	// debug
-#include "signals.h"	// do_exit
 #include "frontend.h"	// frontend
 
 #include <caca.h>	// libcaca
@@ -28,6 +27,11 @@ typedef struct libcaca_video_data_t
 	caca_display_t *display;
 	caca_dither_t *dither;
 
+	uint8_t shades[WID][LEN];	/*! DMG shades, one per byte */
+
+	uint32_t last_hash;	/*! Hash of the frame on the canvas */
+	int last_wid, last_height;	/*! Canvas size it was drawn at */
+
 	FILE *stdout_new;
 	FILE *stderr_new;
 } libcaca_video_data;
@@ -53,8 +57,8 @@ bool libcaca_init_video(emu_state *state)
 		return false;
 	}
 
-	to_stdout = video->stdout_new;
-	to_stderr = video->stderr_new;
+	state->to_stdout = video->stdout_new;
+	state->to_stderr = video->stderr_new;
 
 	video->display = caca_create_display(NULL);
 	if(!(video->display))
@@ -68,8 +72,36 @@ bool libcaca_init_video(emu_state *state)
 
 	caca_set_display_title(video->display, "SuperGameHerm");
 
-	video->dither = caca_create_dither(BPP, LEN, WID, LEN*PITCH,
-			RED, GREEN, BLUE, 0);
+	if(state->system == SYSTEM_CGB)
+	{
+		// Dither RGB555 straight out of the screen buffer
+		video->dither = caca_create_dither(16, LEN, WID,
+				LEN * sizeof(uint16_t), 0x001F, 0x03E0, 0x7C00, 0);
+	}
+	else
+	{
+		// Indexed, using the DMG shades as the palette
+		video->dither = caca_create_dither(8, LEN, WID, LEN, 0, 0, 0, 0);
+		if(video->dither)
+		{
+			unsigned int red[256] = { 0 }, green[256] = { 0 };
+			unsigned int blue[256] = { 0 }, alpha[256] = { 0 };
+
+			for(int i = 0; i < 4; i++)
+			{
+				uint32_t shade = lcdc_dmg_shades[i];
+
+				// libcaca wants 12 bits per component
+				red[i] = ((shade >> 16) & 0xFF) * 0xFFF / 0xFF;
+				green[i] = ((shade >> 8) & 0xFF) * 0xFFF / 0xFF;
+				blue[i] = (shade & 0xFF) * 0xFFF / 0xFF;
+				alpha[i] = 0xFFF;
+			}
+
+			caca_set_dither_palette(video->dither, red, green, blue, alpha);
+		}
+	}
+
 	if(!(video->dither))
 	{
 		warning(state, "Failed to initalise the libcaca video frontend");
@@ -97,8 +129,8 @@ void libcaca_finish_video(emu_state *state)
 	fclose(video->stdout_new);
 	fclose(video->stderr_new);
 
-	to_stdout = stdout;
-	to_stderr = stderr;
+	state->to_stdout = stdout;
+	state->to_stderr = stderr;
 
 	free(video);
 	state->front.video.data = NULL;
@@ -117,10 +149,40 @@ void libcaca_blit_canvas(emu_state *state)
 	libcaca_video_data *video = state->front.video.data;
 	int wid = caca_get_canvas_width(video->canvas);
 	int height = caca_get_canvas_height(video->canvas);
+	const void *pixels;
+
+	// Dithering is the expensive bit; don't redo it for the same picture
+	if(state->lcdc.frame_hash == video->last_hash &&
+		wid == video->last_wid && height == video->last_height)
+	{
+		lcdc_clear_dirty(state);
+		return;
+	}
+
+	if(state->system == SYSTEM_CGB)
+	{
+		pixels = state->lcdc.out.cgb;
+	}
+	else
+	{
+		// Unpack the 2-bit shades; they are already palette indices
+		for(uint8_t line = 0; line < WID; line++)
+		{
+			lcdc_line_to_index(state, line, video->shades[line]);
+		}
+
+		pixels = video->shades;
+	}
 
 	caca_dither_bitmap(video->canvas, 0, 0, wid, height, video->dither,
-			state->lcdc.out);
+			pixels);
 	caca_refresh_display(video->display);
+
+	lcdc_clear_dirty(state);
+
+	video->last_hash = state->lcdc.frame_hash;
+	video->last_wid = wid;
+	video->last_height = height;
 }
 
 void libcaca_get_key(emu_state *state, frontend_input_return *ret)
@@ -183,7 +245,7 @@ void libcaca_get_key(emu_state *state, frontend_input_return *ret)
 			break;
 
 		case CACA_KEY_ESCAPE:
-			do_exit = true;
+			state->do_exit = true;
 
 		default:
 			ret->key = 0;
@@ -192,7 +254,7 @@ void libcaca_get_key(emu_state *state, frontend_input_return *ret)
 	}
 	else if(ev_type & CACA_EVENT_QUIT)
 	{
-		do_exit = true;
+		state->do_exit = true;
 		ret->key = 0;
 	}
 }
@@ -201,15 +263,12 @@ int libcaca_event_loop(emu_state *state)
 {
 	debug(state, "Executing libcaca event loop");
 
-	do
+	while(run_until_frame(state))
 	{
 		frontend_input_return ret;
-		uint8_t mode = state->lcdc.stat.params.mode_flag;
-		uint_fast16_t clock = state->lcdc.curr_clk;
-
-		step_emulator(state);
 
-		if(unlikely(mode == 1 && clock == 1 && state->input.col))
+		// Poll input once a frame
+		if(state->input.col)
 		{
 			GET_KEY(state, &ret);
 			if(ret.key > 0)
@@ -217,7 +276,7 @@ int libcaca_event_loop(emu_state *state)
 				joypad_signal(state, ret.key, ret.press);
 			}
 		}
-	} while(!do_exit);
+	}
 
 	return 0;
 }
@@ -0,0 +1,395 @@
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include "capture.h"	// prototypes
+#include "print.h"	// error, info
+#include "sgherm.h"	// emu_state
+#include "util.h"	// fnv1a
+#include "util_bitops.h"	// htole16, htole32
+#include "util_ring.h"	// spsc_ring
+#include "util_thread.h"	// thread_*
+
+#include <stdio.h>	// FILE, fopen, fwrite
+#include <stdlib.h>	// calloc, free
+#include <string.h>	// memcpy, strlen, strcmp
+
+
+/*! Output files; blocks are tagged with which one they belong to */
+typedef enum
+{
+	CAPTURE_PCM = 0,	/*! Samples (WAV or raw) */
+	CAPTURE_HASH,		/*! One line per audio frame */
+	CAPTURE_STREAMS,
+} capture_stream;
+
+typedef struct capture_block_t
+{
+	uint32_t len;
+	capture_stream stream;
+	uint8_t data[CAPTURE_BLOCK_SIZE];
+} capture_block;
+
+/*!
+ * The emulator thread fills blocks and passes their index through full;
+ * the writer thread hands them back through empty once on disk.  Capture
+ * only runs with null audio, so when the disk falls behind the emulator
+ * waits for an empty block rather than drop anything: a capture is either
+ * complete or reported as failed.
+ *
+ * The rings carry the blocks without locking.  The lock is only there so
+ * that whichever side finds its ring empty can sleep until the other one
+ * pushes: the writer on wake, the emulator on freed.
+ */
+struct capture_state_t
+{
+	FILE *file[CAPTURE_STREAMS];
+	bool wav;			/*! file[CAPTURE_PCM] has a header */
+	uint32_t rate;			/*! Sample rate in the header */
+
+	spsc_ring full;			/*! Emulator to writer */
+	spsc_ring empty;		/*! Writer to emulator */
+	capture_block *cur[CAPTURE_STREAMS];	/*! Being filled */
+	thread_t thread;
+
+	thread_mutex_t lock;		/*! Guards stop and the waits */
+	thread_cond_t wake;		/*! Something in full, or stop */
+	thread_cond_t freed;		/*! Something in empty */
+	bool stop;			/*! Writer drains and exits */
+
+	uint64_t frames;		/*! Audio frames seen */
+	uint64_t pcm_bytes;		/*! Sample bytes queued */
+	volatile uint32_t failed;	/*! The writer couldn't write */
+	uint32_t hash;			/*! Hash of everything, for a summary */
+
+	capture_block blocks[CAPTURE_BLOCKS];
+};
+
+
+/*! Canonical 44-byte header; sizes are patched in at close */
+static void capture_wav_header(uint8_t *out, uint32_t rate, uint32_t bytes)
+{
+	const uint16_t channels = 2, bits = 16;
+	uint32_t word;
+	uint16_t half;
+
+	memcpy(out, "RIFF", 4);
+	word = htole32(bytes + 36);		memcpy(out + 4, &word, 4);
+	memcpy(out + 8, "WAVEfmt ", 8);
+	word = htole32(16);			memcpy(out + 16, &word, 4);
+	half = htole16(1);			memcpy(out + 20, &half, 2);	// PCM
+	half = htole16(channels);		memcpy(out + 22, &half, 2);
+	word = htole32(rate);			memcpy(out + 24, &word, 4);
+	word = htole32(rate * channels * (bits / 8));
+	memcpy(out + 28, &word, 4);
+	half = htole16(channels * (bits / 8));	memcpy(out + 32, &half, 2);
+	half = htole16(bits);			memcpy(out + 34, &half, 2);
+	memcpy(out + 36, "data", 4);
+	word = htole32(bytes);			memcpy(out + 40, &word, 4);
+}
+
+static void capture_writer(void *data)
+{
+	capture_state *cap = data;
+	uint64_t index;
+
+	for(;;)
+	{
+		capture_block *block;
+
+		if(!ring_pop(&(cap->full), &index))
+		{
+			thread_mutex_lock(&(cap->lock));
+
+			// Drained first, so nothing queued before stop is missed
+			while(!ring_pop(&(cap->full), &index))
+			{
+				if(cap->stop)
+				{
+					thread_mutex_unlock(&(cap->lock));
+					return;
+				}
+
+				thread_cond_wait(&(cap->wake), &(cap->lock));
+			}
+
+			thread_mutex_unlock(&(cap->lock));
+		}
+
+		block = &(cap->blocks[index]);
+		if(fwrite(block->data, 1, block->len,
+			cap->file[block->stream]) != block->len)
+		{
+			store_release(&(cap->failed), 1);
+		}
+
+		ring_push(&(cap->empty), index);
+
+		thread_mutex_lock(&(cap->lock));
+		thread_cond_broadcast(&(cap->freed));
+		thread_mutex_unlock(&(cap->lock));
+	}
+}
+
+/*! Hand the block being filled to the writer */
+static void capture_submit(capture_state *cap, capture_stream stream)
+{
+	capture_block *block = cap->cur[stream];
+
+	if(block == NULL)
+	{
+		return;
+	}
+
+	cap->cur[stream] = NULL;
+	ring_push(&(cap->full), block - cap->blocks);
+
+	thread_mutex_lock(&(cap->lock));
+	thread_cond_broadcast(&(cap->wake));
+	thread_mutex_unlock(&(cap->lock));
+}
+
+/*! Queue bytes for a file; waits for the writer if it has fallen behind */
+static void capture_put(capture_state *cap, capture_stream stream,
+		const void *data, size_t len)
+{
+	capture_block *block = cap->cur[stream];
+	uint64_t index;
+
+	if(block != NULL && block->len + len > CAPTURE_BLOCK_SIZE)
+	{
+		capture_submit(cap, stream);
+		block = NULL;
+	}
+
+	if(block == NULL)
+	{
+		if(!ring_pop(&(cap->empty), &index))
+		{
+			thread_mutex_lock(&(cap->lock));
+			while(!ring_pop(&(cap->empty), &index))
+			{
+				thread_cond_wait(&(cap->freed), &(cap->lock));
+			}
+			thread_mutex_unlock(&(cap->lock));
+		}
+
+		block = cap->cur[stream] = &(cap->blocks[index]);
+		block->stream = stream;
+		block->len = 0;
+	}
+
+	memcpy(block->data + block->len, data, len);
+	block->len += len;
+}
+
+static void capture_free_sync(capture_state *cap)
+{
+	thread_cond_destroy(&(cap->freed));
+	thread_cond_destroy(&(cap->wake));
+	thread_mutex_destroy(&(cap->lock));
+}
+
+static bool capture_is_wav(const char *path)
+{
+	size_t len = strlen(path);
+
+	return len >= 4 && (strcmp(path + len - 4, ".wav") == 0 ||
+		strcmp(path + len - 4, ".WAV") == 0);
+}
+
+/*!
+ * @brief	Start capturing audio output to disk.
+ * @param	state	The emulator state; its audio frontend must be null.
+ * @param	path	Where to write samples (.wav gets a header, anything
+ * 			else is raw 16-bit little-endian stereo), or NULL.
+ * @param	hash_path	Where to write one hash per audio frame, or NULL.
+ * @returns	true if capture was started.
+ * @note	Files are written by a background thread; the emulator
+ * 		thread only waits, asleep, when the disk is more than
+ * 		CAPTURE_BLOCKS blocks behind.
+ */
+bool capture_open(emu_state *restrict state, const char *path,
+		const char *hash_path)
+{
+	capture_state *cap = calloc(1, sizeof(capture_state));
+
+	if(cap == NULL)
+	{
+		error(state, "capture: out of memory");
+		return false;
+	}
+
+	if(path != NULL)
+	{
+		if((cap->file[CAPTURE_PCM] = fopen(path, "wb")) == NULL)
+		{
+			perror("capture: fopen");
+			goto fail;
+		}
+
+		cap->wav = capture_is_wav(path);
+	}
+
+	if(hash_path != NULL &&
+		(cap->file[CAPTURE_HASH] = fopen(hash_path, "w")) == NULL)
+	{
+		perror("capture: fopen");
+		goto fail;
+	}
+
+	cap->rate = state->snd.rate;
+	cap->hash = FNV1A_INIT;
+
+	thread_mutex_init(&(cap->lock));
+	thread_cond_init(&(cap->wake));
+	thread_cond_init(&(cap->freed));
+
+	if(cap->wav)
+	{
+		uint8_t header[44];
+
+		// Rewritten with the real sizes at close
+		capture_wav_header(header, cap->rate, 0);
+		fwrite(header, 1, sizeof(header), cap->file[CAPTURE_PCM]);
+	}
+
+	for(uint64_t i = 0; i < CAPTURE_BLOCKS; i++)
+	{
+		ring_push(&(cap->empty), i);
+	}
+
+	if(!thread_create(&(cap->thread), &capture_writer, cap))
+	{
+		error(state, "capture: can't start writer thread");
+		capture_free_sync(cap);
+		goto fail;
+	}
+
+	state->front.audio.data = cap;
+
+	return true;
+
+fail:
+	for(int i = 0; i < CAPTURE_STREAMS; i++)
+	{
+		if(cap->file[i] != NULL)
+		{
+			fclose(cap->file[i]);
+		}
+	}
+
+	free(cap);
+	return false;
+}
+
+/*!
+ * @brief	Capture one audio frame.
+ * @param	state	The emulator state.
+ * @param	samples	Interleaved stereo samples.
+ * @param	count	Number of stereo samples.
+ */
+void capture_write(emu_state *restrict state, const int16_t *samples,
+		size_t count)
+{
+	capture_state *cap = state->front.audio.data;
+	int16_t le[SOUND_OUT_SIZE * 2];
+	size_t len = count * 2 * sizeof(int16_t);
+	uint32_t hash;
+
+	if(unlikely(count > SOUND_OUT_SIZE))
+	{
+		count = SOUND_OUT_SIZE;
+		len = count * 2 * sizeof(int16_t);
+	}
+
+	for(size_t i = 0; i < count * 2; i++)
+	{
+		le[i] = (int16_t)htole16((uint16_t)samples[i]);
+	}
+
+	// Hash the file's bytes so results agree across hosts
+	hash = fnv1a(le, len, FNV1A_INIT);
+	cap->hash = fnv1a(le, len, cap->hash);
+
+	if(cap->file[CAPTURE_PCM] != NULL)
+	{
+		capture_put(cap, CAPTURE_PCM, le, len);
+		cap->pcm_bytes += len;
+	}
+
+	if(cap->file[CAPTURE_HASH] != NULL)
+	{
+		char line[32];
+		int n = snprintf(line, sizeof(line), "%llu %08X\n",
+				(unsigned long long)cap->frames, hash);
+
+		capture_put(cap, CAPTURE_HASH, line, n);
+	}
+
+	cap->frames++;
+}
+
+/*!
+ * @brief	Finish capturing: flush everything and close the files.
+ * @param	state	The emulator state.
+ * @returns	false if anything failed to reach the disk.
+ */
+bool capture_close(emu_state *restrict state)
+{
+	capture_state *cap = state->front.audio.data;
+	bool ok;
+
+	if(cap == NULL)
+	{
+		return true;
+	}
+
+	for(int i = 0; i < CAPTURE_STREAMS; i++)
+	{
+		capture_submit(cap, i);
+	}
+
+	thread_mutex_lock(&(cap->lock));
+	cap->stop = true;
+	thread_cond_broadcast(&(cap->wake));
+	thread_mutex_unlock(&(cap->lock));
+
+	thread_join(&(cap->thread));
+	capture_free_sync(cap);
+
+	if(cap->wav)
+	{
+		uint8_t header[44];
+		uint64_t bytes = cap->pcm_bytes;
+
+		// WAV can't describe more than 4GB; say as much as it can
+		capture_wav_header(header, cap->rate,
+			bytes > UINT32_MAX - 36 ? UINT32_MAX - 36 : (uint32_t)bytes);
+		if(fseek(cap->file[CAPTURE_PCM], 0, SEEK_SET) != 0 ||
+			fwrite(header, 1, sizeof(header),
+			cap->file[CAPTURE_PCM]) != sizeof(header))
+		{
+			cap->failed = 1;
+		}
+	}
+
+	for(int i = 0; i < CAPTURE_STREAMS; i++)
+	{
+		if(cap->file[i] != NULL && fclose(cap->file[i]) != 0)
+		{
+			cap->failed = 1;
+		}
+	}
+
+	info(state, "capture: %llu audio frames, hash %08X",
+		(unsigned long long)cap->frames, cap->hash);
+	if(cap->failed)
+	{
+		error(state, "capture: couldn't write everything to disk");
+	}
+
+	ok = !cap->failed;
+	free(cap);
+	state->front.audio.data = NULL;
+
+	return ok;
+}
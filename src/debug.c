@@ -294,7 +294,7 @@ void print_cycles(emu_state *restrict state)
 	const cpu_freq freq_dmg = CPU_FREQ_DMG, freq_cgb = CPU_FREQ_CGB;
 
 	info(state, "Time taken: %.3f seconds", taken);
-	info(state, "Cycle count: %ld", state->cycles);
+	info(state, "Cycle count: %llu", (unsigned long long)state->cycles);
 	info(state, "Cycles per second: %.3f (%.3fx GB, %.3fx GBC)", cps,
 	     cps / freq_dmg, cps / freq_cgb);
 }
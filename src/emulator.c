@@ -0,0 +1,266 @@
+#include "config.h"	// bool
+
+#include "ctl_unit.h"	// init_ctl, execute
+#include "debug.h"	// print_cycles
+#include "frontend.h"	// frontend_set_*
+#include "lcdc.h"	// lcdc_tick
+#include "link.h"	// link_poll, link_close
+#include "movie.h"	// movie_poll, movie_close, MOVIE_NEVER
+#include "print.h"	// fatal, error, debug
+#include "rom_read.h"	// offsets
+#include "serio.h"	// serial_*
+#include "sgherm.h"	// emu_state, constants
+#include "sound.h"	// init_sound, sound_tick
+#include "timer.h"	// init_timer, timer_tick
+#include "util_time.h"	// get_time
+
+#include <stdio.h>	// file methods
+#include <stdlib.h>	// calloc, free
+#include <string.h>	// memcpy
+
+
+/*!
+ * @brief	Make a new, empty emulator instance.
+ * @param	input	Input frontend.
+ * @param	audio	Audio frontend.
+ * @param	video	Video frontend.
+ * @param	event_loop	Event loop to use with run_emulator.
+ * @returns	The instance, or NULL if out of memory.
+ * @note	Instances share nothing; any number may be used at once, each
+ * 		from one thread at a time.
+ */
+emu_state * create_emulator(frontend_type input, frontend_type audio,
+		frontend_type video, frontend_type event_loop)
+{
+	emu_state *state = (emu_state *)calloc(1, sizeof(emu_state));
+
+	if(state == NULL)
+	{
+		return NULL;
+	}
+
+	state->to_stdout = stdout;
+	state->to_stderr = stderr;
+
+	state->interrupts.enabled = true;
+	state->bank = 1;
+	state->wait = 1;
+	state->freq = CPU_FREQ_DMG;
+	state->movie_next = MOVIE_NEVER;
+
+	memcpy(&(state->front.input), frontend_set_input[input], sizeof(frontend_input));
+	memcpy(&(state->front.audio), frontend_set_audio[audio], sizeof(frontend_audio));
+	memcpy(&(state->front.video), frontend_set_video[video], sizeof(frontend_video));
+	state->front.event_loop = frontend_set_event_loop[event_loop];
+
+	return state;
+}
+
+/*!
+ * @brief	Load a ROM into an instance and power it on.
+ * @param	state	An instance from create_emulator.
+ * @param	rom_path	Path to the ROM image.
+ * @returns	true if the ROM was loaded.  If it couldn't be read, false;
+ * 		if it was bad, false with state->fatal_code set as well.
+ */
+bool load_rom(emu_state *restrict state, const char *rom_path)
+{
+	cart_header *header;
+	FILE *rom;
+
+	if((rom = fopen(rom_path, "rb")) == NULL)
+	{
+		error(state, "can't open ROM %s", rom_path);
+		return false;
+	}
+
+	if(unlikely(!read_rom_data(state, rom, &header)))
+	{
+		fatal(state, "can't read ROM data (ROM is corrupt)?");
+		fclose(rom);
+		return false;
+	}
+
+	fclose(rom);
+
+	// Initalise state
+	init_ctl(state);
+	init_lcdc(state);
+	init_timer(state);
+	init_serial(state);
+	init_sound(state);
+
+	// Start the clock
+	state->start_time = get_time();
+
+	return true;
+}
+
+emu_state * init_emulator(const char *rom_path, frontend_type input,
+		frontend_type audio, frontend_type video,
+		frontend_type event_loop)
+{
+	emu_state *state = create_emulator(input, audio, video, event_loop);
+
+	if(state == NULL)
+	{
+		return NULL;
+	}
+
+	if(!load_rom(state, rom_path))
+	{
+		free(state->cart_data);
+		free(state);
+		return NULL;
+	}
+
+	return state;
+}
+
+/*!
+ * @brief	Run an instance through its frontends until it stops.
+ * @param	state	A loaded instance.
+ * @returns	The event loop's result, or the test ROM's verdict if a
+ * 		serial match was hit, or state->fatal_code after a fatal
+ * 		error.
+ * @note	Set state->do_exit from anywhere to stop it.
+ */
+int run_emulator(emu_state *state)
+{
+	int val;
+
+	FRONTEND_INIT_ALL(state)
+	val = EVENT_LOOP(state);
+
+	FRONTEND_FINISH_ALL(state)
+
+	// A test ROM told us how it went
+	if(state->ser.matched)
+	{
+		val = state->ser.exit_code;
+	}
+
+	// Nothing the ROM said counts after that
+	if(state->fatal_code != 0)
+	{
+		val = state->fatal_code;
+	}
+
+	return val;
+}
+
+void finish_emulator(emu_state *restrict state)
+{
+	print_cycles(state);
+	serial_flush(state);
+	link_close(state);
+	movie_close(state);
+
+	free(state->cart_data);
+	free(state);
+}
+
+/*! One clock of everything; the body of every run loop */
+static inline void emulator_clock(emu_state *restrict state)
+{
+	execute(state);
+	if(unlikely(state->cycles >= state->lcdc.next_event))
+	{
+		lcdc_tick(state);
+	}
+	if(unlikely(state->cycles >= state->ser.next_event))
+	{
+		serial_tick(state);
+	}
+	if(unlikely(state->cycles >= state->ser.link_next))
+	{
+		link_poll(state);
+	}
+	if(unlikely(state->cycles >= state->timer.next_event))
+	{
+		timer_tick(state);
+	}
+	if(unlikely(state->cycles >= state->snd.next_event))
+	{
+		sound_tick(state);
+	}
+	//clock_tick(state);
+
+	if(unlikely(++state->count_cur_second == state->freq))
+	{
+		state->count_cur_second = 0;
+		if((++state->game_seconds % 10) == 0)
+		{
+			debug(state, "GBC seconds: %ld", ++state->game_seconds);
+		}
+	}
+
+	state->cycles++;
+
+	// Between clocks, which is where the host's input lands too
+	if(unlikely(state->cycles >= state->movie_next))
+	{
+		movie_poll(state);
+	}
+}
+
+/*! One clock; false once the instance has hit a fatal error */
+bool step_emulator(emu_state *restrict state)
+{
+	emulator_clock(state);
+
+	return state->fatal_code == 0;
+}
+
+/*!
+ * @brief	Run for a number of clocks.
+ * @param	state	The instance to run.
+ * @param	count	Clocks to run for.
+ * @returns	The clocks actually run; fewer than count only if
+ * 		state->do_exit was set on the way (by fatal() too; see
+ * 		state->fatal_code).
+ */
+uint64_t run_cycles(emu_state *restrict state, uint64_t count)
+{
+	const uint64_t end = state->cycles + count;
+
+	while(state->cycles < end && !state->do_exit)
+	{
+		emulator_clock(state);
+	}
+
+	return count - (end - state->cycles);
+}
+
+/*!
+ * @brief	Run until the next frame is finished.
+ * @param	state	The instance to run.
+ * @returns	true when stopped on entry to v-blank (or, with the LCD off,
+ * 		after a frame's worth of clocks); false if state->do_exit
+ * 		was set first, as fatal() does along with state->fatal_code.
+ * @note	This is where frontends do their once-a-frame work.
+ */
+bool run_until_frame(emu_state *restrict state)
+{
+	const uint32_t frame = state->lcdc.frames;
+	const uint64_t end = state->cycles + LCDC_FRAME_CLOCKS;
+
+	while(state->lcdc.frames == frame)
+	{
+		if(unlikely(state->do_exit))
+		{
+			return false;
+		}
+
+		// LCD off never gets to v-blank; keep the pace anyway
+		if(unlikely(state->cycles >= end &&
+			!state->lcdc.lcd_control.params.enable))
+		{
+			break;
+		}
+
+		emulator_clock(state);
+	}
+
+	return true;
+}
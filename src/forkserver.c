@@ -0,0 +1,260 @@
+#include "config.h"	// macros, HAVE_POSIX
+
+#include "batch.h"	// batch_*, forkserver_main
+#include "frontend.h"	// FRONT_NULL
+#include "lcdc.h"	// set_render_policy
+#include "print.h"	// error
+#include "serio.h"	// serial_set_matches
+#include "sgherm.h"	// emu_state, create_emulator, run_until_frame
+#include "util_time.h"	// get_time
+
+#include <stdio.h>	// fprintf, snprintf, perror
+#include <stdlib.h>	// EXIT_*
+#include <string.h>	// memchr
+
+
+/*
+ * Fork-server: load a ROM once, run it up to a checkpoint, then fork a
+ * copy-on-write child for each job.  Starting a job costs one fork()
+ * instead of allocating, loading and booting all over again.
+ *
+ * Clients connect to the UNIX socket and send one line of manifest options
+ * without the ROM (e.g. "frames=600 input=keys.txt").  The child forked
+ * for the connection runs the job from the checkpoint, replies with one
+ * tab-separated record and hangs up:
+ *
+ *	pid	reason	exit	frames	cycles	seconds	frame_hash
+ *
+ * If the child dies, the connection just closes.  Any number of jobs may
+ * be running at once; the clients decide how many.
+ */
+
+#ifdef HAVE_POSIX
+
+#include <errno.h>	// errno, EINTR
+#include <signal.h>	// sigaction, SIGCHLD, SIGPIPE
+#include <sys/socket.h>	// socket, bind, listen, accept
+#include <sys/un.h>	// sockaddr_un
+#include <unistd.h>	// fork, read, write, close, unlink, _exit
+
+#define FORKSERVER_REQUEST_SIZE	4096	/*! Longest request line */
+
+
+/*! Write all of buf, unless the client has gone */
+static void forkserver_send(int conn, const char *buf, size_t len)
+{
+	while(len > 0)
+	{
+		ssize_t done = write(conn, buf, len);
+
+		if(done < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if(done <= 0)
+		{
+			return;
+		}
+
+		buf += done;
+		len -= (size_t)done;
+	}
+}
+
+/*! Read the request line from a client; false if there isn't one */
+static bool forkserver_receive(int conn, char *buf, size_t size)
+{
+	size_t len = 0;
+
+	while(len < size - 1)
+	{
+		ssize_t got = read(conn, buf + len, size - 1 - len);
+
+		if(got < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if(got <= 0)
+		{
+			break;
+		}
+
+		len += (size_t)got;
+		if(memchr(buf + len - got, '\n', (size_t)got) != NULL)
+		{
+			break;
+		}
+	}
+
+	buf[len] = '\0';
+	return len > 0;
+}
+
+/*!
+ * @brief	Run one client's job in a freshly forked child.
+ * @param	state	The child's copy of the checkpointed instance.
+ * @param	conn	Connection to the client.
+ * @param	start	When the connection was accepted.
+ * @note	Never returns.  The child leaves with _exit, so the parent's
+ * 		stdio buffers and atexit handlers aren't run twice.
+ */
+static void forkserver_child(emu_state *state, int conn, uint64_t start)
+{
+	char request[FORKSERVER_REQUEST_SIZE], reply[256];
+	batch_job job = { 0 };
+	batch_result res = { "bad-request", -1, 0, 0, 0, false };
+	char hash[BATCH_HASH_TEXT];
+	FILE *serial = NULL, *log = NULL;
+	int len;
+
+	if(forkserver_receive(conn, request, sizeof(request)) &&
+		batch_parse_options(&job, request, "request", 1))
+	{
+		batch_open_outputs(&job, &serial, &log);
+		state->to_stdout = serial;
+		state->to_stderr = log;
+
+		batch_execute(state, &job, &res);
+	}
+
+	len = snprintf(reply, sizeof(reply), "%ld\t%s\t%d\t%llu\t%llu\t%.6f\t"
+		"%s\n", (long)getpid(), res.reason, res.exit_code,
+		(unsigned long long)res.frames, (unsigned long long)res.cycles,
+		(get_time() - start) / 1e9, batch_hash_text(&res, hash));
+	forkserver_send(conn, reply, (size_t)len);
+
+	batch_close_outputs(serial, log);
+	close(conn);
+
+	_exit((strcmp(res.reason, "limit") == 0 ||
+		strcmp(res.reason, "pass") == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*!
+ * @brief	Serve jobs for one ROM until something goes wrong.
+ * @param	rom	ROM every job runs.
+ * @param	path	Where to put the UNIX socket.
+ * @param	checkpoint	Frames to run before forking any jobs.
+ * @returns	EXIT_FAILURE; it only stops on error.
+ */
+int forkserver_main(const char *rom, const char *path, uint64_t checkpoint)
+{
+	emu_state *state = create_emulator(FRONT_NULL, FRONT_NULL, FRONT_NULL,
+			FRONT_NULL);
+	struct sockaddr_un addr = { 0 };
+	struct sigaction sa;
+	int sock;
+
+	if(state == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	// Serial output before the checkpoint isn't anyone's
+	state->to_stdout = NULL;
+
+	if(!load_rom(state, rom))
+	{
+		free(state->cart_data);
+		free(state);
+		return EXIT_FAILURE;
+	}
+
+	serial_set_matches(state, serial_default_matches,
+			serial_default_match_count);
+
+	set_render_policy(state, RENDER_NEVER, 0);
+	for(uint64_t i = 0; i < checkpoint && run_until_frame(state); i++)
+	{
+		// Nothing to do between frames
+	}
+
+	if(state->do_exit)
+	{
+		error(state, "%s stopped before the checkpoint", rom);
+		finish_emulator(state);
+		return EXIT_FAILURE;
+	}
+
+	// Children reap themselves, and live on if their client goes away
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = SIG_IGN;
+	sa.sa_flags = SA_NOCLDWAIT;
+	sigaction(SIGCHLD, &sa, NULL);
+	sa.sa_flags = 0;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		error(state, "Socket path %s is too long", path);
+		finish_emulator(state);
+		return EXIT_FAILURE;
+	}
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	if((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+		bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(sock, SOMAXCONN) < 0)
+	{
+		perror("forkserver: socket");
+		finish_emulator(state);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stderr, "Serving %s from frame %llu on %s\n", rom,
+		(unsigned long long)checkpoint, path);
+
+	// Nothing buffered may be inherited, or it'd come out once per child
+	fflush(NULL);
+
+	for(;;)
+	{
+		int conn = accept(sock, NULL, NULL);
+		uint64_t start = get_time();
+		pid_t pid;
+
+		if(conn < 0)
+		{
+			if(errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+
+			perror("forkserver: accept");
+			break;
+		}
+
+		if((pid = fork()) == 0)
+		{
+			close(sock);
+			forkserver_child(state, conn, start);
+		}
+		else if(pid < 0)
+		{
+			perror("forkserver: fork");
+		}
+
+		close(conn);
+	}
+
+	close(sock);
+	unlink(path);
+	finish_emulator(state);
+
+	return EXIT_FAILURE;
+}
+
+#else /* !HAVE_POSIX */
+
+int forkserver_main(const char *rom UNUSED, const char *path UNUSED,
+		uint64_t checkpoint UNUSED)
+{
+	fprintf(stderr, "The fork-server needs fork() and UNIX sockets\n");
+	return EXIT_FAILURE;
+}
+
+#endif /* HAVE_POSIX */
@@ -4,6 +4,7 @@
 
 #include "ctl_unit.h"	// signal_interrupt
 #include "input.h"	// input_key, defines
+#include "movie.h"	// movie_input
 #include "print.h"	// error
 #include "sgherm.h"	// emu_state
 #include "util.h"	// UNUSED
@@ -35,7 +36,8 @@ void joypad_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 	return;
 }
 
-void joypad_signal(emu_state *restrict state, input_key key, bool down)
+/*! Press or release a key, whoever asked */
+void joypad_press(emu_state *restrict state, input_key key, bool down)
 {
 	if(down)
 	{
@@ -54,3 +56,20 @@ void joypad_signal(emu_state *restrict state, input_key key, bool down)
 
 	state->input.row = 0xf & ~(state->input.key_row);
 }
+
+/*!
+ * @brief	Press or release a key from the host.
+ * @param	state	The instance.
+ * @param	key	Which key.
+ * @param	down	true if pressed.
+ * @note	A movie being recorded sees it; one being played ignores it.
+ */
+void joypad_signal(emu_state *restrict state, input_key key, bool down)
+{
+	if(unlikely(state->movie != NULL) && !movie_input(state, key, down))
+	{
+		return;
+	}
+
+	joypad_press(state, key, down);
+}
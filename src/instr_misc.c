@@ -1,6 +1,6 @@
 /*!
  * @brief Invalid opcode (multiple values)
- * @result Terminates emulator
+ * @result Stops the instance (see fatal)
  */
 static inline void invalid(emu_state *restrict state, uint8_t data[] UNUSED)
 {
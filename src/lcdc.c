@@ -2,9 +2,11 @@
 
 #include "print.h"	// fatal
 #include "ctl_unit.h"	// signal_interrupt
-#include "util.h"	// likely/unlikely
+#include "util.h"	// likely/unlikely, fnv1a
 #include "sgherm.h"	// emu_state
 
+#include <string.h>	// memset, memcmp, memcpy
+
 
 #define LCDC_BGWINDOW_SHOW	0x01
 #define LCDC_OBJ_DISPLAY	0x02
@@ -15,6 +17,70 @@
 #define LCDC_WINTILE_MAP_HI	0x40
 #define LCDC_ENABLE		0x80
 
+/*! Offset of the OBJ palettes in the palette cache */
+#define PAL_OUT_OBJ		32
+
+/*! The four shades of the DMG screen in ARGB8888, lightest first */
+const uint32_t lcdc_dmg_shades[4] =
+{
+	0x009CBD0F, 0x008CAD0F, 0x00306230, 0x000F380F
+};
+
+/*! Convert a CGB RGB555 colour to ARGB8888 */
+static inline uint32_t rgb555_to_argb(uint16_t colour)
+{
+	uint32_t r = colour & 0x1F;
+	uint32_t g = (colour >> 5) & 0x1F;
+	uint32_t b = (colour >> 10) & 0x1F;
+
+	// Expand 5 bits to 8, so 0x1F becomes 0xFF
+	r = (r << 3) | (r >> 2);
+	g = (g << 3) | (g >> 2);
+	b = (b << 3) | (b >> 2);
+
+	return (r << 16) | (g << 8) | b;
+}
+
+/*! Recompute one cached colour from CGB palette RAM */
+static inline void update_cgb_colour(const uint8_t *ram, uint16_t *cache, uint8_t index)
+{
+	uint8_t lo = index & ~1;
+	uint16_t colour = ram[lo] | (ram[lo + 1] << 8);
+
+	cache[index >> 1] = colour & 0x7FFF;
+}
+
+/*! Recompute four cached shades from a DMG palette register */
+static inline void update_dmg_palette(uint16_t *cache, uint8_t pal)
+{
+	for(uint8_t i = 0; i < 4; i++, pal >>= 2)
+	{
+		cache[i] = pal & 0x3;
+	}
+}
+
+/*! Decide whether the frame about to start gets drawn */
+static inline void lcdc_start_frame(emu_state *restrict state)
+{
+	switch(state->render)
+	{
+	case RENDER_ALWAYS:
+		state->lcdc.render_frame = true;
+		break;
+	case RENDER_SKIP:
+		state->lcdc.render_frame = (state->render_skip < 2) ||
+			(state->lcdc.frames % state->render_skip) == 0;
+		break;
+	case RENDER_ON_DEMAND:
+		state->lcdc.render_frame = state->render_request;
+		break;
+	case RENDER_NEVER:
+	default:
+		state->lcdc.render_frame = false;
+		break;
+	}
+}
+
 void init_lcdc(emu_state *restrict state)
 {
 	state->lcdc.lcd_control.params.enable = true;
@@ -25,139 +91,375 @@ void init_lcdc(emu_state *restrict state)
 
 	state->lcdc.ly = 0;
 	state->lcdc.lyc = 0;
+
+	state->lcdc.next_event = state->cycles + LCDC_OAM_CLOCKS;
+	lcdc_start_frame(state);
+
+	// Frontends haven't seen anything yet
+	memset(state->lcdc.dirty, 0xFF, sizeof(state->lcdc.dirty));
+	state->lcdc.frame_changed = true;
+
+	if(state->system == SYSTEM_CGB)
+	{
+		// All white, as left by the boot ROM
+		memset(state->lcdc.bg_pal, 0xFF, sizeof(state->lcdc.bg_pal));
+		memset(state->lcdc.obj_pal, 0xFF, sizeof(state->lcdc.obj_pal));
+
+		for(uint8_t i = 0; i < 64; i += 2)
+		{
+			update_cgb_colour(state->lcdc.bg_pal, state->lcdc.pal_out, i);
+			update_cgb_colour(state->lcdc.obj_pal,
+				state->lcdc.pal_out + PAL_OUT_OBJ, i);
+		}
+	}
+	else
+	{
+		state->lcdc.bgp = 0xFC;
+		state->lcdc.obp[0] = state->lcdc.obp[1] = 0xFF;
+
+		update_dmg_palette(state->lcdc.pal_out, state->lcdc.bgp);
+		update_dmg_palette(state->lcdc.pal_out + PAL_OUT_OBJ, state->lcdc.obp[0]);
+		update_dmg_palette(state->lcdc.pal_out + PAL_OUT_OBJ + 4, state->lcdc.obp[1]);
+	}
+}
+
+/*! Draw the current line into the screen buffer */
+static void lcdc_render_line(emu_state *restrict state)
+{
+	uint16_t next_tile = 0x1800;
+	uint8_t curr_tile = 0;
+	uint16_t start = (state->lcdc.lcd_control.params.bg_char_sel) ? 0x0 : 0x800;
+	uint8_t ly = state->lcdc.ly;
+	uint8_t pixel_y_offset = ly % 8;
+	bool cgb = (state->system == SYSTEM_CGB);
+	union
+	{
+		uint8_t dmg[LCDC_WIDTH / 4];
+		uint16_t cgb[LCDC_WIDTH];
+	} line;
+	void *dest = cgb ? (void *)state->lcdc.out.cgb[ly] : (void *)state->lcdc.out.dmg[ly];
+	size_t len = cgb ? sizeof(line.cgb) : sizeof(line.dmg);
+
+	if (state->lcdc.lcd_control.params.bg_code_sel)
+	{
+		next_tile += 0x400;
+	}
+	next_tile += (ly >> 3) << 5;
+
+	for (; curr_tile < 20; curr_tile++, next_tile++)
+	{
+		uint8_t tile = state->lcdc.vram[0x0][next_tile];
+		uint8_t attr = cgb ? state->lcdc.vram[0x1][next_tile] : 0;
+		const uint16_t *pal = state->lcdc.pal_out + ((attr & 0x7) << 2);
+		const uint8_t *mem;
+		uint8_t lo, hi;
+		if (!state->lcdc.lcd_control.params.bg_char_sel)
+		{
+			tile -= 0x80;
+		}
+		mem = state->lcdc.vram[(attr >> 3) & 0x1] + start + (tile * 16) + (pixel_y_offset * 2);
+		lo = mem[0];
+		hi = mem[1];
+
+		if(cgb)
+		{
+			uint16_t *out = line.cgb + (curr_tile << 3);
+
+			for(int8_t bit = 7; bit >= 0; bit--)
+			{
+				*out++ = pal[((lo >> bit) & 0x1) | (((hi >> bit) & 0x1) << 1)];
+			}
+		}
+		else
+		{
+			uint16_t packed = 0;
+
+			for(int8_t bit = 7; bit >= 0; bit--)
+			{
+				packed = (packed << 2) | pal[((lo >> bit) & 0x1) | (((hi >> bit) & 0x1) << 1)];
+			}
+
+			line.dmg[curr_tile << 1] = packed >> 8;
+			line.dmg[(curr_tile << 1) + 1] = packed & 0xFF;
+		}
+	}
+
+	// Only touch the screen buffer (and frontends) if something changed
+	if(memcmp(dest, &line, len) != 0)
+	{
+		memcpy(dest, &line, len);
+		state->lcdc.line_hash[ly] = fnv1a(&line, len, FNV1A_INIT);
+		state->lcdc.dirty[ly >> 5] |= 1UL << (ly & 31);
+		state->lcdc.frame_changed = true;
+	}
 }
 
+/*!
+ * @brief	Recompute the STAT interrupt line.
+ * @param	state	The emulator state to check.
+ * @result	LYC coincidence is updated, and INT_LCD_STAT is raised if
+ * 		the line went from low to high.
+ * @note	Only call this when LY, LYC, the mode, or STAT changes.
+ */
+static inline void lcdc_stat_update(emu_state *restrict state)
+{
+	bool line = false;
+
+	state->lcdc.stat.params.lyc_state = (state->lcdc.ly == state->lcdc.lyc);
+
+	if(state->lcdc.stat.params.lyc_state && state->lcdc.stat.params.lyc)
+	{
+		line = true;
+	}
+
+	switch(state->lcdc.stat.params.mode_flag)
+	{
+	case 0:
+		line |= state->lcdc.stat.params.mode_00;
+		break;
+	case 1:
+		line |= state->lcdc.stat.params.mode_01;
+		break;
+	case 2:
+		line |= state->lcdc.stat.params.mode_10;
+		break;
+	}
+
+	if(line && !state->lcdc.stat_line)
+	{
+		signal_interrupt(state, INT_LCD_STAT);
+	}
+
+	state->lcdc.stat_line = line;
+}
+
+/*!
+ * @brief	Move the LCD controller on to its next mode.
+ * @param	state	The emulator state, which has reached lcdc.next_event.
+ * @result	The mode and/or LY change and the next transition is
+ * 		scheduled; nothing needs to run in between.
+ */
 void lcdc_tick(emu_state *restrict state)
 {
-	if(unlikely(state->stop) ||
-	   unlikely(!state->lcdc.lcd_control.params.enable))
+	if(unlikely(!state->lcdc.lcd_control.params.enable))
 	{
+		// lcdc_control_write reschedules us
+		state->lcdc.next_event = LCDC_NEVER;
 		return;
 	}
 
-	state->lcdc.curr_clk++;
+	if(unlikely(state->stop))
+	{
+		// Frozen until we're woken up
+		state->lcdc.next_event++;
+		return;
+	}
 
 	switch(state->lcdc.stat.params.mode_flag)
 	{
 	case 2:
 		/* first mode - reading OAM for h scan line */
-		if(state->lcdc.curr_clk >= 80)
-		{
-			state->lcdc.curr_clk = 0;
-			state->lcdc.stat.params.mode_flag = 3;
-		}
+		state->lcdc.stat.params.mode_flag = 3;
+		state->lcdc.next_event += LCDC_XFER_CLOCKS;
 		break;
 	case 3:
 		/* second mode - reading VRAM for h scan line */
-		if(state->lcdc.curr_clk >= 172)
+		if(state->lcdc.render_frame)
 		{
-			state->lcdc.curr_clk = 0;
-			state->lcdc.stat.params.mode_flag = 0;
+			lcdc_render_line(state);
 		}
+
+		state->lcdc.stat.params.mode_flag = 0;
+		state->lcdc.next_event += LCDC_HBLANK_CLOCKS;
 		break;
 	case 0:
 		/* third mode - h-blank */
-		if(state->lcdc.curr_clk >= 204)
+		if((++state->lcdc.ly) == 144)
 		{
-			uint16_t next_tile = 0x1800;
-			uint8_t skip = 0, curr_tile = 0;
-			uint16_t start = (state->lcdc.lcd_control.params.bg_char_sel) ? 0x0 : 0x800;
-			uint8_t pixel_y_offset = state->lcdc.ly % 8;
-			uint32_t val[4] = { 0x009CBD0F, 0x008CAD0F, 0x00306230, 0x000F380F };
-			static const uint16_t letter_a[8] = { 0x7C7C, 0x00C6, 0xC600, 0x00FE, 0xC6C6, 0x00C6, 0xC600, 0x0000 };
-
-			// Silence GCC
-			(void)letter_a;
+			/* going to v-blank */
+			state->lcdc.stat.params.mode_flag = 1;
+			state->lcdc.next_event += LCDC_LINE_CLOCKS;
 
-			if (state->lcdc.lcd_control.params.bg_code_sel)
-			{
-				next_tile += 0x400;
-			}
-			next_tile += (state->lcdc.ly >> 3) << 5;
+			// Fire the vblank interrupt
+			signal_interrupt(state, INT_VBLANK);
 
-			for (; curr_tile < 20; curr_tile++, next_tile++, skip += 8)
+			state->lcdc.frames++;
+			if(state->lcdc.render_frame)
 			{
-				uint8_t tile = state->lcdc.vram[0x0][next_tile];
-				uint8_t pixel_temp;
-				uint16_t *mem;
-				if (!state->lcdc.lcd_control.params.bg_char_sel)
+				if(state->lcdc.frame_changed)
 				{
-					tile -= 0x80;
+					state->lcdc.frame_hash = fnv1a(state->lcdc.line_hash,
+						sizeof(state->lcdc.line_hash), FNV1A_INIT);
+					state->lcdc.frame_changed = false;
 				}
-				mem = (uint16_t *)(state->lcdc.vram[0x0] + start + (tile * 16) + (pixel_y_offset * 2));
-
-				pixel_temp = ((*mem & 0x01) << 1) | (*mem & 0x100 >> 8);
-				state->lcdc.out[state->lcdc.ly][skip + 7] = val[pixel_temp];
-				pixel_temp = ((*mem & 0x02)) | ((*mem & 0x200) >> 9);
-				state->lcdc.out[state->lcdc.ly][skip + 6] = val[pixel_temp];
-				pixel_temp = ((*mem & 0x04) >> 1) | ((*mem & 0x400) >> 10);
-				state->lcdc.out[state->lcdc.ly][skip + 5] = val[pixel_temp];
-				pixel_temp = ((*mem & 0x08) >> 2) | ((*mem & 0x800) >> 11);
-				state->lcdc.out[state->lcdc.ly][skip + 4] = val[pixel_temp];
-				pixel_temp = ((*mem & 0x10) >> 3) | ((*mem & 0x1000) >> 12);
-				state->lcdc.out[state->lcdc.ly][skip + 3] = val[pixel_temp];
-				pixel_temp = ((*mem & 0x20) >> 4) | ((*mem & 0x2000) >> 13);
-				state->lcdc.out[state->lcdc.ly][skip + 2] = val[pixel_temp];
-				pixel_temp = ((*mem & 0x40) >> 5) | ((*mem & 0x4000) >> 14);
-				state->lcdc.out[state->lcdc.ly][skip + 1] = val[pixel_temp];
-				pixel_temp = ((*mem & 0x80) >> 6) | ((*mem & 0x8000) >> 15);
-				state->lcdc.out[state->lcdc.ly][skip] = val[pixel_temp];
-			}
 
-			state->lcdc.curr_clk = 0;
-			if((++state->lcdc.ly) == 144)
-			{
-				/* going to v-blank */
-				state->lcdc.stat.params.mode_flag = 1;
-			}
-			else
-			{
-				/* start another scan line */
-				state->lcdc.stat.params.mode_flag = 2;
+				// Blit
+				BLIT_CANVAS(state);
+				state->render_request = false;
 			}
 		}
+		else
+		{
+			/* start another scan line */
+			state->lcdc.stat.params.mode_flag = 2;
+			state->lcdc.next_event += LCDC_OAM_CLOCKS;
+		}
 		break;
 	case 1:
 		/* v-blank */
-		if(state->lcdc.ly == 144 &&
-		   state->lcdc.curr_clk == 1)
+		if((++state->lcdc.ly) == 154)
 		{
-			// Fire the vblank interrupt
-			signal_interrupt(state, INT_VBLANK);
+			state->lcdc.ly = 0;
+			state->lcdc.stat.params.mode_flag = 2;
+			state->lcdc.next_event += LCDC_OAM_CLOCKS;
+			lcdc_start_frame(state);
+		}
+		else
+		{
+			state->lcdc.next_event += LCDC_LINE_CLOCKS;
+		}
+		break;
+	default:
+		fatal(state, "somehow wound up in an unknown impossible video mode");
+	}
+
+	lcdc_stat_update(state);
+}
+
+/*!
+ * @brief	Convert a line of the screen buffer to ARGB8888.
+ * @param	state	The emulator state to read the screen of.
+ * @param	line	The line to convert (0..143).
+ * @param	dst	Where to put the 160 converted pixels.
+ */
+void lcdc_line_to_argb(const emu_state *restrict state, uint8_t line, uint32_t *restrict dst)
+{
+	if(state->system == SYSTEM_CGB)
+	{
+		const uint16_t *src = state->lcdc.out.cgb[line];
 
-			// Blit
-			BLIT_CANVAS(state);
+		for(uint8_t x = 0; x < LCDC_WIDTH; x++)
+		{
+			dst[x] = rgb555_to_argb(src[x]);
 		}
+	}
+	else
+	{
+		const uint8_t *src = state->lcdc.out.dmg[line];
 
-		if(state->lcdc.curr_clk % 456 == 0)
+		for(uint8_t x = 0; x < LCDC_WIDTH / 4; x++, dst += 4)
 		{
-			state->lcdc.ly++;
-		};
+			dst[0] = lcdc_dmg_shades[src[x] >> 6];
+			dst[1] = lcdc_dmg_shades[(src[x] >> 4) & 0x3];
+			dst[2] = lcdc_dmg_shades[(src[x] >> 2) & 0x3];
+			dst[3] = lcdc_dmg_shades[src[x] & 0x3];
+		}
+	}
+}
+
+/*!
+ * @brief	Convert a line of the screen buffer to 8-bit values.
+ * @param	state	The emulator state to read the screen of.
+ * @param	line	The line to convert (0..143).
+ * @param	dst	Where to put the 160 converted pixels.
+ * @note	DMG pixels become their shade (0 = lightest .. 3); CGB pixels
+ * 		become grey levels (0 = black .. 255).
+ */
+void lcdc_line_to_index(const emu_state *restrict state, uint8_t line, uint8_t *restrict dst)
+{
+	if(state->system == SYSTEM_CGB)
+	{
+		const uint16_t *src = state->lcdc.out.cgb[line];
 
-		if(state->lcdc.ly == 153)
+		for(uint8_t x = 0; x < LCDC_WIDTH; x++)
 		{
-			state->lcdc.curr_clk = 0;
-			state->lcdc.ly = 0;
-			state->lcdc.stat.params.mode_flag = 2;
+			uint16_t r = src[x] & 0x1F;
+			uint16_t g = (src[x] >> 5) & 0x1F;
+			uint16_t b = (src[x] >> 10) & 0x1F;
+
+			// Weights add up to 32, and 31 * 8.25 rounds to 255
+			dst[x] = (((r * 10) + (g * 16) + (b * 6)) * 33) >> 7;
 		}
+	}
+	else
+	{
+		const uint8_t *src = state->lcdc.out.dmg[line];
 
-		break;
-	default:
-		fatal(state, "somehow wound up in an unknown impossible video mode");
+		for(uint8_t x = 0; x < LCDC_WIDTH / 4; x++, dst += 4)
+		{
+			dst[0] = src[x] >> 6;
+			dst[1] = (src[x] >> 4) & 0x3;
+			dst[2] = (src[x] >> 2) & 0x3;
+			dst[3] = src[x] & 0x3;
+		}
 	}
+}
 
-	if(state->lcdc.ly == state->lcdc.lyc)
+/*!
+ * @brief	Find the next run of changed lines.
+ * @param	state	The emulator state to look at.
+ * @param	start	The line to start looking from; set to the first
+ * 			line of the run found.
+ * @returns	The number of lines in the run, 0 if there are no more.
+ */
+uint8_t lcdc_dirty_run(const emu_state *restrict state, uint8_t *start)
+{
+	const uint32_t *dirty = state->lcdc.dirty;
+	uint8_t line = *start, count = 0;
+
+	while(line < LCDC_HEIGHT && !(dirty[line >> 5] & (1UL << (line & 31))))
 	{
-		state->lcdc.stat.params.lyc_state = true;
-		if(state->lcdc.stat.params.lyc)
+		// Skip whole clean words quickly
+		if((line & 31) == 0 && dirty[line >> 5] == 0)
 		{
-			signal_interrupt(state, INT_LCD_STAT);
+			line += 32;
+			continue;
 		}
+
+		line++;
 	}
-	else
+
+	*start = line;
+
+	while(line < LCDC_HEIGHT && (dirty[line >> 5] & (1UL << (line & 31))))
 	{
-		state->lcdc.stat.params.lyc_state = false;
+		line++;
+		count++;
 	}
+
+	return count;
+}
+
+/*!
+ * @brief	Mark every line as seen by the frontend.
+ * @param	state	The emulator state to clear.
+ */
+void lcdc_clear_dirty(emu_state *restrict state)
+{
+	memset(state->lcdc.dirty, 0, sizeof(state->lcdc.dirty));
+}
+
+/*!
+ * @brief	Choose which frames the LCD controller draws.
+ * @param	state	The emulator state to change.
+ * @param	policy	The render policy to use.
+ * @param	skip	For RENDER_SKIP, draw one frame in this many.
+ * @result	Takes effect from the next frame.
+ */
+void set_render_policy(emu_state *restrict state, render_policy policy, unsigned int skip)
+{
+	state->render = policy;
+	state->render_skip = skip;
+}
+
+/*!
+ * @brief	Ask for the next whole frame to be drawn and blitted.
+ * @param	state	The emulator state to draw.
+ * @note	Only meaningful with RENDER_ON_DEMAND.
+ */
+void request_frame(emu_state *restrict state)
+{
+	state->render_request = true;
 }
 
 inline uint8_t lcdc_read(emu_state *restrict state, uint16_t reg)
@@ -235,6 +537,22 @@ inline uint8_t lcdc_window_read(emu_state *restrict state, uint16_t reg)
 	}
 }
 
+inline uint8_t dmg_pal_read(emu_state *restrict state, uint16_t reg)
+{
+	switch(reg)
+	{
+	case 0xFF47:
+		return state->lcdc.bgp;
+	case 0xFF48:
+		return state->lcdc.obp[0];
+	case 0xFF49:
+		return state->lcdc.obp[1];
+	default:
+		fatal(state, "BUG: Attempt to read palette stuff from non-palette reg");
+		return 0xFF;
+	}
+}
+
 inline uint8_t bg_pal_ind_read(emu_state *restrict state, uint16_t reg)
 {
 	if(state->system != SYSTEM_CGB)
@@ -242,8 +560,7 @@ inline uint8_t bg_pal_ind_read(emu_state *restrict state, uint16_t reg)
 		return no_hardware(state, reg);
 	}
 
-	// TODO
-	return state->memory[reg];
+	return state->lcdc.bcps.reg | 0x40;
 }
 
 inline uint8_t bg_pal_data_read(emu_state *restrict state, uint16_t reg)
@@ -253,8 +570,7 @@ inline uint8_t bg_pal_data_read(emu_state *restrict state, uint16_t reg)
 		return no_hardware(state, reg);
 	}
 
-	// TODO
-	return state->memory[reg];
+	return state->lcdc.bg_pal[state->lcdc.bcps.reg & 0x3F];
 }
 
 inline uint8_t sprite_pal_ind_read(emu_state *restrict state, uint16_t reg)
@@ -264,8 +580,7 @@ inline uint8_t sprite_pal_ind_read(emu_state *restrict state, uint16_t reg)
 		return no_hardware(state, reg);
 	}
 
-	// TODO
-	return state->memory[reg];
+	return state->lcdc.ocps.reg | 0x40;
 }
 
 inline uint8_t sprite_pal_data_read(emu_state *restrict state, uint16_t reg)
@@ -275,8 +590,7 @@ inline uint8_t sprite_pal_data_read(emu_state *restrict state, uint16_t reg)
 		return no_hardware(state, reg);
 	}
 
-	// TODO
-	return state->memory[reg];
+	return state->lcdc.obj_pal[state->lcdc.ocps.reg & 0x3F];
 }
 
 void dump_lcdc_state(emu_state *restrict state)
@@ -295,7 +609,7 @@ void dump_lcdc_state(emu_state *restrict state)
 	);
 	debug(state, "STAT: %02X (MODE=%d)",
 	      state->lcdc.stat.reg, state->lcdc.stat.params.mode_flag);
-	debug(state, "ICLK: %02X", state->lcdc.curr_clk);
+	debug(state, "NEXT: %llu", (unsigned long long)state->lcdc.next_event);
 	debug(state, "LY  : %02X", state->lcdc.ly);
 }
 
@@ -317,16 +631,43 @@ inline void vram_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 	}
 
 	state->lcdc.vram[bank][reg - 0x8000] = data;
+	snapshot_mark(state->written.vram + (bank & 1), reg - 0x8000);
 }
 
 inline void lcdc_control_write(emu_state *restrict state, uint16_t reg UNUSED, uint8_t data)
 {
+	bool was_enabled = state->lcdc.lcd_control.params.enable;
+
 	state->lcdc.lcd_control.reg = data;
+
+	if(was_enabled == state->lcdc.lcd_control.params.enable)
+	{
+		return;
+	}
+
+	state->lcdc.ly = 0;
+
+	if(state->lcdc.lcd_control.params.enable)
+	{
+		// Start over from the top of the screen
+		state->lcdc.stat.params.mode_flag = 2;
+		state->lcdc.next_event = state->cycles + LCDC_OAM_CLOCKS;
+		lcdc_start_frame(state);
+	}
+	else
+	{
+		state->lcdc.stat.params.mode_flag = 0;
+		state->lcdc.next_event = LCDC_NEVER;
+	}
+
+	lcdc_stat_update(state);
 }
 
 inline void lcdc_stat_write(emu_state *restrict state, uint16_t reg UNUSED, uint8_t data)
 {
-	state->lcdc.stat.params.lyc = ((data & 0x60) == 0x60);
+	// Only the interrupt selection bits are writable
+	state->lcdc.stat.reg = (state->lcdc.stat.reg & 0x07) | (data & 0x78);
+	lcdc_stat_update(state);
 }
 
 inline void lcdc_scroll_write(emu_state *restrict state, uint16_t reg, uint8_t data)
@@ -357,6 +698,7 @@ inline void lcdc_ly_write(emu_state *restrict state, uint16_t reg UNUSED, uint8_
 inline void lcdc_lyc_write(emu_state *restrict state, uint16_t reg UNUSED, uint8_t data)
 {
 	state->lcdc.lyc = data;
+	lcdc_stat_update(state);
 }
 
 inline void lcdc_window_write(emu_state *restrict state, uint16_t reg, uint8_t data)
@@ -375,6 +717,50 @@ inline void lcdc_window_write(emu_state *restrict state, uint16_t reg, uint8_t d
 	}
 }
 
+inline void dmg_pal_write(emu_state *restrict state, uint16_t reg, uint8_t data)
+{
+	uint16_t *cache;
+
+	switch(reg)
+	{
+	case 0xFF47:
+		state->lcdc.bgp = data;
+		cache = state->lcdc.pal_out;
+		break;
+	case 0xFF48:
+		state->lcdc.obp[0] = data;
+		cache = state->lcdc.pal_out + PAL_OUT_OBJ;
+		break;
+	case 0xFF49:
+		state->lcdc.obp[1] = data;
+		cache = state->lcdc.pal_out + PAL_OUT_OBJ + 4;
+		break;
+	default:
+		fatal(state, "BUG: Attempt to write palette data to non-palette register");
+		return;
+	}
+
+	// CGB palettes come from palette RAM instead
+	if(state->system != SYSTEM_CGB)
+	{
+		update_dmg_palette(cache, data);
+	}
+}
+
+/*! Write a byte of CGB palette RAM, then bump the index if asked to */
+static inline void pal_data_write(cps *sel, uint8_t *ram, uint16_t *cache, uint8_t data)
+{
+	uint8_t index = sel->reg & 0x3F;
+
+	ram[index] = data;
+	update_cgb_colour(ram, cache, index);
+
+	if(sel->params.pal_sel)
+	{
+		sel->reg = (sel->reg & 0x80) | ((index + 1) & 0x3F);
+	}
+}
+
 void bg_pal_ind_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 {
 	if(state->system != SYSTEM_CGB)
@@ -383,8 +769,7 @@ void bg_pal_ind_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 		return;
 	}
 
-	// TODO
-	state->memory[reg] = data;
+	state->lcdc.bcps.reg = data & 0xBF;
 }
 
 void bg_pal_data_write(emu_state *restrict state, uint16_t reg, uint8_t data)
@@ -395,8 +780,8 @@ void bg_pal_data_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 		return;
 	}
 
-	// TODO
-	state->memory[reg] = data;
+	pal_data_write(&(state->lcdc.bcps), state->lcdc.bg_pal,
+		state->lcdc.pal_out, data);
 }
 
 void sprite_pal_ind_write(emu_state *restrict state, uint16_t reg, uint8_t data)
@@ -407,8 +792,7 @@ void sprite_pal_ind_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 		return;
 	}
 
-	// TODO
-	state->memory[reg] = data;
+	state->lcdc.ocps.reg = data & 0xBF;
 }
 
 void sprite_pal_data_write(emu_state *restrict state, uint16_t reg, uint8_t data)
@@ -419,8 +803,8 @@ void sprite_pal_data_write(emu_state *restrict state, uint16_t reg, uint8_t data
 		return;
 	}
 
-	// TODO
-	state->memory[reg] = data;
+	pal_data_write(&(state->lcdc.ocps), state->lcdc.obj_pal,
+		state->lcdc.pal_out + PAL_OUT_OBJ, data);
 }
 
 void magical_mystery_cure(void)
@@ -432,6 +816,7 @@ void magical_mystery_cure(void)
 	lcdc_ly_read(NULL, 0);
 	lcdc_lyc_read(NULL, 0);
 	lcdc_window_read(NULL, 0);
+	dmg_pal_read(NULL, 0);
 	bg_pal_ind_read(NULL, 0);
 	bg_pal_data_read(NULL, 0);
 	sprite_pal_ind_read(NULL, 0);
@@ -444,5 +829,6 @@ void magical_mystery_cure(void)
 	lcdc_ly_write(NULL, 0, 0);
 	lcdc_lyc_write(NULL, 0, 0);
 	lcdc_window_write(NULL, 0, 0);
+	dmg_pal_write(NULL, 0, 0);
 	vram_write(NULL, 0, 0);
 }
@@ -0,0 +1,676 @@
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include "ctl_unit.h"	// signal_interrupt, INT_SERIAL
+#include "link.h"	// prototypes
+#include "print.h"	// error, info
+#include "sgherm.h"	// emu_state
+#include "util_ring.h"	// spsc_ring
+#include "util_thread.h"	// thread_yield
+#include "util_time.h"	// get_time
+
+#include <stdio.h>	// perror
+#include <stdlib.h>	// calloc, free
+#include <string.h>	// strcpy, strlen
+
+#ifdef HAVE_SHM_OPEN
+#	include <errno.h>	// errno, EEXIST
+#	include <fcntl.h>	// O_*
+#	include <sys/mman.h>	// shm_open, mmap
+#	include <sys/stat.h>	// fstat
+#	include <unistd.h>	// ftruncate, close
+#endif
+
+
+/*!
+ * Packets are one ring word: the sender's cycle count in the top 48 bits,
+ * then the packet kind, then the byte being exchanged.  The two sides'
+ * counts have nothing to do with each other (either may have been running
+ * for hours before plugging in), so the cycle is only there for debugging.
+ */
+#define LINK_PACKET(cycle, kind, data) \
+	(((uint64_t)(cycle) << 16) | ((uint64_t)(kind) << 8) | (data))
+#define LINK_PACKET_CYCLE(p)	((p) >> 16)
+#define LINK_PACKET_KIND(p)	(((p) >> 8) & 0xFF)
+#define LINK_PACKET_DATA(p)	((p) & 0xFF)
+
+#define LINK_MAGIC	0x4B4E4C53	/*! 'SLNK' */
+#define LINK_TIMEOUT	2000000000ULL	/*! ns of silence before giving up */
+
+typedef enum
+{
+	LINK_START = 1,		/*! Clock master started a transfer */
+	LINK_REPLY,		/*! Other side's byte for that transfer */
+} link_packet_kind;
+
+/*! What lives in shared memory; no pointers allowed */
+typedef struct link_shared_t
+{
+	volatile uint32_t magic;	/*! Set once the rings are usable */
+	volatile uint32_t refs;		/*! Sides still attached */
+	volatile uint32_t taken[2];	/*! Side has been claimed, ever */
+	volatile uint32_t closed[2];	/*! Side has gone away */
+	volatile uint32_t beat[2];	/*! Bumped while the side is running */
+	spsc_ring ring[2];		/*! Packets to side n */
+} link_shared;
+
+/*! Per-instance view of the cable */
+struct link_state_t
+{
+	link_shared *shared;
+	spsc_ring *tx, *rx;
+	unsigned int side;
+	bool mapped;			/*! shared is an mmap, not calloc */
+	bool owner;			/*! we made the shm object */
+	char name[64];			/*! shm object name */
+	uint64_t dev, ino;		/*! The object we made, by identity */
+	uint32_t beat;			/*! Our last shared->beat */
+	bool dead;			/*! Peer stopped answering; unplugged */
+};
+
+/*! Watching for the peer to stop while we wait on it */
+typedef struct link_watch_t
+{
+	uint32_t beat;			/*! Peer's beat last time it moved */
+	uint64_t since;			/*! When that was */
+} link_watch;
+
+
+static bool link_attach(emu_state *restrict state, link_shared *shared,
+		unsigned int side, bool mapped)
+{
+	link_state *link;
+
+	// One instance per side; a side that has gone isn't replaced
+	if(!atomic_cas(&(shared->taken[side]), 0, 1))
+	{
+		error(state, "link: side %u is already taken", side);
+		return false;
+	}
+
+	if((link = calloc(1, sizeof(link_state))) == NULL)
+	{
+		error(state, "link: out of memory");
+		store_release(&(shared->taken[side]), 0);
+		return false;
+	}
+
+	link->shared = shared;
+	link->side = side;
+	link->rx = &(shared->ring[side]);
+	link->tx = &(shared->ring[!side]);
+	link->mapped = mapped;
+
+	atomic_inc(&(shared->refs));
+
+	state->link = link;
+	state->ser.link_next = state->cycles + LINK_POLL_CLOCKS;
+
+	return true;
+}
+
+/*!
+ * @brief	Connect two instances in the same process.
+ * @param	a	The first emulator.
+ * @param	b	The second emulator.
+ * @returns	true if the cable was connected.
+ * @note	Transfers block until the other side answers, so the two
+ * 		instances must be stepped on separate threads.
+ */
+bool link_pair(emu_state *restrict a, emu_state *restrict b)
+{
+	link_shared *shared = calloc(1, sizeof(link_shared));
+
+	if(shared == NULL)
+	{
+		error(a, "link: out of memory");
+		return false;
+	}
+
+	shared->magic = LINK_MAGIC;
+
+	if(!link_attach(a, shared, 0, false))
+	{
+		free(shared);
+		return false;
+	}
+
+	if(!link_attach(b, shared, 1, false))
+	{
+		link_close(a);
+		return false;
+	}
+
+	return true;
+}
+
+#ifdef HAVE_SHM_OPEN
+typedef enum
+{
+	LINK_SHM_OK = 0,
+	LINK_SHM_MISSING,	/*! Nothing by that name yet */
+	LINK_SHM_STALE,		/*! Left behind by a side that has gone */
+	LINK_SHM_BUSY,		/*! In use: both sides there, or made already */
+	LINK_SHM_FAILED,	/*! Anything else; already reported */
+} link_shm_result;
+
+/*! true if a side's heartbeat moves within LINK_TIMEOUT */
+static bool link_side_alive(link_shared *shared, unsigned int side)
+{
+	uint32_t beat = load_acquire(&(shared->beat[side]));
+	uint64_t start = get_time();
+
+	do
+	{
+		if(load_acquire(&(shared->beat[side])) != beat)
+		{
+			return true;
+		}
+
+		thread_sleep(1);
+	} while(get_time() - start < LINK_TIMEOUT);
+
+	return false;
+}
+
+/*! true if name is still the object link made (not a replacement) */
+static bool link_shm_ours(const link_state *link)
+{
+	struct stat st;
+	int fd = shm_open(link->name, O_RDONLY, 0);
+	bool ours;
+
+	if(fd < 0)
+	{
+		return false;
+	}
+
+	ours = (fstat(fd, &st) == 0 && (uint64_t)st.st_dev == link->dev &&
+		(uint64_t)st.st_ino == link->ino);
+	close(fd);
+
+	return ours;
+}
+
+/*! Side 1: is a mapped object somebody's live, unclaimed end? */
+static link_shm_result link_shm_check(link_shared *shared)
+{
+	// Its maker may be a moment from finishing it
+	if(load_acquire(&(shared->magic)) != LINK_MAGIC)
+	{
+		thread_sleep(10);
+		if(load_acquire(&(shared->magic)) != LINK_MAGIC)
+		{
+			return LINK_SHM_STALE;
+		}
+	}
+
+	if(load_acquire(&(shared->closed[0])) ||
+		load_acquire(&(shared->closed[1])) ||
+		!link_side_alive(shared, 0))
+	{
+		return LINK_SHM_STALE;
+	}
+
+	if(load_acquire(&(shared->taken[1])))
+	{
+		return link_side_alive(shared, 1) ? LINK_SHM_BUSY :
+			LINK_SHM_STALE;
+	}
+
+	return LINK_SHM_OK;
+}
+
+static link_shm_result link_shm_open(emu_state *restrict state,
+		const char *name, unsigned int side)
+{
+	link_shm_result res;
+	link_shared *shared;
+	struct stat st;
+	int fd;
+
+	if(side == 0)
+	{
+		if((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600)) < 0)
+		{
+			if(errno == EEXIST)
+			{
+				return LINK_SHM_BUSY;
+			}
+
+			perror("link: shm_open");
+			return LINK_SHM_FAILED;
+		}
+
+		if(ftruncate(fd, sizeof(link_shared)) < 0 || fstat(fd, &st) < 0)
+		{
+			perror("link: ftruncate");
+			close(fd);
+			shm_unlink(name);
+			return LINK_SHM_FAILED;
+		}
+	}
+	else
+	{
+		if((fd = shm_open(name, O_RDWR, 0600)) < 0)
+		{
+			return LINK_SHM_MISSING;
+		}
+
+		// Made, but never sized: same as for the magic below
+		if(fstat(fd, &st) == 0 && (size_t)st.st_size < sizeof(link_shared))
+		{
+			thread_sleep(10);
+		}
+
+		if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(link_shared))
+		{
+			close(fd);
+			return LINK_SHM_STALE;
+		}
+	}
+
+	shared = mmap(NULL, sizeof(link_shared), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(shared == MAP_FAILED)
+	{
+		perror("link: mmap");
+		if(side == 0)
+		{
+			shm_unlink(name);
+		}
+		return LINK_SHM_FAILED;
+	}
+
+	if(side == 0)
+	{
+		// ftruncate zeroes it; publish once everything else is there
+		store_release(&(shared->magic), LINK_MAGIC);
+	}
+	else if((res = link_shm_check(shared)) != LINK_SHM_OK)
+	{
+		munmap(shared, sizeof(link_shared));
+		return res;
+	}
+
+	if(!link_attach(state, shared, side, true))
+	{
+		munmap(shared, sizeof(link_shared));
+		if(side == 0)
+		{
+			shm_unlink(name);
+			return LINK_SHM_FAILED;
+		}
+
+		// Somebody else claimed it first
+		return LINK_SHM_BUSY;
+	}
+
+	state->link->owner = (side == 0);
+	state->link->dev = (uint64_t)st.st_dev;
+	state->link->ino = (uint64_t)st.st_ino;
+	strcpy(state->link->name, name);
+
+	info(state, "link: attached to %s as side %u", name, side);
+
+	return LINK_SHM_OK;
+}
+
+/*!
+ * @brief	Connect to another process through shared memory.
+ * @param	state	The emulator to connect.
+ * @param	name	The shared memory object name (e.g. "/sgherm-link").
+ * @param	side	0 creates the object, 1 attaches to it.
+ * @returns	true if connected; side 1 fails until side 0 has set up and
+ * 		is running, and if the object is stale or already has a side 1.
+ */
+bool link_open_shm(emu_state *restrict state, const char *name,
+		unsigned int side)
+{
+	if(side > 1 || strlen(name) >= sizeof(((link_state *)0)->name))
+	{
+		error(state, "link: bad side or name");
+		return false;
+	}
+
+	switch(link_shm_open(state, name, side))
+	{
+	case LINK_SHM_OK:
+		return true;
+	case LINK_SHM_STALE:
+		error(state, "link: %s was left behind by a side that has gone",
+			name);
+		return false;
+	case LINK_SHM_BUSY:
+		error(state, "link: %s is already in use", name);
+		return false;
+	default:
+		return false;
+	}
+}
+
+/*!
+ * @brief	Connect to whichever process connects with the same name.
+ * @param	state	The emulator to connect.
+ * @param	name	The shared memory object name (e.g. "/sgherm-link").
+ * @returns	true if connected, perhaps still waiting for the other side.
+ * @note	The first one there creates the object, as side 0, and must be
+ * 		running for the second to attach.  An object left behind by a
+ * 		process that went away is replaced.
+ */
+bool link_connect(emu_state *restrict state, const char *name)
+{
+	if(strlen(name) >= sizeof(((link_state *)0)->name))
+	{
+		error(state, "link: name too long");
+		return false;
+	}
+
+	// Only a race with another newcomer needs a second go
+	for(unsigned int tries = 0; tries < 3; tries++)
+	{
+		switch(link_shm_open(state, name, 1))
+		{
+		case LINK_SHM_OK:
+			return true;
+		case LINK_SHM_STALE:
+			info(state, "link: replacing %s, left behind by a side "
+				"that has gone", name);
+			shm_unlink(name);
+			break;
+		case LINK_SHM_MISSING:
+			break;
+		case LINK_SHM_BUSY:
+			error(state, "link: %s already has both sides", name);
+			return false;
+		default:
+			return false;
+		}
+
+		switch(link_shm_open(state, name, 0))
+		{
+		case LINK_SHM_OK:
+			return true;
+		case LINK_SHM_BUSY:
+			// Somebody made it just now; attach to theirs
+			continue;
+		default:
+			return false;
+		}
+	}
+
+	error(state, "link: can't connect to %s", name);
+	return false;
+}
+#else
+bool link_open_shm(emu_state *restrict state, const char *name UNUSED,
+		unsigned int side UNUSED)
+{
+	error(state, "link: shared memory is not supported on this platform");
+	return false;
+}
+
+bool link_connect(emu_state *restrict state, const char *name UNUSED)
+{
+	return link_open_shm(state, name, 0);
+}
+#endif /*HAVE_SHM_OPEN*/
+
+/*!
+ * @brief	Disconnect the cable.
+ * @param	state	The emulator to disconnect.
+ * @result	The other side sees 0xFF from now on.
+ */
+void link_close(emu_state *restrict state)
+{
+	link_state *link = state->link;
+	link_shared *shared;
+	bool last;
+
+	if(link == NULL)
+	{
+		return;
+	}
+
+	shared = link->shared;
+	store_release(&(shared->closed[link->side]), 1);
+	last = (atomic_dec(&(shared->refs)) == 0);
+
+	if(link->mapped)
+	{
+#ifdef HAVE_SHM_OPEN
+		munmap(shared, sizeof(link_shared));
+
+		// Unless someone has replaced it since, thinking us gone
+		if(link->owner && link_shm_ours(link))
+		{
+			shm_unlink(link->name);
+		}
+#endif
+	}
+	else if(last)
+	{
+		free(shared);
+	}
+
+	free(link);
+	state->link = NULL;
+	state->ser.link_next = LINK_NEVER;
+}
+
+/*! Let the other side know we're still here */
+static inline void link_beat(link_state *link)
+{
+	store_release(&(link->shared->beat[link->side]), ++(link->beat));
+}
+
+static void link_watch_start(link_state *link, link_watch *watch)
+{
+	watch->beat = load_acquire(&(link->shared->beat[!link->side]));
+	watch->since = get_time();
+}
+
+/*!
+ * @brief	Wait a moment for the other side.
+ * @param	state	The emulator waiting.
+ * @param	watch	From link_watch_start, before the first wait.
+ * @returns	false if there is no use waiting any more.
+ * @note	A peer that hasn't been attached, has gone, or has not moved
+ * 		for LINK_TIMEOUT is no use; the last kind unplugs the cable
+ * 		for good, since a hung process never says it's closed.
+ */
+static bool link_wait(emu_state *restrict state, link_watch *watch)
+{
+	link_state *link = state->link;
+	link_shared *shared = link->shared;
+	uint32_t beat;
+	uint64_t now;
+
+	if(link->dead || state->do_exit ||
+		load_acquire(&(shared->closed[!link->side])) ||
+		load_acquire(&(shared->refs)) < 2)
+	{
+		return false;
+	}
+
+	link_beat(link);
+
+	beat = load_acquire(&(shared->beat[!link->side]));
+	now = get_time();
+	if(beat != watch->beat)
+	{
+		watch->beat = beat;
+		watch->since = now;
+	}
+	else if(now - watch->since > LINK_TIMEOUT)
+	{
+		error(state, "link: the other side stopped answering; unplugged");
+		link->dead = true;
+		return false;
+	}
+
+	thread_yield();
+	return true;
+}
+
+static void link_send(emu_state *restrict state, link_packet_kind kind,
+		uint8_t data)
+{
+	link_state *link = state->link;
+	uint64_t packet = LINK_PACKET(state->cycles, kind, data);
+	link_watch watch;
+
+	// Nobody on the other end to hear it (yet, or any more)
+	if(link->dead || load_acquire(&(link->shared->refs)) < 2)
+	{
+		return;
+	}
+
+	link_watch_start(link, &watch);
+
+	// Only ever a couple of packets in flight, but be safe
+	while(!ring_push(link->tx, packet))
+	{
+		if(!link_wait(state, &watch))
+		{
+			return;
+		}
+	}
+}
+
+/*! Act on a transfer started by the other side's clock */
+static void link_receive_start(emu_state *restrict state, uint64_t packet)
+{
+	// Only a side waiting on the external clock takes part
+	if(!state->ser.enabled || state->ser.use_internal ||
+		state->ser.link_pending)
+	{
+		link_send(state, LINK_REPLY, 0xFF);
+		return;
+	}
+
+	link_send(state, LINK_REPLY, state->ser.out);
+
+	/*
+	 * Finish when the bits would have arrived.  It was sent some time
+	 * since the last poll; call it half a poll ago.
+	 */
+	state->ser.link_pending = true;
+	state->ser.link_in = LINK_PACKET_DATA(packet);
+	state->ser.link_due = state->cycles + LINK_XFER_CLOCKS -
+		(LINK_POLL_CLOCKS / 2);
+}
+
+/*!
+ * @brief	Begin a transfer clocked by this side.
+ * @param	state	The emulator driving the clock.
+ * @param	data	The byte being sent.
+ */
+void link_start(emu_state *restrict state, uint8_t data)
+{
+	link_send(state, LINK_START, data);
+}
+
+/*!
+ * @brief	Complete a transfer clocked by this side.
+ * @param	state	The emulator driving the clock.
+ * @returns	The other side's byte, or 0xFF if nobody is there.
+ * @note	This is the only point the two sides wait on each other.
+ */
+uint8_t link_finish(emu_state *restrict state)
+{
+	link_state *link = state->link;
+	link_watch watch;
+	uint64_t packet;
+
+	if(link->dead)
+	{
+		return 0xFF;
+	}
+
+	link_watch_start(link, &watch);
+
+	for(;;)
+	{
+		while(ring_pop(link->rx, &packet))
+		{
+			switch(LINK_PACKET_KIND(packet))
+			{
+			case LINK_REPLY:
+				return LINK_PACKET_DATA(packet);
+			case LINK_START:
+				// Both sides drive the clock; neither hears anything
+				link_send(state, LINK_REPLY, 0xFF);
+				break;
+			default:
+				error(state, "link: bad packet %016llX",
+					(unsigned long long)packet);
+				break;
+			}
+		}
+
+		if(!link_wait(state, &watch))
+		{
+			return 0xFF;
+		}
+	}
+}
+
+/*!
+ * @brief	Check the cable for transfers started by the other side.
+ * @param	state	The emulator to check.
+ * @note	Called when state->cycles reaches ser.link_next.
+ */
+void link_poll(emu_state *restrict state)
+{
+	link_state *link = state->link;
+	uint64_t packet;
+
+	if(link == NULL)
+	{
+		state->ser.link_next = LINK_NEVER;
+		return;
+	}
+
+	if(state->ser.link_pending && state->cycles >= state->ser.link_due)
+	{
+		state->ser.link_pending = false;
+		state->ser.in = state->ser.link_in;
+		state->ser.enabled = false;
+		signal_interrupt(state, INT_SERIAL);
+	}
+
+	if(link->dead)
+	{
+		// Finish what we had, then it's as good as unplugged
+		state->ser.link_next = state->ser.link_pending ?
+			state->ser.link_due : LINK_NEVER;
+		return;
+	}
+
+	link_beat(link);
+
+	while(ring_pop(link->rx, &packet))
+	{
+		switch(LINK_PACKET_KIND(packet))
+		{
+		case LINK_START:
+			link_receive_start(state, packet);
+			break;
+		case LINK_REPLY:
+			// Stale answer to a transfer we gave up on
+			break;
+		default:
+			error(state, "link: bad packet %016llX",
+				(unsigned long long)packet);
+			break;
+		}
+	}
+
+	state->ser.link_next = state->cycles + LINK_POLL_CLOCKS;
+	if(state->ser.link_pending && state->ser.link_due < state->ser.link_next)
+	{
+		state->ser.link_next = state->ser.link_due;
+	}
+}
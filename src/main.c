@@ -1,137 +1,194 @@
 #include "config.h"	// bool
 
-#include "ctl_unit.h"	// init_ctl, execute
-#include "debug.h"	// print_cycles
-#include "frontend.h"	// null_frontend_*
-#include "lcdc.h"	// lcdc_tick
-#include "print.h"	// fatal, error, debug
-#include "rom_read.h"	// offsets
-#include "serio.h"	// serial_tick
-#include "sgherm.h"	// emu_state, constants
-#include "signals.h"	// register_handler
-#include "sound.h"	// sound_tick
-#include "timer.h"	// get_clock
-#include "util_time.h"	// get_time
-
-#include <stdio.h>	// file methods
-#include <stdlib.h>	// exit
-#include <string.h>	// memset
-
-emu_state * init_emulator(const char *rom_path, frontend_type input,
-		frontend_type audio, frontend_type video,
-		frontend_type event_loop)
-{
-	emu_state *state = (emu_state *)calloc(1, sizeof(emu_state));
-	cart_header *header;
-	FILE *rom;
-
-	if((rom = fopen(rom_path, "rb")) == NULL)
-	{
-		perror("fopen");
-		free(state);
-		return NULL;
-	}
+#include "capture.h"	// capture_open
+#include "frontend.h"	// FRONT_*
+#include "link.h"	// link_connect
+#include "movie.h"	// movie_record, movie_play
+#include "print.h"	// fatal
+#include "serio.h"	// serial_set_matches
+#include "sgherm.h"	// emu_state, init_emulator
+#include "signals.h"	// register_handlers
 
-	state->interrupts.enabled = true;
-	state->bank = 1;
-	state->wait = 1;
-	state->freq = CPU_FREQ_DMG;
+#include <stdio.h>	// printf
+#include <stdlib.h>	// EXIT_FAILURE, strtoul
+#include <string.h>	// strcmp, strdup
 
-	memcpy(&(state->front.input), frontend_set_input[input], sizeof(frontend_input));
-	memcpy(&(state->front.audio), frontend_set_audio[audio], sizeof(frontend_audio));
-	memcpy(&(state->front.video), frontend_set_video[video], sizeof(frontend_video));
-	state->front.event_loop = frontend_set_event_loop[event_loop];
-
-
-	if(unlikely(!read_rom_data(state, rom, &header)))
-	{
-		fatal(state, "can't read ROM data (ROM is corrupt)?");
-		free(state);
-		fclose(rom);
-		return NULL;
-	}
+#ifdef HAVE_COMPILER_MSVC
+#	include <windows.h>	// WinMain, GetOpenFileName
+#endif
 
-	// Initalise state
-	init_ctl(state);
-	init_lcdc(state);
 
-	// Start the clock
-	state->start_time = get_time();
+static int main_common(emu_state *state)
+{
+	int val;
 
-	fclose(rom);
+	register_handlers(state);
 
-	return state;
-}
+	val = run_emulator(state);
 
-void finish_emulator(emu_state *restrict state)
-{
-	print_cycles(state);
+	finish_emulator(state);
 
-	free(state->cart_data);
-	free(state);
+	return val;
 }
 
-bool step_emulator(emu_state *restrict state)
+int main(int argc, char *argv[])
 {
-	static uint32_t count_cur_second = 0, game_seconds = 0;
+	emu_state *state;
+	bool test_mode = false;
+	const char *wav_path = NULL, *hash_path = NULL;
+	const char *record_path = NULL, *play_path = NULL;
+	const char *link_name = NULL;
+	unsigned int run_ahead = 0;
+	int arg = 1;
 
-	execute(state);
-	lcdc_tick(state);
-	serial_tick(state);
-	timer_tick(state);
-	sound_tick(state);
-	//clock_tick(state);
+	printf("Super Game Herm!\n");
+	printf("Beta version!\n\n");
 
-	if(unlikely(++count_cur_second == state->freq))
+	for(; arg < argc && argv[arg][0] == '-'; arg++)
 	{
-		count_cur_second = 0;
-		if((++game_seconds % 10) == 0)
+		// -t: exit as soon as a test ROM reports its result
+		if(strcmp(argv[arg], "-t") == 0)
+		{
+			test_mode = true;
+		}
+		// -w file: write audio to file (.wav, else raw PCM), no device
+		else if(strcmp(argv[arg], "-w") == 0 && arg + 1 < argc)
 		{
-			debug(state, "GBC seconds: %ld", ++game_seconds);
+			wav_path = argv[++arg];
+		}
+		// -H file: write a hash of each audio frame to file
+		else if(strcmp(argv[arg], "-H") == 0 && arg + 1 < argc)
+		{
+			hash_path = argv[++arg];
+		}
+		// -r file: record input to a movie
+		else if(strcmp(argv[arg], "-r") == 0 && arg + 1 < argc)
+		{
+			record_path = argv[++arg];
+		}
+		// -p file: play a movie back (headless: sgherm-batch movie=)
+		else if(strcmp(argv[arg], "-p") == 0 && arg + 1 < argc)
+		{
+			play_path = argv[++arg];
+		}
+		// -a frames: show this many frames ahead, to hide input lag
+		else if(strcmp(argv[arg], "-a") == 0 && arg + 1 < argc)
+		{
+			run_ahead = (unsigned int)strtoul(argv[++arg], NULL, 10);
+		}
+		// -l name: link cable to another sgherm run with the same name
+		else if(strcmp(argv[arg], "-l") == 0 && arg + 1 < argc)
+		{
+			link_name = argv[++arg];
+		}
+		else
+		{
+			fatal(NULL, "Unknown option %s", argv[arg]);
+			return EXIT_FAILURE;
 		}
 	}
 
-	state->cycles++;
+	if(arg >= argc)
+	{
+		fatal(NULL, "You must specify a ROM file... -.-");
+		return EXIT_FAILURE;
+	}
 
-	return true;
-}
+	state = init_emulator(argv[arg], FRONT_SDL2,
+			(wav_path || hash_path) ? FRONT_NULL : FRONT_SDL2,
+			FRONT_SDL2, FRONT_SDL2);
+	//state = init_emulator(argv[1], FRONT_LIBCACA, FRONT_NULL, FRONT_LIBCACA, FRONT_LIBCACA);
+	if(state == NULL)
+	{
+		fatal(NULL, "Error initalising the emulator :(");
+		return EXIT_FAILURE;
+	}
 
-int main_common(emu_state *state)
-{
-	register_handlers();
+	if((wav_path || hash_path) &&
+		!capture_open(state, wav_path, hash_path))
+	{
+		fatal(NULL, "Can't capture audio");
+		finish_emulator(state);
+		return EXIT_FAILURE;
+	}
 
-	FRONTEND_INIT_ALL(state)
-	int val = EVENT_LOOP(state);
+	if((record_path && !movie_record(state, record_path)) ||
+		(play_path && !movie_play(state, play_path)))
+	{
+		fatal(NULL, "Can't %s the movie", record_path ? "record" : "play");
+		finish_emulator(state);
+		return EXIT_FAILURE;
+	}
 
-	FRONTEND_FINISH_ALL(state)
-	finish_emulator(state);
+	if(link_name && !link_connect(state, link_name))
+	{
+		fatal(NULL, "Can't connect the link cable to %s", link_name);
+		finish_emulator(state);
+		return EXIT_FAILURE;
+	}
 
-	return val;
+	state->run_ahead = run_ahead;
+
+	if(test_mode)
+	{
+		serial_set_matches(state, serial_default_matches,
+				serial_default_match_count);
+	}
+
+	return main_common(state);
 }
 
-int main(int argc, char *argv[])
+#ifdef HAVE_COMPILER_MSVC
+// The Windows entry point lives with main; the frontend is in libsgherm
+static char *AskUserForROMPath(void)
 {
-	emu_state *state;
+	char szROMName[MAX_PATH];
+
+	OPENFILENAME ofn;
+	ZeroMemory(&szROMName, sizeof(szROMName));
+	ZeroMemory(&ofn, sizeof(OPENFILENAME));
+	ofn.lStructSize = sizeof(OPENFILENAME);
+	ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST | OFN_EXPLORER;
+	//ofn.hwndOwner = hwnd;
+	ofn.lpstrFile = szROMName;
+	ofn.lpstrFilter = "All Game Boy ROMs\0*.gb;*.gbc\0Original Game Boy (DMG) ROMs\0*.gb\0";
+	ofn.lpstrTitle = "Open Game!";
+	ofn.nMaxFile = sizeof(szROMName);
+
+	if(!GetOpenFileName(&ofn))
+	{
+		return NULL;
+	}
+	else
+	{
+		return strdup(szROMName);
+	}
+}
 
-	to_stdout = stdout;
-	to_stderr = stderr;
+int WINAPI WinMain(HINSTANCE hInstance UNUSED, HINSTANCE hPrevInstance UNUSED, char *szCmdLine, int iCmdShow UNUSED)
+{
+	emu_state *state;
+	char *rom_path;
 
-	fprintf(to_stdout, "Super Game Herm!\n");
-	fprintf(to_stdout, "Beta version!\n\n");
+	AllocConsole();
+	freopen("CONOUT$", "w", stdout);
+	freopen("CONOUT$", "w", stderr);
 
-	if(argc < 2)
+	if(szCmdLine == NULL || strlen(szCmdLine) == 0)
 	{
-		fatal(NULL, "You must specify a ROM file... -.-");
-		return EXIT_FAILURE;
+		rom_path = AskUserForROMPath();
+	} else {
+		rom_path = strdup(szCmdLine);
 	}
 
-	state = init_emulator(argv[1], FRONT_SDL2, FRONT_SDL2, FRONT_SDL2, FRONT_SDL2);
-	//state = init_emulator(argv[1], FRONT_LIBCACA, FRONT_NULL, FRONT_LIBCACA, FRONT_LIBCACA);
-	if(state == NULL)
+	if((state = init_emulator(rom_path, FRONT_WIN32, FRONT_NULL,
+		FRONT_WIN32, FRONT_WIN32)) == NULL)
 	{
-		fatal(NULL, "Error initalising the emulator :(");
-		return EXIT_FAILURE;
+		return -1;
 	}
 
+	free(rom_path);
+
 	return main_common(state);
 }
+#endif /*HAVE_COMPILER_MSVC*/
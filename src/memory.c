@@ -87,8 +87,11 @@ static mem_read_fn hw_reg_read[0x80] =
 
 	no_hardware, /* 46 - DMA - DMA transfer and control */
 
-	/* 47..4B - more graphics stuff */
-	lcdc_read, lcdc_read, lcdc_read, lcdc_window_read, lcdc_window_read,
+	/* 47..49 - DMG palettes */
+	dmg_pal_read, dmg_pal_read, dmg_pal_read,
+
+	/* 4A..4B - window position */
+	lcdc_window_read, lcdc_window_read,
 
 	/* 4C..4E - NO HARDWARE */
 	no_hardware, no_hardware, no_hardware,
@@ -139,7 +142,7 @@ static inline uint8_t ram_bank_read(emu_state *restrict state, uint16_t location
  * @param	state		The emulator state to use when reading.
  * @param	location	The location in memory to read.
  * @returns	The value of the location in memory.
- * @result	Emulation will terminate if the memory cannot be read.
+ * @result	The instance stops (see fatal) if it cannot be read.
  */
 uint8_t mem_read8(emu_state *restrict state, uint16_t location)
 {
@@ -203,7 +206,7 @@ uint8_t mem_read8(emu_state *restrict state, uint16_t location)
  * @param	state		The emulator state to use when reading.
  * @param	location	The location in memory to read.
  * @returns	The value of the two bytes at the location, LSB lower.
- * @result	Emulation will terminate if the memory cannot be read.
+ * @result	The instance stops (see fatal) if it cannot be read.
  */
 uint16_t mem_read16(emu_state *restrict state, uint16_t location)
 {
@@ -250,13 +253,14 @@ static inline void dma_write(emu_state *restrict state, uint16_t location UNUSED
 	uint16_t start = data << 8;
 	assert(location == 0xFF46);
 	memmove(state->lcdc.oam_ram, state->memory + start, 160);
+	state->written.oam = true;
 
 	state->dma_membar_wait = 640;
 }
 
 static inline void vram_bank_switch_write(emu_state *restrict state, uint16_t location UNUSED, uint8_t data)
 {
-	state->lcdc.vram_bank = data;
+	state->lcdc.vram_bank = data & 0x1;
 }
 
 static mem_write8_fn hw_reg_write[0x80] =
@@ -314,8 +318,11 @@ static mem_write8_fn hw_reg_write[0x80] =
 
 	dma_write, /* 46 - DMA */
 
-	/* 47..4B - more video */
-	lcdc_write, lcdc_write, lcdc_write, lcdc_window_write, lcdc_window_write,
+	/* 47..49 - DMG palettes */
+	dmg_pal_write, dmg_pal_write, dmg_pal_write,
+
+	/* 4A..4B - window position */
+	lcdc_window_write, lcdc_window_write,
 
 	/* 4C..4E - NO HARDWARE */
 	doofus_write, doofus_write, doofus_write,
@@ -348,7 +355,7 @@ static mem_write8_fn hw_reg_write[0x80] =
  * @param	location	The location in memory to write.
  * @param	data		The data to write.
  * @result	The data is written to the specified location.
- * 		Emulation will terminate if the memory cannot be written to.
+ * 		The instance stops (see fatal) if it cannot be written to.
  */
 void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 {
@@ -370,19 +377,21 @@ void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 		case CART_MBC1:
 		case CART_MBC1_RAM:
 		case CART_MBC1_RAM_BATT:
-			state->bank = data & 0x1F;
+			// Bank 0 is always at 0x0000; asking for it gets 1
+			state->bank = (data & 0x1F) ? (data & 0x1F) : 1;
 			return;
 		case CART_MBC3:
 		case CART_MBC3_RAM:
 		case CART_MBC3_RAM_BATT:
 		case CART_MBC3_TIMER_BATT:
 		case CART_MBC3_TIMER_RAM_BATT:
-			state->bank = data & 0x7F;
+			state->bank = (data & 0x7F) ? (data & 0x7F) : 1;
 			return;
 		default:
 			fatal(state, "banks for this cart (type %04X [%s]) aren't done yet sorry :(",
 					state->cart_data[OFF_CART_TYPE],
 					friendly_cart_names[location >> 12]);
+			return;
 		}
 	case 0x4:
 	case 0x5:
@@ -394,6 +403,7 @@ void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 		case CART_MBC5:
 			fatal(state, "invalid memory write at %04X (%02X)",
 				location, data);
+			return;
 		case CART_MBC3_RAM:
 		case CART_MBC3_RAM_BATT:
 		case CART_MBC3_TIMER_RAM_BATT:
@@ -406,7 +416,15 @@ void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 		default:
 			fatal(state, "RAM banks for this cart (type %04X) aren't done yet sorry :(",
 					state->cart_data[OFF_CART_TYPE]);
+			return;
 		}
+	case 0x0:
+	case 0x1:
+	case 0x6:
+	case 0x7:
+		/* RAM enable and banking mode; nothing to latch (yet), and
+		 * certainly not the ROM underneath */
+		return;
 	case 0x8:
 	case 0x9:
 		/* VRAM */
@@ -416,6 +434,8 @@ void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 	case 0xB:
 		/* switched RAM bank */
 		state->cart_ram[state->ram_bank][location - 0xA000] = data;
+		snapshot_mark(state->written.cart_ram + (state->ram_bank & 0xF),
+			location - 0xA000);
 		return;
 	case 0xE:
 	case 0xF:
@@ -426,6 +446,7 @@ void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 			{
 				// FIXME I'm feeling lazy
 				state->lcdc.oam_ram[location - 0xFE00] = data;
+				state->written.oam = true;
 			}
 
 			break;
@@ -449,6 +470,7 @@ void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 	}
 
 	state->memory[location] = data;
+	snapshot_mark(state->written.memory, location - 0x8000);
 }
 
 void mem_write16(emu_state *restrict state, uint16_t location, uint16_t data)
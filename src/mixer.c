@@ -0,0 +1,238 @@
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include "blip.h"	// blip_kernel, BLIP_*
+#include "mixer.h"	// prototypes
+
+#include <string.h>	// memcpy
+
+/*
+ * Pick the widest vector unit the compiler was told it can use; the
+ * scalar loop always handles whatever is left over.
+ */
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#	define MIX_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define MIX_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#	define MIX_NEON
+#endif
+
+
+static inline int16_t saturate_16(int32_t val)
+{
+	return (val > INT16_MAX) ? INT16_MAX : (val < INT16_MIN) ? INT16_MIN : val;
+}
+
+/*!
+ * @brief	Mix channels down to interleaved stereo.
+ * @param	out	Where to put the stereo samples (2 * count).
+ * @param	chan	The channels' samples.
+ * @param	left	Per-channel gain on the left, in eighths.
+ * @param	right	Per-channel gain on the right, in eighths.
+ * @param	count	The number of samples in each channel.
+ */
+void mix_channels(int16_t *restrict out,
+		const int16_t *const chan[MIXER_CHANNELS],
+		const int16_t left[MIXER_CHANNELS],
+		const int16_t right[MIXER_CHANNELS], size_t count)
+{
+	size_t i = 0;
+
+#if defined(MIX_AVX2)
+	// Gains paired up so madd does two channels at once
+	const __m256i gl01 = _mm256_set1_epi32((uint16_t)left[0] | (left[1] << 16));
+	const __m256i gl23 = _mm256_set1_epi32((uint16_t)left[2] | (left[3] << 16));
+	const __m256i gr01 = _mm256_set1_epi32((uint16_t)right[0] | (right[1] << 16));
+	const __m256i gr23 = _mm256_set1_epi32((uint16_t)right[2] | (right[3] << 16));
+
+	for(; i + 16 <= count; i += 16)
+	{
+		__m256i c0 = _mm256_loadu_si256((const __m256i *)(chan[0] + i));
+		__m256i c1 = _mm256_loadu_si256((const __m256i *)(chan[1] + i));
+		__m256i c2 = _mm256_loadu_si256((const __m256i *)(chan[2] + i));
+		__m256i c3 = _mm256_loadu_si256((const __m256i *)(chan[3] + i));
+		__m256i lo01 = _mm256_unpacklo_epi16(c0, c1);
+		__m256i hi01 = _mm256_unpackhi_epi16(c0, c1);
+		__m256i lo23 = _mm256_unpacklo_epi16(c2, c3);
+		__m256i hi23 = _mm256_unpackhi_epi16(c2, c3);
+		__m256i l_lo = _mm256_add_epi32(_mm256_madd_epi16(lo01, gl01),
+				_mm256_madd_epi16(lo23, gl23));
+		__m256i l_hi = _mm256_add_epi32(_mm256_madd_epi16(hi01, gl01),
+				_mm256_madd_epi16(hi23, gl23));
+		__m256i r_lo = _mm256_add_epi32(_mm256_madd_epi16(lo01, gr01),
+				_mm256_madd_epi16(lo23, gr23));
+		__m256i r_hi = _mm256_add_epi32(_mm256_madd_epi16(hi01, gr01),
+				_mm256_madd_epi16(hi23, gr23));
+		// In-lane unpack then pack puts samples back in order
+		__m256i l = _mm256_packs_epi32(_mm256_srai_epi32(l_lo, MIXER_SHIFT),
+				_mm256_srai_epi32(l_hi, MIXER_SHIFT));
+		__m256i r = _mm256_packs_epi32(_mm256_srai_epi32(r_lo, MIXER_SHIFT),
+				_mm256_srai_epi32(r_hi, MIXER_SHIFT));
+		__m256i lr_lo = _mm256_unpacklo_epi16(l, r);
+		__m256i lr_hi = _mm256_unpackhi_epi16(l, r);
+
+		_mm256_storeu_si256((__m256i *)(out + (i * 2)),
+				_mm256_permute2x128_si256(lr_lo, lr_hi, 0x20));
+		_mm256_storeu_si256((__m256i *)(out + (i * 2) + 16),
+				_mm256_permute2x128_si256(lr_lo, lr_hi, 0x31));
+	}
+#elif defined(MIX_SSE2)
+	const __m128i gl01 = _mm_set1_epi32((uint16_t)left[0] | (left[1] << 16));
+	const __m128i gl23 = _mm_set1_epi32((uint16_t)left[2] | (left[3] << 16));
+	const __m128i gr01 = _mm_set1_epi32((uint16_t)right[0] | (right[1] << 16));
+	const __m128i gr23 = _mm_set1_epi32((uint16_t)right[2] | (right[3] << 16));
+
+	for(; i + 8 <= count; i += 8)
+	{
+		__m128i c0 = _mm_loadu_si128((const __m128i *)(chan[0] + i));
+		__m128i c1 = _mm_loadu_si128((const __m128i *)(chan[1] + i));
+		__m128i c2 = _mm_loadu_si128((const __m128i *)(chan[2] + i));
+		__m128i c3 = _mm_loadu_si128((const __m128i *)(chan[3] + i));
+		__m128i lo01 = _mm_unpacklo_epi16(c0, c1);
+		__m128i hi01 = _mm_unpackhi_epi16(c0, c1);
+		__m128i lo23 = _mm_unpacklo_epi16(c2, c3);
+		__m128i hi23 = _mm_unpackhi_epi16(c2, c3);
+		__m128i l_lo = _mm_add_epi32(_mm_madd_epi16(lo01, gl01),
+				_mm_madd_epi16(lo23, gl23));
+		__m128i l_hi = _mm_add_epi32(_mm_madd_epi16(hi01, gl01),
+				_mm_madd_epi16(hi23, gl23));
+		__m128i r_lo = _mm_add_epi32(_mm_madd_epi16(lo01, gr01),
+				_mm_madd_epi16(lo23, gr23));
+		__m128i r_hi = _mm_add_epi32(_mm_madd_epi16(hi01, gr01),
+				_mm_madd_epi16(hi23, gr23));
+		__m128i l = _mm_packs_epi32(_mm_srai_epi32(l_lo, MIXER_SHIFT),
+				_mm_srai_epi32(l_hi, MIXER_SHIFT));
+		__m128i r = _mm_packs_epi32(_mm_srai_epi32(r_lo, MIXER_SHIFT),
+				_mm_srai_epi32(r_hi, MIXER_SHIFT));
+
+		_mm_storeu_si128((__m128i *)(out + (i * 2)), _mm_unpacklo_epi16(l, r));
+		_mm_storeu_si128((__m128i *)(out + (i * 2) + 8), _mm_unpackhi_epi16(l, r));
+	}
+#elif defined(MIX_NEON)
+	for(; i + 4 <= count; i += 4)
+	{
+		int16x4_t c0 = vld1_s16(chan[0] + i);
+		int16x4_t c1 = vld1_s16(chan[1] + i);
+		int16x4_t c2 = vld1_s16(chan[2] + i);
+		int16x4_t c3 = vld1_s16(chan[3] + i);
+		int32x4_t l = vmull_n_s16(c0, left[0]);
+		int32x4_t r = vmull_n_s16(c0, right[0]);
+		int16x4x2_t lr;
+
+		l = vmlal_n_s16(l, c1, left[1]);
+		l = vmlal_n_s16(l, c2, left[2]);
+		l = vmlal_n_s16(l, c3, left[3]);
+		r = vmlal_n_s16(r, c1, right[1]);
+		r = vmlal_n_s16(r, c2, right[2]);
+		r = vmlal_n_s16(r, c3, right[3]);
+
+		lr.val[0] = vqshrn_n_s32(l, MIXER_SHIFT);
+		lr.val[1] = vqshrn_n_s32(r, MIXER_SHIFT);
+		vst2_s16(out + (i * 2), lr);
+	}
+#endif
+
+	for(; i < count; i++)
+	{
+		int32_t l = 0, r = 0;
+
+		for(uint8_t c = 0; c < MIXER_CHANNELS; c++)
+		{
+			l += chan[c][i] * left[c];
+			r += chan[c][i] * right[c];
+		}
+
+		out[i * 2] = saturate_16(l >> MIXER_SHIFT);
+		out[(i * 2) + 1] = saturate_16(r >> MIXER_SHIFT);
+	}
+}
+
+/*!
+ * @brief	Set the rates a resampler converts between.
+ * @param	rs	The resampler.
+ * @param	in_rate	The input rate, in Hz.
+ * @param	out_rate	The output rate, in Hz.
+ * @param	skew	Parts per million more input to use per output.
+ */
+void resampler_set_rate(resampler *restrict rs, uint32_t in_rate,
+		uint32_t out_rate, int32_t skew)
+{
+	uint64_t step = ((uint64_t)in_rate << RESAMPLE_FRAC) / out_rate;
+
+	rs->step = (uint32_t)((step * (uint64_t)(1000000 + skew)) / 1000000);
+}
+
+/*!
+ * @brief	Resample interleaved stereo.
+ * @param	rs	The resampler.
+ * @param	in	The input samples.
+ * @param	in_count	The number of stereo input samples.
+ * @param	out	Where to put the output samples.
+ * @param	out_max	The most stereo samples out can take.
+ * @returns	The number of stereo samples produced.
+ * @note	This is a polyphase FIR using the same windowed sinc table
+ * 		as the blip buffers; output lags input by half the taps.
+ */
+size_t resample(resampler *restrict rs, const int16_t *restrict in,
+		size_t in_count, int16_t *restrict out, size_t out_max)
+{
+	int16_t work[2][RESAMPLE_TAPS + BLIP_BUF_SIZE];
+	size_t total = rs->hist_len;
+	size_t produced = 0, idx;
+	uint32_t pos = rs->pos;
+
+	if(in_count > BLIP_BUF_SIZE)
+	{
+		in_count = BLIP_BUF_SIZE;
+	}
+
+	// Planar, with what was left over last time in front
+	memcpy(work[0], rs->hist[0], total * sizeof(int16_t));
+	memcpy(work[1], rs->hist[1], total * sizeof(int16_t));
+	for(size_t i = 0; i < in_count; i++, total++)
+	{
+		work[0][total] = in[i * 2];
+		work[1][total] = in[(i * 2) + 1];
+	}
+
+	while((idx = pos >> RESAMPLE_FRAC) + RESAMPLE_TAPS <= total &&
+		produced < out_max)
+	{
+		const int16_t *kernel = blip_kernel[(pos >> (RESAMPLE_FRAC - 5)) &
+			(BLIP_PHASES - 1)];
+		const int16_t *l = work[0] + idx, *r = work[1] + idx;
+		int32_t sl = 0, sr = 0;
+
+		for(uint8_t t = 0; t < RESAMPLE_TAPS; t++)
+		{
+			sl += kernel[t] * l[t];
+			sr += kernel[t] * r[t];
+		}
+
+		*out++ = saturate_16(sl >> BLIP_KERNEL_BITS);
+		*out++ = saturate_16(sr >> BLIP_KERNEL_BITS);
+		produced++;
+
+		pos += rs->step;
+	}
+
+	// Keep everything not used up yet (at most RESAMPLE_TAPS - 1)
+	idx = pos >> RESAMPLE_FRAC;
+	if(total - idx >= RESAMPLE_TAPS)
+	{
+		// Output was full; drop the oldest rather than overflow
+		idx = total - (RESAMPLE_TAPS - 1);
+		pos = (pos & ((1 << RESAMPLE_FRAC) - 1)) |
+			(uint32_t)(idx << RESAMPLE_FRAC);
+	}
+
+	rs->hist_len = total - idx;
+	rs->pos = pos - (uint32_t)(idx << RESAMPLE_FRAC);
+	memcpy(rs->hist[0], work[0] + idx, rs->hist_len * sizeof(int16_t));
+	memcpy(rs->hist[1], work[1] + idx, rs->hist_len * sizeof(int16_t));
+
+	return produced;
+}
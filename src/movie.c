@@ -0,0 +1,460 @@
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include "input.h"	// joypad_press, input_key
+#include "movie.h"	// prototypes
+#include "print.h"	// error, info
+#include "savestate.h"	// savestate_*
+#include "sgherm.h"	// emu_state
+#include "util_bitops.h"	// htole32, htole64, le32toh, le64toh
+
+#include <stdio.h>	// FILE, fopen, fread, fwrite
+#include <stdlib.h>	// calloc, malloc, free
+#include <string.h>	// memcpy, memcmp
+
+
+/*
+ * A movie is every key the host pressed or let go of, stamped with the
+ * clock it happened on.  The host only gets a word in between clocks, so
+ * putting each event back on the same clock (see emulator_clock) replays a
+ * run exactly, frontend or not.
+ *
+ * The file is a header, then a save state if the movie didn't start at
+ * power-on, then one varint per event, little end first, seven bits a
+ * byte: the clocks since the last event shifted up by four, above the
+ * press bit and the key.  Most events fit in three bytes.
+ */
+
+#define MOVIE_MAGIC		"SGHM"
+#define MOVIE_FLAG_STATE	0x1	/*! A save state follows the header */
+
+#define MOVIE_KEY_MASK		0x7
+#define MOVIE_PRESS		0x8
+#define MOVIE_CODE_BITS		4
+
+/*! Everything little-endian */
+typedef struct movie_header_t
+{
+	char magic[4];			/*! MOVIE_MAGIC */
+	uint32_t version;		/*! MOVIE_VERSION */
+	uint32_t rom_id;		/*! savestate_rom_id */
+	uint32_t flags;			/*! MOVIE_FLAG_* */
+	uint32_t events;		/*! How many there are */
+	uint32_t state_size;		/*! Bytes of save state, if any */
+	uint64_t length;		/*! Clocks from start to end */
+} movie_header;
+
+struct movie_state_t
+{
+	bool playing;			/*! Else recording */
+	uint64_t start;			/*! Clock it starts on */
+	uint64_t at;			/*! Clock of the last event */
+	uint32_t events;		/*! Recorded, or still to play */
+
+	FILE *file;			/*! Recording to */
+	movie_header header;		/*! Rewritten with the counts at the end */
+	bool warned;			/*! Told about time going backwards */
+
+	uint8_t *data;			/*! Whole file, when playing */
+	const uint8_t *cursor, *end;	/*! Events not yet decoded */
+	uint8_t code;			/*! Key and press of the next event */
+	uint64_t length;		/*! Clocks it runs for */
+};
+
+/*! Key codes in files; the index is what's saved */
+static const input_key movie_keys[MOVIE_KEY_MASK + 1] =
+{
+	INPUT_RIGHT, INPUT_LEFT, INPUT_UP, INPUT_DOWN,
+	INPUT_A, INPUT_B, INPUT_SELECT, INPUT_START,
+};
+
+
+static void movie_put_varint(FILE *f, uint64_t value)
+{
+	while(value >= 0x80)
+	{
+		putc((int)(value & 0x7F) | 0x80, f);
+		value >>= 7;
+	}
+
+	putc((int)value, f);
+}
+
+/*! false if it runs off the end or past 64 bits */
+static bool movie_get_varint(const uint8_t **cursor, const uint8_t *end,
+		uint64_t *value)
+{
+	*value = 0;
+
+	for(unsigned int shift = 0; *cursor < end && shift < 64; shift += 7)
+	{
+		uint8_t byte = *((*cursor)++);
+
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if(!(byte & 0x80))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void movie_header_write(const movie_header *header, FILE *f,
+		bool *ok)
+{
+	movie_header le = *header;
+
+	le.version = htole32(le.version);
+	le.rom_id = htole32(le.rom_id);
+	le.flags = htole32(le.flags);
+	le.events = htole32(le.events);
+	le.state_size = htole32(le.state_size);
+	le.length = htole64(le.length);
+
+	*ok &= (fwrite(&le, sizeof(le), 1, f) == 1);
+}
+
+/*! Line up the next event to play, or the end */
+static void movie_next_event(emu_state *restrict state, movie_state *mv)
+{
+	uint64_t value;
+
+	state->movie_next = MOVIE_NEVER;
+
+	if(mv->events == 0)
+	{
+		return;
+	}
+
+	if(!movie_get_varint(&(mv->cursor), mv->end, &value))
+	{
+		error(state, "movie: truncated, %u events short", mv->events);
+		mv->events = 0;
+		return;
+	}
+
+	mv->events--;
+	mv->at += value >> MOVIE_CODE_BITS;
+	mv->code = value & (MOVIE_KEY_MASK | MOVIE_PRESS);
+	state->movie_next = mv->at;
+}
+
+/*!
+ * @brief	Start recording the host's input into a movie.
+ * @param	state	The instance, with a ROM loaded.
+ * @param	path	File to write; it's complete once movie_close is called.
+ * @returns	true if it's recording.
+ * @note	Unless it's at power-on, the instance is saved into the movie
+ * 		to start from.
+ */
+bool movie_record(emu_state *restrict state, const char *path)
+{
+	movie_header header = { .version = MOVIE_VERSION };
+	movie_state *mv;
+	uint8_t *saved = NULL;
+	bool ok = true;
+
+	if(state->movie != NULL)
+	{
+		error(state, "movie: one is already going");
+		return false;
+	}
+
+	memcpy(header.magic, MOVIE_MAGIC, sizeof(header.magic));
+	header.rom_id = savestate_rom_id(state);
+
+	if(state->cycles != 0)
+	{
+		size_t len = savestate_size(state);
+
+		if((saved = malloc(len)) == NULL ||
+			(header.state_size = savestate_save(state, saved, len)) == 0)
+		{
+			error(state, "movie: can't save the starting state");
+			free(saved);
+			return false;
+		}
+
+		header.flags |= MOVIE_FLAG_STATE;
+	}
+
+	if((mv = calloc(1, sizeof(movie_state))) == NULL)
+	{
+		error(state, "movie: out of memory");
+		free(saved);
+		return false;
+	}
+
+	if((mv->file = fopen(path, "wb")) == NULL)
+	{
+		error(state, "movie: can't open %s", path);
+		free(saved);
+		free(mv);
+		return false;
+	}
+
+	// Counts go in at the end
+	movie_header_write(&header, mv->file, &ok);
+	if(saved != NULL)
+	{
+		ok &= (fwrite(saved, 1, header.state_size, mv->file) ==
+			header.state_size);
+		free(saved);
+	}
+
+	if(!ok)
+	{
+		error(state, "movie: can't write %s", path);
+		fclose(mv->file);
+		free(mv);
+		return false;
+	}
+
+	mv->header = header;
+	mv->start = mv->at = state->cycles;
+	state->movie = mv;
+	state->movie_next = MOVIE_NEVER;
+
+	return true;
+}
+
+/*!
+ * @brief	Play a movie back into an instance.
+ * @param	state	The instance, with the movie's ROM loaded and, unless
+ * 		the movie has a save state, still at power-on.
+ * @param	path	The movie, from movie_record.
+ * @returns	true if it's playing.
+ * @note	Host input is ignored until the movie is over.
+ */
+bool movie_play(emu_state *restrict state, const char *path)
+{
+	movie_header header;
+	movie_state *mv;
+	FILE *f;
+	long len;
+
+	if(state->movie != NULL)
+	{
+		error(state, "movie: one is already going");
+		return false;
+	}
+
+	if((f = fopen(path, "rb")) == NULL)
+	{
+		error(state, "movie: can't open %s", path);
+		return false;
+	}
+
+	if((mv = calloc(1, sizeof(movie_state))) == NULL ||
+		fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 ||
+		fseek(f, 0, SEEK_SET) != 0 ||
+		(mv->data = malloc(len ? len : 1)) == NULL ||
+		fread(mv->data, 1, len, f) != (size_t)len)
+	{
+		error(state, "movie: can't read %s", path);
+		goto fail;
+	}
+
+	fclose(f);
+	f = NULL;
+
+	if((size_t)len < sizeof(header))
+	{
+		error(state, "movie: %s is too short", path);
+		goto fail;
+	}
+
+	memcpy(&header, mv->data, sizeof(header));
+	header.version = le32toh(header.version);
+	header.rom_id = le32toh(header.rom_id);
+	header.flags = le32toh(header.flags);
+	header.events = le32toh(header.events);
+	header.state_size = le32toh(header.state_size);
+	header.length = le64toh(header.length);
+
+	if(memcmp(header.magic, MOVIE_MAGIC, sizeof(header.magic)) != 0)
+	{
+		error(state, "movie: %s isn't a movie", path);
+		goto fail;
+	}
+	else if(header.version != MOVIE_VERSION)
+	{
+		error(state, "movie: version %u, need %u", header.version,
+			MOVIE_VERSION);
+		goto fail;
+	}
+	else if(header.rom_id != savestate_rom_id(state))
+	{
+		error(state, "movie: recorded with a different ROM");
+		goto fail;
+	}
+	else if(header.state_size > len - sizeof(header))
+	{
+		error(state, "movie: %s is truncated", path);
+		goto fail;
+	}
+
+	if(header.flags & MOVIE_FLAG_STATE)
+	{
+		if(!savestate_load(state, mv->data + sizeof(header),
+			header.state_size))
+		{
+			goto fail;
+		}
+	}
+	else if(state->cycles != 0)
+	{
+		error(state, "movie: it starts at power-on; this has been running");
+		goto fail;
+	}
+
+	mv->playing = true;
+	mv->start = mv->at = state->cycles;
+	mv->events = header.events;
+	mv->length = header.length;
+	mv->cursor = mv->data + sizeof(header) + header.state_size;
+	mv->end = mv->data + len;
+
+	state->movie = mv;
+	movie_next_event(state, mv);
+
+	// Anything on the very first clock
+	if(state->cycles >= state->movie_next)
+	{
+		movie_poll(state);
+	}
+
+	return true;
+
+fail:
+	if(f != NULL)
+	{
+		fclose(f);
+	}
+	if(mv != NULL)
+	{
+		free(mv->data);
+		free(mv);
+	}
+	return false;
+}
+
+/*! Stop recording (finishing the file) or playing; fine with no movie */
+void movie_close(emu_state *restrict state)
+{
+	movie_state *mv = state->movie;
+
+	if(mv == NULL)
+	{
+		return;
+	}
+
+	if(!mv->playing)
+	{
+		bool ok = true;
+
+		mv->header.events = mv->events;
+		mv->header.length = state->cycles - mv->start;
+
+		ok &= (fseek(mv->file, 0, SEEK_SET) == 0);
+		movie_header_write(&(mv->header), mv->file, &ok);
+		if(fclose(mv->file) != 0 || !ok)
+		{
+			error(state, "movie: error finishing the file");
+		}
+		else
+		{
+			info(state, "movie: %u events over %llu clocks",
+				mv->events, (unsigned long long)mv->header.length);
+		}
+	}
+
+	free(mv->data);
+	free(mv);
+
+	state->movie = NULL;
+	state->movie_next = MOVIE_NEVER;
+}
+
+/*!
+ * @brief	See input from the host; called by joypad_signal.
+ * @param	state	The instance, with a movie going.
+ * @param	key	Which key.
+ * @param	down	true if pressed.
+ * @returns	true if the input should go through.
+ */
+bool movie_input(emu_state *restrict state, input_key key, bool down)
+{
+	movie_state *mv = state->movie;
+	uint64_t code;
+
+	if(mv->playing)
+	{
+		// It's the player's once the movie is over
+		return movie_finished(state);
+	}
+
+	for(code = 0; code <= MOVIE_KEY_MASK; code++)
+	{
+		if(movie_keys[code] == key)
+		{
+			break;
+		}
+	}
+
+	if(code > MOVIE_KEY_MASK)
+	{
+		return true;
+	}
+
+	if(unlikely(state->cycles < mv->at))
+	{
+		if(!mv->warned)
+		{
+			error(state, "movie: time went backwards; not recorded");
+			mv->warned = true;
+		}
+
+		return true;
+	}
+
+	code |= down ? MOVIE_PRESS : 0;
+	movie_put_varint(mv->file,
+		((state->cycles - mv->at) << MOVIE_CODE_BITS) | code);
+
+	mv->at = state->cycles;
+	mv->events++;
+
+	return true;
+}
+
+/*! Play every event that's due; emulator_clock calls it on movie_next */
+void movie_poll(emu_state *restrict state)
+{
+	movie_state *mv = state->movie;
+
+	while(state->cycles >= state->movie_next)
+	{
+		joypad_press(state, movie_keys[mv->code & MOVIE_KEY_MASK],
+			mv->code & MOVIE_PRESS);
+		movie_next_event(state, mv);
+	}
+}
+
+/*! true once a movie being played has run its length */
+bool movie_finished(const emu_state *restrict state)
+{
+	const movie_state *mv = state->movie;
+
+	return mv != NULL && mv->playing && mv->events == 0 &&
+		state->movie_next == MOVIE_NEVER &&
+		state->cycles - mv->start >= mv->length;
+}
+
+/*! Clocks a movie being played runs for; 0 with none */
+uint64_t movie_length(const emu_state *restrict state)
+{
+	const movie_state *mv = state->movie;
+
+	return (mv != NULL && mv->playing) ? mv->length : 0;
+}
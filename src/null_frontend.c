@@ -1,17 +1,47 @@
 #include "sgherm.h"	// emu_state, UNUSED
 #include "print.h"	// debug
-#include "signals.h"	// do_exit
 #include "input.h"	// int
 #include "frontend.h"	// frontend
+#include "capture.h"	// capture_write, capture_close
+
+
+/*! Messages each instance only shows once (frontend.null_noticed) */
+enum
+{
+	NOTICE_INIT_VIDEO = 0x001,
+	NOTICE_FINISH_VIDEO = 0x002,
+	NOTICE_INIT_AUDIO = 0x004,
+	NOTICE_FINISH_AUDIO = 0x008,
+	NOTICE_INIT_INPUT = 0x010,
+	NOTICE_FINISH_INPUT = 0x020,
+	NOTICE_BLIT = 0x040,
+	NOTICE_OUTPUT = 0x080,
+	NOTICE_GET_KEY = 0x100,
+};
+
+/*! true the first time a message is asked about */
+static inline bool null_notice(emu_state *state, unsigned int which)
+{
+	if(likely(state->front.null_noticed & which))
+	{
+		return false;
+	}
+
+	state->front.null_noticed |= which;
+	return true;
+}
 
 bool null_init_video(emu_state *state)
 {
-	static bool did_notice = false;
+	// Nobody is looking, so don't draw unless asked (or told otherwise)
+	if(state->render == RENDER_ALWAYS)
+	{
+		set_render_policy(state, RENDER_ON_DEMAND, 0);
+	}
 
-	if(unlikely(!did_notice))
+	if(unlikely(null_notice(state, NOTICE_INIT_VIDEO)))
 	{
 		debug(state, "Not initialising a null display");
-		did_notice = true;
 	}
 
 	return true;
@@ -19,23 +49,17 @@ bool null_init_video(emu_state *state)
 
 void null_finish_video(emu_state *state)
 {
-	static bool did_notice = false;
-
-	if(unlikely(!did_notice))
+	if(unlikely(null_notice(state, NOTICE_FINISH_VIDEO)))
 	{
 		debug(state, "Not finalising a null display");
-		did_notice = true;
 	}
 }
 
 bool null_init_audio(emu_state *state)
 {
-	static bool did_notice = false;
-
-	if(unlikely(!did_notice))
+	if(unlikely(null_notice(state, NOTICE_INIT_AUDIO)))
 	{
 		debug(state, "Not initialising null audio");
-		did_notice = true;
 	}
 
 	return true;
@@ -43,23 +67,19 @@ bool null_init_audio(emu_state *state)
 
 void null_finish_audio(emu_state *state)
 {
-	static bool did_notice = false;
+	capture_close(state);
 
-	if(unlikely(!did_notice))
+	if(unlikely(null_notice(state, NOTICE_FINISH_AUDIO)))
 	{
 		debug(state, "Not finalising null audio");
-		did_notice = true;
 	}
 }
 
 bool null_init_input(emu_state *state)
 {
-	static bool did_notice = false;
-
-	if(unlikely(!did_notice))
+	if(unlikely(null_notice(state, NOTICE_INIT_INPUT)))
 	{
 		debug(state, "Not initialising a null keyboard");
-		did_notice = true;
 	}
 
 	return true;
@@ -67,45 +87,41 @@ bool null_init_input(emu_state *state)
 
 void null_finish_input(emu_state *state)
 {
-	static bool did_notice = false;
-
-	if(unlikely(!did_notice))
+	if(unlikely(null_notice(state, NOTICE_FINISH_INPUT)))
 	{
 		debug(state, "Not finalising a null keyboard");
-		did_notice = true;
 	}
 }
 
 void null_blit_canvas(emu_state *state)
 {
-	static bool did_notice = false;
-
-	if(unlikely(!did_notice))
+	if(unlikely(null_notice(state, NOTICE_BLIT)))
 	{
 		debug(state, "Not blitting to null display");
-		did_notice = true;
 	}
 }
 
-void null_output_sample(emu_state *state)
+void null_output_sample(emu_state *state, const int16_t *samples,
+		size_t count)
 {
-	static bool did_notice = false;
+	// No device, but somebody may want the samples on disk
+	if(state->front.audio.data != NULL)
+	{
+		capture_write(state, samples, count);
+		return;
+	}
 
-	if(unlikely(!did_notice))
+	if(unlikely(null_notice(state, NOTICE_OUTPUT)))
 	{
 		debug(state, "Not outputting to null audio");
-		did_notice = true;
 	}
 }
 
 void null_get_key(emu_state *state, frontend_input_return *ret UNUSED)
 {
-	static bool did_notice = false;
-
-	if(unlikely(!did_notice))
+	if(unlikely(null_notice(state, NOTICE_GET_KEY)))
 	{
 		debug(state, "Not getting a null keystroke");
-		did_notice = true;
 	}
 }
 
@@ -113,10 +129,10 @@ int null_event_loop(emu_state *state)
 {
 	debug(state, "Executing null event loop");
 
-	do
+	while(run_until_frame(state))
 	{
-		step_emulator(state);
-	} while(!do_exit);
+		// Nothing to do between frames
+	}
 
 	return 0;
 }
@@ -1,62 +1,103 @@
 #include "config.h"	// macros
 #include <stdarg.h>	// required for gcc, because lol. (not clang/msvc)
 #include <stdio.h>	// ?fprintf
-#include <stdlib.h>	// exit
+#include <stdlib.h>	// EXIT_FAILURE
 
 #include "sgherm.h"	// emu_state
 #include "util.h"	// UNUSED
 
 
-FILE *to_stdout;
-FILE *to_stderr;
+/*! Where messages about state go; NULL states are global */
+static inline FILE * print_to(const emu_state *state)
+{
+	if(state != NULL)
+	{
+		return state->to_stderr;	// NULL if silenced
+	}
+
+	return stderr;
+}
 
-void fatal(emu_state *state UNUSED, const char *str, ...)
+void fatal(emu_state *state, const char *str, ...)
 {
+	FILE *to = print_to(state);
 	va_list argp;
+
+	// Too important to swallow
+	if(to == NULL)
+	{
+		to = stderr;
+	}
+
 	va_start(argp, str);
 
-	fprintf(to_stderr, "FATAL ERROR during execution: ");
-	vfprintf(to_stderr, str, argp);
-	fprintf(to_stderr, "\n");
+	fprintf(to, "FATAL ERROR during execution: ");
+	vfprintf(to, str, argp);
+	fprintf(to, "\n");
 
 	va_end(argp);
 
-	exit(EXIT_FAILURE);
-	/* NOTREACHED */
+	// Only this instance is done for, not the process
+	if(state != NULL)
+	{
+		state->fatal_code = EXIT_FAILURE;
+		state->do_exit = true;
+	}
 }
 
-void error(emu_state *state UNUSED, const char *str, ...)
+void error(emu_state *state, const char *str, ...)
 {
+	FILE *to = print_to(state);
 	va_list argp;
+
+	if(to == NULL)
+	{
+		return;
+	}
+
 	va_start(argp, str);
 
-	fprintf(to_stderr, "ERROR during execution: ");
-	vfprintf(to_stderr, str, argp);
-	fprintf(to_stderr, "\n");
+	fprintf(to, "ERROR during execution: ");
+	vfprintf(to, str, argp);
+	fprintf(to, "\n");
 
 	va_end(argp);
 }
 
-void info(emu_state *state UNUSED, const char *str, ...)
+void info(emu_state *state, const char *str, ...)
 {
+	FILE *to = print_to(state);
 	va_list argp;
+
+	if(to == NULL)
+	{
+		return;
+	}
+
 	va_start(argp, str);
 
-	fprintf(to_stderr, "info: ");
-	vfprintf(to_stderr, str, argp);
-	fprintf(to_stderr, "\n");
+	fprintf(to, "info: ");
+	vfprintf(to, str, argp);
+	fprintf(to, "\n");
 
 	va_end(argp);
 }
 
-void warning(emu_state *state UNUSED, const char *str, ...)
+void warning(emu_state *state, const char *str, ...)
 {
+	FILE *to = print_to(state);
 	va_list argp;
+
+	if(to == NULL)
+	{
+		return;
+	}
+
 	va_start(argp, str);
 
-	fprintf(to_stderr, "WARNING: ");
-	vfprintf(to_stderr, str, argp);
-	fprintf(to_stderr, "\n");
+	fprintf(to, "WARNING: ");
+	vfprintf(to, str, argp);
+	fprintf(to, "\n");
 
 	va_end(argp);
 }
@@ -67,13 +108,20 @@ void debug(emu_state *state UNUSED, const char *str UNUSED, ...)
 	// Stub
 }
 #else
-void debug(emu_state *state UNUSED, const char *str, ...)
+void debug(emu_state *state, const char *str, ...)
 {
+	FILE *to = print_to(state);
 	va_list argp;
+
+	if(to == NULL)
+	{
+		return;
+	}
+
 	va_start(argp, str);
 
-	vfprintf(to_stderr, str, argp);
-	fprintf(to_stderr, "\n");
+	vfprintf(to, str, argp);
+	fprintf(to, "\n");
 
 	va_end(argp);
 }
@@ -0,0 +1,421 @@
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include "print.h"	// error
+#include "rewind.h"	// prototypes
+#include "savestate.h"	// savestate_*
+#include "sgherm.h"	// emu_state
+
+#include <stdlib.h>	// calloc, malloc, free
+#include <string.h>	// memcpy, memset
+
+
+/*
+ * The rewind buffer keeps a save state every so many frames, as the XOR
+ * against the one before, run-length encoded.  Most of the machine stays
+ * the same from one frame to the next, so the XOR is mostly zero words.
+ * Every so often a keyframe is kept instead (the XOR against nothing), so
+ * the oldest snapshots can be thrown away a keyframe at a time once the
+ * buffer is full.
+ *
+ * Going back is cheap too.  The newest snapshot is always kept decoded,
+ * and XORing a delta into it gives the one before.  Only stepping back
+ * over a keyframe means decoding forward from the keyframe before it.
+ *
+ * Encoded snapshots are a run of tokens, each a pair of uint16_t (words
+ * unchanged, words changed) followed by the changed words' XORs.
+ */
+
+typedef struct rewind_entry_t
+{
+	uint32_t offset;		/*! Where it is in data */
+	uint32_t len;			/*! Encoded size */
+	bool key;			/*! Against nothing, not the one before */
+} rewind_entry;
+
+struct rewind_buffer_t
+{
+	size_t state_size;		/*! Bytes in a save state */
+	size_t words;			/*! state_size rounded up to words */
+
+	uint64_t *cur;			/*! Snapshot being taken */
+	uint64_t *prev;			/*! Newest snapshot kept, decoded */
+	uint64_t *zero;			/*! What keyframes are against */
+	uint8_t *scratch;		/*! Snapshot being encoded */
+
+	uint8_t *data;			/*! Encoded snapshots, a ring of bytes */
+	size_t data_size;
+	size_t head;			/*! Where the next one goes (maybe) */
+	size_t tail;			/*! Where the oldest one is */
+
+	rewind_entry *entries;		/*! Ring of snapshots, oldest first */
+	unsigned int first;		/*! Index of the oldest */
+	unsigned int count;		/*! Snapshots kept */
+	unsigned int keys;		/*! Of those, keyframes */
+	unsigned int since_key;		/*! Deltas after the newest keyframe */
+
+	unsigned int interval;		/*! Frames between snapshots */
+	unsigned int countdown;		/*! Frames to the next snapshot */
+	unsigned int keyframe_every;	/*! Snapshots per keyframe */
+};
+
+
+/*! Worst case size of an encoded snapshot */
+static inline size_t rewind_encoded_max(size_t words)
+{
+	return words * sizeof(uint64_t) + (words / UINT16_MAX + 2) * 4;
+}
+
+/*!
+ * @brief	Encode cur XOR prev.
+ * @param	cur	Snapshot to encode.
+ * @param	prev	What to encode it against.
+ * @param	words	Size of both, in words.
+ * @param	out	Where to put it (rewind_encoded_max bytes).
+ * @returns	The encoded size.
+ */
+static size_t rewind_encode(const uint64_t *restrict cur,
+		const uint64_t *restrict prev, size_t words,
+		uint8_t *restrict out)
+{
+	uint8_t *p = out;
+	size_t i = 0;
+
+	while(i < words)
+	{
+		uint16_t run[2] = { 0, 0 };
+		size_t changed;
+
+		while(i < words && run[0] < UINT16_MAX && cur[i] == prev[i])
+		{
+			run[0]++;
+			i++;
+		}
+
+		changed = i;
+		while(i < words && run[1] < UINT16_MAX && cur[i] != prev[i])
+		{
+			run[1]++;
+			i++;
+		}
+
+		memcpy(p, run, sizeof(run));
+		p += sizeof(run);
+
+		for(; changed < i; changed++)
+		{
+			uint64_t x = cur[changed] ^ prev[changed];
+
+			memcpy(p, &x, sizeof(x));
+			p += sizeof(x);
+		}
+	}
+
+	return (size_t)(p - out);
+}
+
+/*! XOR an encoded snapshot into buf */
+static void rewind_apply(const uint8_t *restrict in, size_t len,
+		uint64_t *restrict buf)
+{
+	const uint8_t *end = in + len;
+	size_t i = 0;
+
+	while(in < end)
+	{
+		uint16_t run[2];
+
+		memcpy(run, in, sizeof(run));
+		in += sizeof(run);
+		i += run[0];
+
+		for(uint16_t j = 0; j < run[1]; j++, i++)
+		{
+			uint64_t x;
+
+			memcpy(&x, in, sizeof(x));
+			in += sizeof(x);
+			buf[i] ^= x;
+		}
+	}
+}
+
+static inline rewind_entry * rewind_entry_at(rewind_buffer *restrict rw,
+		unsigned int n)
+{
+	return &(rw->entries[(rw->first + n) % REWIND_MAX_SNAPSHOTS]);
+}
+
+/*! Throw away the oldest keyframe and the deltas that need it */
+static void rewind_drop_oldest(rewind_buffer *restrict rw)
+{
+	do
+	{
+		if(rewind_entry_at(rw, 0)->key)
+		{
+			rw->keys--;
+		}
+
+		rw->first = (rw->first + 1) % REWIND_MAX_SNAPSHOTS;
+		rw->count--;
+	} while(rw->count > 0 && !rewind_entry_at(rw, 0)->key);
+
+	if(rw->count == 0)
+	{
+		rw->head = rw->tail = 0;
+		rw->since_key = 0;
+	}
+	else
+	{
+		rw->tail = rewind_entry_at(rw, 0)->offset;
+	}
+}
+
+/*!
+ * @brief	Find room for a snapshot, throwing old ones away as needed.
+ * @param	rw	The rewind buffer.
+ * @param	len	Bytes needed.
+ * @param	key	The snapshot is a keyframe.
+ * @param	offset	Filled in with where to put it.
+ * @returns	false if a delta would need its own keyframe thrown away.
+ */
+static bool rewind_make_room(rewind_buffer *restrict rw, size_t len, bool key,
+		size_t *offset)
+{
+	for(;;)
+	{
+		if(rw->count == 0)
+		{
+			*offset = 0;
+			return key;
+		}
+
+		if(rw->count < REWIND_MAX_SNAPSHOTS)
+		{
+			// Free space is [head, tail) or [head, end) + [0, tail)
+			if(rw->head < rw->tail && rw->tail - rw->head >= len)
+			{
+				*offset = rw->head;
+				return true;
+			}
+			else if(rw->head > rw->tail)
+			{
+				if(rw->data_size - rw->head >= len)
+				{
+					*offset = rw->head;
+					return true;
+				}
+				else if(rw->tail >= len)
+				{
+					*offset = 0;
+					return true;
+				}
+			}
+		}
+
+		if(!key && rw->keys == 1)
+		{
+			return false;
+		}
+
+		rewind_drop_oldest(rw);
+	}
+}
+
+/*! Take a snapshot */
+static void rewind_push(rewind_buffer *restrict rw, emu_state *restrict state)
+{
+	bool key = (rw->count == 0 || rw->since_key + 1 >= rw->keyframe_every);
+	rewind_entry *entry;
+	uint64_t *swap;
+	size_t len, offset;
+
+	savestate_save(state, rw->cur, rw->state_size);
+
+	for(;;)
+	{
+		len = rewind_encode(rw->cur, key ? rw->zero : rw->prev, rw->words,
+			rw->scratch);
+		if(rewind_make_room(rw, len, key, &offset))
+		{
+			break;
+		}
+
+		// Its keyframe had to go to make room
+		key = true;
+	}
+
+	memcpy(rw->data + offset, rw->scratch, len);
+	rw->head = offset + len;
+	if(rw->count == 0)
+	{
+		rw->tail = offset;
+	}
+
+	entry = rewind_entry_at(rw, rw->count++);
+	entry->offset = (uint32_t)offset;
+	entry->len = (uint32_t)len;
+	entry->key = key;
+
+	if(key)
+	{
+		rw->keys++;
+		rw->since_key = 0;
+	}
+	else
+	{
+		rw->since_key++;
+	}
+
+	swap = rw->prev;
+	rw->prev = rw->cur;
+	rw->cur = swap;
+}
+
+/*!
+ * @brief	Make a rewind buffer for an instance.
+ * @param	state	The instance, with a ROM loaded.
+ * @param	budget	Bytes the encoded snapshots may take up.
+ * @param	interval	Frames between snapshots.
+ * @param	keyframe_every	Snapshots per keyframe.
+ * @returns	The buffer, or NULL if the budget is too small (it must fit a
+ * 		few snapshots) or there's no memory.
+ */
+rewind_buffer * rewind_create(const emu_state *restrict state, size_t budget,
+		unsigned int interval, unsigned int keyframe_every)
+{
+	rewind_buffer *rw = calloc(1, sizeof(rewind_buffer));
+	size_t bytes;
+
+	if(rw == NULL)
+	{
+		return NULL;
+	}
+
+	rw->state_size = savestate_size(state);
+	rw->words = (rw->state_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+	bytes = rw->words * sizeof(uint64_t);
+
+	if(budget < rewind_encoded_max(rw->words) * 4 || budget > UINT32_MAX)
+	{
+		error(NULL, "rewind: a budget of %zu bytes won't do", budget);
+		free(rw);
+		return NULL;
+	}
+
+	rw->interval = rw->countdown = interval ? interval : 1;
+	rw->keyframe_every = keyframe_every ? keyframe_every : 1;
+	rw->data_size = budget;
+
+	// calloc, so the padding at the end of each snapshot stays zero
+	rw->cur = calloc(1, bytes);
+	rw->prev = calloc(1, bytes);
+	rw->zero = calloc(1, bytes);
+	rw->scratch = malloc(rewind_encoded_max(rw->words));
+	rw->data = malloc(budget);
+	rw->entries = malloc(REWIND_MAX_SNAPSHOTS * sizeof(rewind_entry));
+
+	if(!rw->cur || !rw->prev || !rw->zero || !rw->scratch || !rw->data ||
+		!rw->entries)
+	{
+		error(NULL, "rewind: out of memory");
+		rewind_destroy(rw);
+		return NULL;
+	}
+
+	return rw;
+}
+
+void rewind_destroy(rewind_buffer *rw)
+{
+	if(rw == NULL)
+	{
+		return;
+	}
+
+	free(rw->cur);
+	free(rw->prev);
+	free(rw->zero);
+	free(rw->scratch);
+	free(rw->data);
+	free(rw->entries);
+	free(rw);
+}
+
+/*!
+ * @brief	Tell the rewind buffer a frame has gone by.
+ * @param	rw	The rewind buffer.
+ * @param	state	The instance it belongs to.
+ * @note	Takes a snapshot every interval frames.
+ */
+void rewind_frame(rewind_buffer *restrict rw, emu_state *restrict state)
+{
+	if(--rw->countdown > 0)
+	{
+		return;
+	}
+
+	rw->countdown = rw->interval;
+	rewind_push(rw, state);
+}
+
+/*!
+ * @brief	Go back to the newest snapshot, and forget it.
+ * @param	rw	The rewind buffer.
+ * @param	state	The instance it belongs to.
+ * @returns	false if there's nothing left to go back to.
+ * @note	Call it once a frame to run backwards, interval frames a time.
+ */
+bool rewind_back(rewind_buffer *restrict rw, emu_state *restrict state)
+{
+	rewind_entry *entry;
+
+	if(rw->count == 0 || !savestate_load(state, rw->prev, rw->state_size))
+	{
+		return false;
+	}
+
+	entry = rewind_entry_at(rw, --rw->count);
+	rw->head = entry->offset;
+	rw->countdown = rw->interval;
+
+	if(rw->count == 0)
+	{
+		rw->head = rw->tail = 0;
+		rw->keys = rw->since_key = 0;
+	}
+	else if(!entry->key)
+	{
+		// A XOR (A XOR B) = B
+		rewind_apply(rw->data + entry->offset, entry->len, rw->prev);
+		rw->since_key--;
+	}
+	else
+	{
+		unsigned int key = rw->count - 1;
+
+		rw->keys--;
+
+		// Decode forward from the keyframe before
+		while(!rewind_entry_at(rw, key)->key)
+		{
+			key--;
+		}
+
+		memset(rw->prev, 0, rw->words * sizeof(uint64_t));
+		for(unsigned int i = key; i < rw->count; i++)
+		{
+			entry = rewind_entry_at(rw, i);
+			rewind_apply(rw->data + entry->offset, entry->len, rw->prev);
+		}
+
+		rw->since_key = rw->count - 1 - key;
+	}
+
+	return true;
+}
+
+/*! Snapshots there are to go back to */
+unsigned int rewind_count(const rewind_buffer *restrict rw)
+{
+	return rw->count;
+}
@@ -0,0 +1,587 @@
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include "link.h"	// LINK_NEVER, LINK_POLL_CLOCKS
+#include "mixer.h"	// resampler_set_rate
+#include "print.h"	// error
+#include "rom_read.h"	// OFF_*
+#include "savestate.h"	// prototypes
+#include "serio.h"	// serial_flush
+#include "sgherm.h"	// emu_state
+#include "snapshot.h"	// snapshot_forget
+#include "sound.h"	// SOUND_RATE, LFSR*_PERIOD
+#include "timer.h"	// timer_ticks
+#include "util.h"	// fnv1a
+
+#include <stdio.h>	// FILE, fopen, fread, fwrite
+#include <stdlib.h>	// malloc, free
+#include <string.h>	// memcpy, memcmp
+
+
+/*
+ * A save state is a header and then a run of tagged chunks, one per part
+ * of the machine.  Each chunk is a straight copy of the structure it comes
+ * from, so saving and loading are a handful of memcpy()s.  The price is
+ * that states only load into a build with the same layout: the version,
+ * byte order and every chunk's size have to match.  Chunks with tags we
+ * don't know are skipped, so extra ones can be added without a new
+ * version.
+ *
+ * Being straight copies, nothing in a chunk can be trusted until it's
+ * been looked at: every bank, table index and enum is checked against
+ * what the loading instance allows before any of it is copied in.
+ *
+ * Host things are never saved: cart_data, the frontend, the link cable,
+ * the render policy, serial matches, the output sample rate and the last
+ * frame of video and audio.  They stay as they are on load.  The ROM has
+ * to be the one the state was saved from.
+ */
+
+#define SAVESTATE_MAGIC		"SGHS"
+#define SAVESTATE_BYTE_ORDER	0x01020304
+
+typedef struct savestate_header_t
+{
+	char magic[4];			/*! SAVESTATE_MAGIC */
+	uint32_t byte_order;		/*! SAVESTATE_BYTE_ORDER, as written */
+	uint32_t version;		/*! SAVESTATE_VERSION */
+	uint32_t size;			/*! Bytes, including this header */
+	uint32_t rom_id;		/*! Hash of the cartridge header */
+} savestate_header;
+
+typedef struct savestate_chunk_t
+{
+	char tag[4];
+	uint32_t size;			/*! Bytes after this */
+} savestate_chunk;
+
+/*! The CPU's and the MBC's share of emu_state, which is spread about */
+typedef struct savestate_cpu_t
+{
+	register_state registers;
+	interrupt_state interrupts;
+	uint64_t cycles;
+	uint32_t wait;
+	uint32_t count_cur_second;
+	uint32_t game_seconds;
+	uint32_t freq;
+	uint32_t system;
+	uint16_t dma_membar_wait;
+	uint8_t bank;
+	uint8_t ram_bank;
+	bool halt;
+	bool stop;
+} savestate_cpu;
+
+typedef enum
+{
+	CHUNK_CPU = 0,
+	CHUNK_RAM,			/*! 0x8000 up; below is ROM */
+	CHUNK_CART_RAM,			/*! As many banks as the cart has */
+	CHUNK_LCDC,
+	CHUNK_TIMER,
+	CHUNK_SERIAL,
+	CHUNK_SOUND,
+	CHUNK_INPUT,
+	CHUNK_COUNT,
+} savestate_chunk_id;
+
+static const char savestate_tags[CHUNK_COUNT][4] =
+{
+	{ 'C', 'P', 'U', ' ' },
+	{ 'R', 'A', 'M', ' ' },
+	{ 'C', 'R', 'A', 'M' },
+	{ 'L', 'C', 'D', 'C' },
+	{ 'T', 'I', 'M', 'R' },
+	{ 'S', 'E', 'R', 'I' },
+	{ 'S', 'N', 'D', ' ' },
+	{ 'J', 'O', 'Y', 'P' },
+};
+
+
+/*! Cartridge RAM banks in use, from the header */
+static uint32_t savestate_cart_banks(const emu_state *restrict state)
+{
+	static const uint8_t banks[] = { 0, 1, 1, 4, 16, 8 };
+	uint8_t code = state->cart_data[OFF_RAM_SIZE];
+	uint32_t count, most = sizeof(state->cart_ram) / sizeof(*state->cart_ram);
+
+	count = (code < sizeof(banks)) ? banks[code] : most;
+	return (count < most) ? count : most;
+}
+
+/*! ROM banks in the cart; 0x148 is log2 of its size in 32KiB units */
+static uint32_t savestate_rom_banks(const emu_state *restrict state)
+{
+	uint8_t code = state->cart_data[OFF_ROM_SIZE];
+
+	return (code < 16) ? (2U << code) : 0;
+}
+
+/*! Which ROM a state (or anything else saved) belongs to */
+uint32_t savestate_rom_id(const emu_state *restrict state)
+{
+	return fnv1a(state->cart_data + OFF_TITLE_BEGIN,
+		OFF_CART_END + 1 - OFF_TITLE_BEGIN, FNV1A_INIT);
+}
+
+/*!
+ * @brief	Find where each chunk lives in an instance.
+ * @param	state	The instance.
+ * @param	cpu	Stands in for the CPU chunk, which has to be gathered.
+ * @param	data	Filled in with where each chunk's bytes are.
+ * @param	size	Filled in with each chunk's size.
+ */
+static void savestate_map(emu_state *restrict state, savestate_cpu *cpu,
+		void *data[CHUNK_COUNT], uint32_t size[CHUNK_COUNT])
+{
+	data[CHUNK_CPU] = cpu;
+	size[CHUNK_CPU] = sizeof(savestate_cpu);
+
+	data[CHUNK_RAM] = state->memory + 0x8000;
+	size[CHUNK_RAM] = MEM_SIZE - 0x8000;
+
+	data[CHUNK_CART_RAM] = state->cart_ram;
+	size[CHUNK_CART_RAM] = savestate_cart_banks(state) *
+		sizeof(*state->cart_ram);
+
+	data[CHUNK_LCDC] = &(state->lcdc);
+	size[CHUNK_LCDC] = offsetof(lcdc_state, out);
+
+	data[CHUNK_TIMER] = &(state->timer);
+	size[CHUNK_TIMER] = sizeof(timer_state);
+
+	data[CHUNK_SERIAL] = &(state->ser);
+	size[CHUNK_SERIAL] = offsetof(ser_state, matches);
+
+	data[CHUNK_SOUND] = &(state->snd);
+	size[CHUNK_SOUND] = offsetof(snd_state, chan_out);
+
+	data[CHUNK_INPUT] = &(state->input);
+	size[CHUNK_INPUT] = sizeof(input_state);
+}
+
+/*! Copy one field out of a chunk that hasn't been loaded */
+#define CHUNK_FIELD(chunk, type, field, var) \
+	memcpy(&(var), (chunk) + offsetof(type, field), sizeof(var))
+
+/*!
+ * @brief	Check the values in a state's chunks before loading them.
+ * @param	state	The instance it would load into.
+ * @param	cpu	The state's CPU chunk.
+ * @param	found	Where each chunk is in the state.
+ * @returns	true if every bank, table index and enum is in range.
+ */
+static bool savestate_check(emu_state *restrict state, const savestate_cpu *cpu,
+		const uint8_t *found[CHUNK_COUNT])
+{
+	const uint8_t *lcdc = found[CHUNK_LCDC], *snd = found[CHUNK_SOUND];
+	uint32_t ram_banks = savestate_cart_banks(state);
+	uint_fast8_t vram_bank, ly;
+	uint16_t ticks_per_tima, buf_len;
+	struct snd_square_t square[2];
+	struct _ch3 ch3;
+	struct _ch4 ch4;
+	uint8_t fs_step;
+	resampler rs;
+	bool ticks_ok = false;
+
+	if(cpu->bank == 0 || cpu->bank >= savestate_rom_banks(state) ||
+		cpu->ram_bank >= (ram_banks ? ram_banks : 1))
+	{
+		error(state, "savestate: bank %u/RAM bank %u not in this cart",
+			cpu->bank, cpu->ram_bank);
+		return false;
+	}
+	else if(cpu->system > SYSTEM_CGB || (cpu->freq != CPU_FREQ_DMG &&
+		cpu->freq != CPU_FREQ_SGB && cpu->freq != CPU_FREQ_CGB))
+	{
+		error(state, "savestate: unknown system %u at %uHz",
+			cpu->system, cpu->freq);
+		return false;
+	}
+
+	CHUNK_FIELD(lcdc, lcdc_state, vram_bank, vram_bank);
+	CHUNK_FIELD(lcdc, lcdc_state, ly, ly);
+	if(vram_bank > 1 || ly >= 154)
+	{
+		error(state, "savestate: bad VRAM bank %u or LY %u",
+			(unsigned int)vram_bank, (unsigned int)ly);
+		return false;
+	}
+
+	CHUNK_FIELD(found[CHUNK_TIMER], timer_state, ticks_per_tima,
+		ticks_per_tima);
+	for(uint8_t rate = 0; rate < 4; rate++)
+	{
+		ticks_ok |= (timer_ticks[rate] == ticks_per_tima);
+	}
+	if(!ticks_ok)
+	{
+		error(state, "savestate: bad timer rate %u", ticks_per_tima);
+		return false;
+	}
+
+	CHUNK_FIELD(found[CHUNK_SERIAL], ser_state, buf_len, buf_len);
+	if(buf_len >= SERIAL_BUF_SIZE)
+	{
+		error(state, "savestate: bad serial buffer length %u", buf_len);
+		return false;
+	}
+
+	// Indexes into sound.c's tables: duty (4x8), wave shifts (4), noise
+	// divisors (8) and the LFSR sequences; and the resampler history
+	CHUNK_FIELD(snd, snd_state, ch1, square[0]);
+	CHUNK_FIELD(snd, snd_state, ch2, square[1]);
+	CHUNK_FIELD(snd, snd_state, ch3, ch3);
+	CHUNK_FIELD(snd, snd_state, ch4, ch4);
+	CHUNK_FIELD(snd, snd_state, fs_step, fs_step);
+	CHUNK_FIELD(snd, snd_state, rs, rs);
+
+	for(unsigned int i = 0; i < 2; i++)
+	{
+		if(square[i].wave_duty >= 4 || square[i].duty_pos >= 8 ||
+			square[i].volume > 15)
+		{
+			error(state, "savestate: bad sound channel %u", i + 1);
+			return false;
+		}
+	}
+
+	if(ch3.volume >= 4 || ch3.pos >= 32)
+	{
+		error(state, "savestate: bad sound channel 3");
+		return false;
+	}
+	else if(ch4.divisor >= 8 || ch4.volume > 15 ||
+		ch4.lfsr_pos >= (ch4.width7 ? LFSR7_PERIOD : LFSR15_PERIOD))
+	{
+		error(state, "savestate: bad sound channel 4");
+		return false;
+	}
+	else if(fs_step >= 8 || rs.hist_len >= RESAMPLE_TAPS ||
+		(rs.pos >> RESAMPLE_FRAC) > rs.hist_len)
+	{
+		error(state, "savestate: bad sound sequencer or resampler");
+		return false;
+	}
+
+	return true;
+}
+
+/*!
+ * @brief	Work out how big a save state of an instance is.
+ * @param	state	The instance, with a ROM loaded.
+ * @returns	The size in bytes; it's the same for as long as the ROM is.
+ */
+size_t savestate_size(const emu_state *restrict state)
+{
+	savestate_cpu cpu;
+	void *data[CHUNK_COUNT];
+	uint32_t size[CHUNK_COUNT];
+	size_t total = sizeof(savestate_header);
+
+	savestate_map((emu_state *)state, &cpu, data, size);
+
+	for(unsigned int i = 0; i < CHUNK_COUNT; i++)
+	{
+		total += sizeof(savestate_chunk) + size[i];
+	}
+
+	return total;
+}
+
+/*!
+ * @brief	Save an instance.
+ * @param	state	The instance.
+ * @param	buf	Where to save it.
+ * @param	len	Size of buf; savestate_size says how much is needed.
+ * @returns	Bytes used, or 0 if buf is too small.
+ * @note	Pending serial output is written out first, so a state never
+ * 		holds any.
+ */
+size_t savestate_save(emu_state *restrict state, void *restrict buf,
+		size_t len)
+{
+	savestate_header header;
+	savestate_cpu cpu = { 0 };
+	void *data[CHUNK_COUNT];
+	uint32_t size[CHUNK_COUNT];
+	size_t total = savestate_size(state);
+	uint8_t *out = buf;
+
+	if(unlikely(len < total))
+	{
+		error(state, "savestate: %zu bytes needed, %zu given", total, len);
+		return 0;
+	}
+
+	serial_flush(state);
+
+	cpu.registers = state->registers;
+	cpu.interrupts = state->interrupts;
+	cpu.cycles = state->cycles;
+	cpu.wait = (uint32_t)state->wait;
+	cpu.count_cur_second = state->count_cur_second;
+	cpu.game_seconds = state->game_seconds;
+	cpu.freq = (uint32_t)state->freq;
+	cpu.system = (uint32_t)state->system;
+	cpu.dma_membar_wait = (uint16_t)state->dma_membar_wait;
+	cpu.bank = (uint8_t)state->bank;
+	cpu.ram_bank = (uint8_t)state->ram_bank;
+	cpu.halt = state->halt;
+	cpu.stop = state->stop;
+
+	memcpy(header.magic, SAVESTATE_MAGIC, sizeof(header.magic));
+	header.byte_order = SAVESTATE_BYTE_ORDER;
+	header.version = SAVESTATE_VERSION;
+	header.size = (uint32_t)total;
+	header.rom_id = savestate_rom_id(state);
+
+	memcpy(out, &header, sizeof(header));
+	out += sizeof(header);
+
+	savestate_map(state, &cpu, data, size);
+
+	for(unsigned int i = 0; i < CHUNK_COUNT; i++)
+	{
+		savestate_chunk chunk;
+
+		memcpy(chunk.tag, savestate_tags[i], sizeof(chunk.tag));
+		chunk.size = size[i];
+
+		memcpy(out, &chunk, sizeof(chunk));
+		memcpy(out + sizeof(chunk), data[i], size[i]);
+		out += sizeof(chunk) + size[i];
+	}
+
+	return total;
+}
+
+/*!
+ * @brief	Load a save state into an instance.
+ * @param	state	The instance, with the state's ROM loaded.
+ * @param	buf	The state, from savestate_save.
+ * @param	len	Size of buf.
+ * @returns	true if it was loaded; if not, state is untouched.
+ */
+bool savestate_load(emu_state *restrict state, const void *restrict buf,
+		size_t len)
+{
+	savestate_header header;
+	savestate_cpu cpu;
+	void *data[CHUNK_COUNT];
+	uint32_t size[CHUNK_COUNT];
+	const uint8_t *in = buf, *end, *found[CHUNK_COUNT] = { NULL };
+	uint32_t rate = state->snd.rate;
+	int32_t skew = state->snd.skew;
+
+	if(unlikely(len < sizeof(header)))
+	{
+		error(state, "savestate: too short");
+		return false;
+	}
+
+	memcpy(&header, in, sizeof(header));
+	if(memcmp(header.magic, SAVESTATE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.byte_order != SAVESTATE_BYTE_ORDER)
+	{
+		error(state, "savestate: not a save state from this machine");
+		return false;
+	}
+	else if(header.version != SAVESTATE_VERSION)
+	{
+		error(state, "savestate: version %u, need %u", header.version,
+			SAVESTATE_VERSION);
+		return false;
+	}
+	else if(header.size > len)
+	{
+		error(state, "savestate: truncated (%zu of %u bytes)", len,
+			header.size);
+		return false;
+	}
+	else if(header.rom_id != savestate_rom_id(state))
+	{
+		error(state, "savestate: saved from a different ROM");
+		return false;
+	}
+
+	savestate_map(state, &cpu, data, size);
+
+	// Check it all before touching anything
+	end = in + header.size;
+	in += sizeof(header);
+	while(in < end)
+	{
+		savestate_chunk chunk;
+
+		if((size_t)(end - in) < sizeof(chunk))
+		{
+			error(state, "savestate: truncated chunk");
+			return false;
+		}
+
+		memcpy(&chunk, in, sizeof(chunk));
+		in += sizeof(chunk);
+
+		if((size_t)(end - in) < chunk.size)
+		{
+			error(state, "savestate: truncated %.4s chunk", chunk.tag);
+			return false;
+		}
+
+		for(unsigned int i = 0; i < CHUNK_COUNT; i++)
+		{
+			if(memcmp(chunk.tag, savestate_tags[i], sizeof(chunk.tag)))
+			{
+				continue;
+			}
+
+			if(chunk.size != size[i])
+			{
+				error(state, "savestate: %.4s chunk is %u bytes, need %u",
+					chunk.tag, chunk.size, size[i]);
+				return false;
+			}
+
+			found[i] = in;
+		}
+
+		in += chunk.size;
+	}
+
+	for(unsigned int i = 0; i < CHUNK_COUNT; i++)
+	{
+		if(found[i] == NULL)
+		{
+			error(state, "savestate: no %.4s chunk",
+				savestate_tags[i]);
+			return false;
+		}
+	}
+
+	memcpy(&cpu, found[CHUNK_CPU], sizeof(cpu));
+	if(!savestate_check(state, &cpu, found))
+	{
+		return false;
+	}
+
+	// Whatever the present went to print has been printed
+	serial_flush(state);
+
+	for(unsigned int i = 0; i < CHUNK_COUNT; i++)
+	{
+		if(i != CHUNK_CPU)
+		{
+			memcpy(data[i], found[i], size[i]);
+		}
+	}
+
+	state->registers = cpu.registers;
+	state->interrupts = cpu.interrupts;
+	state->cycles = cpu.cycles;
+	state->wait = cpu.wait;
+	state->count_cur_second = cpu.count_cur_second;
+	state->game_seconds = cpu.game_seconds;
+	state->freq = (cpu_freq)cpu.freq;
+	state->system = (system_types)cpu.system;
+	state->dma_membar_wait = cpu.dma_membar_wait;
+	state->bank = cpu.bank;
+	state->ram_bank = cpu.ram_bank;
+	state->halt = cpu.halt;
+	state->stop = cpu.stop;
+
+	// The host's output rate isn't the state's business
+	state->snd.rate = rate;
+	state->snd.skew = skew;
+	resampler_set_rate(&(state->snd.rs), SOUND_RATE, rate, skew);
+
+	// Nor is the peer on the link cable, which hasn't gone anywhere
+	state->ser.link_pending = false;
+	state->ser.link_next = (state->link != NULL) ?
+		state->cycles + LINK_POLL_CLOCKS : LINK_NEVER;
+
+	// Memory changed wholesale, not a page at a time
+	snapshot_forget(state);
+
+	return true;
+}
+
+bool savestate_save_file(emu_state *restrict state, const char *path)
+{
+	size_t len = savestate_size(state);
+	uint8_t *buf = malloc(len);
+	FILE *f;
+	bool ok = false;
+
+	if(buf == NULL)
+	{
+		error(state, "savestate: out of memory");
+		return false;
+	}
+
+	if((len = savestate_save(state, buf, len)) == 0)
+	{
+		free(buf);
+		return false;
+	}
+
+	if((f = fopen(path, "wb")) == NULL)
+	{
+		error(state, "savestate: can't open %s", path);
+		free(buf);
+		return false;
+	}
+
+	ok = (fwrite(buf, len, 1, f) == 1);
+	ok &= (fclose(f) == 0);
+	if(!ok)
+	{
+		error(state, "savestate: can't write %s", path);
+	}
+
+	free(buf);
+	return ok;
+}
+
+bool savestate_load_file(emu_state *restrict state, const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t *buf;
+	long len;
+	bool ok = false;
+
+	if(f == NULL)
+	{
+		error(state, "savestate: can't open %s", path);
+		return false;
+	}
+
+	if(fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 ||
+		fseek(f, 0, SEEK_SET) != 0)
+	{
+		error(state, "savestate: can't size %s", path);
+		fclose(f);
+		return false;
+	}
+
+	if((buf = malloc(len ? (size_t)len : 1)) == NULL)
+	{
+		error(state, "savestate: out of memory");
+		fclose(f);
+		return false;
+	}
+
+	if(fread(buf, (size_t)len, 1, f) == 1 || len == 0)
+	{
+		ok = savestate_load(state, buf, (size_t)len);
+	}
+	else
+	{
+		error(state, "savestate: can't read %s", path);
+	}
+
+	free(buf);
+	fclose(f);
+	return ok;
+}
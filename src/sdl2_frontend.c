@@ -1,7 +1,11 @@
 #include "sgherm.h"	// emu_state,
-#include "print.h"	// debug
-#include "signals.h"	// do_exit
+#include "print.h"	// debug, error
 #include "frontend.h"	// frontend
+#include "lcdc.h"	// set_render_policy
+#include "rewind.h"	// rewind_*
+#include "savestate.h"	// savestate_*
+#include "sound.h"	// sound_set_output_rate, sound_set_rate_skew
+#include "util_ring.h"	// sample_ring
 
 // SDL 2 whines. *sigh*
 #ifdef HAVE_STDINT_H
@@ -13,7 +17,7 @@
 
 #include <SDL.h>	// SDL
 #include <stdbool.h>	// bool
-#include <stdlib.h>	// calloc
+#include <stdlib.h>	// calloc, malloc, free
 
 
 #define LEN 144
@@ -26,14 +30,42 @@
 #define BLUE	0x00ff0000
 #define ALPHA	0xff000000
 
+#define AUDIO_RING_SIZE	16384	/*! Samples (not frames) the ring holds */
+#define AUDIO_TARGET	4096	/*! Samples we try to keep queued (~43ms) */
+#define AUDIO_SKEW_MAX	5000	/*! Most rate adjustment, in ppm (0.5%) */
+
+#define REWIND_BUDGET	(64 << 20)	/*! Bytes of rewind history (minutes) */
+#define REWIND_INTERVAL	1	/*! Frames between rewind snapshots */
+#define REWIND_KEYFRAMES	64	/*! Rewind snapshots per keyframe */
+
+
+/*! Where the real frame is kept while the ahead ones are run */
+typedef struct sdl2_run_ahead_t
+{
+	uint8_t *saved;		/*! Save state of the real frame */
+	size_t len;		/*! Size of saved */
+	render_policy render;	/*! Policy for the frame shown */
+	unsigned int render_skip;
+} sdl2_run_ahead;
 
 typedef struct sdl2_video_data_t
 {
 	SDL_Window *window;
 	SDL_Renderer *render;
 	SDL_Texture *texture;
+
+	uint32_t last_hash;	/*! Hash of the frame on screen */
+	bool redraw;		/*! Window needs repainting regardless */
 } sdl2_video_data;
 
+typedef struct sdl2_audio_data_t
+{
+	SDL_AudioDeviceID dev;
+	sample_ring ring;	/*! Emulator thread to audio callback */
+	int16_t last[2];	/*! Repeated on underrun (callback side) */
+	int16_t buf[AUDIO_RING_SIZE];
+} sdl2_audio_data;
+
 bool sdl2_init_video(emu_state *state)
 {
 	sdl2_video_data *video;
@@ -88,6 +120,8 @@ bool sdl2_init_video(emu_state *state)
 	SDL_RenderClear(video->render);
 	SDL_RenderPresent(video->render);
 
+	video->redraw = true;
+
 	return true;
 }
 
@@ -104,17 +138,78 @@ bool sdl2_init_input(emu_state *state UNUSED)
 	return true;
 }
 
-bool sdl2_init_audio(emu_state *state UNUSED)
+/*!
+ * Runs on SDL's audio thread; may only touch the consumer side of the ring.
+ */
+static void sdl2_audio_callback(void *userdata, Uint8 *stream, int len)
 {
-	 info(state, "Initalising the SDL audio frontend");
+	sdl2_audio_data *audio = userdata;
+	int16_t *out = (int16_t *)stream;
+	size_t want = len / sizeof(int16_t);
+	size_t got = sample_ring_read(&(audio->ring), out, want);
 
-	 if(SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
-	 {
-		 error(state, "Failed to initalise audio frontend: %s", SDL_GetError());
-		 return false;
-	 }
+	if(got >= 2)
+	{
+		audio->last[0] = out[got - 2];
+		audio->last[1] = out[got - 1];
+	}
 
-	 return true;
+	// Underrun; hold the last level rather than clicking to zero
+	for(; got + 1 < want; got += 2)
+	{
+		out[got] = audio->last[0];
+		out[got + 1] = audio->last[1];
+	}
+}
+
+bool sdl2_init_audio(emu_state *state)
+{
+	sdl2_audio_data *audio;
+	SDL_AudioSpec want, have;
+
+	info(state, "Initalising the SDL audio frontend");
+
+	if(SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
+	{
+		error(state, "Failed to initalise audio frontend: %s", SDL_GetError());
+		return false;
+	}
+
+	audio = calloc(1, sizeof(sdl2_audio_data));
+	if(audio == NULL)
+	{
+		error(state, "Failed to initalise audio frontend: out of memory");
+		SDL_QuitSubSystem(SDL_INIT_AUDIO);
+		return false;
+	}
+
+	audio->ring.size = AUDIO_RING_SIZE;
+	audio->ring.buf = audio->buf;
+
+	SDL_zero(want);
+	want.freq = SOUND_RATE;
+	want.format = AUDIO_S16SYS;
+	want.channels = 2;
+	want.samples = 512;
+	want.callback = &sdl2_audio_callback;
+	want.userdata = audio;
+
+	audio->dev = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+			SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+	if(audio->dev == 0)
+	{
+		error(state, "Failed to open audio device: %s", SDL_GetError());
+		free(audio);
+		SDL_QuitSubSystem(SDL_INIT_AUDIO);
+		return false;
+	}
+
+	state->front.audio.data = audio;
+	sound_set_output_rate(state, have.freq);
+
+	SDL_PauseAudioDevice(audio->dev, 0);
+
+	return true;
 }
 
 void sdl2_finish_video(emu_state *state)
@@ -140,25 +235,68 @@ void sdl2_finish_input(emu_state *state UNUSED)
 	SDL_QuitSubSystem(SDL_INIT_EVENTS);
 }
 
-void sdl2_finish_audio(emu_state *state UNUSED)
+void sdl2_finish_audio(emu_state *state)
 {
+	sdl2_audio_data *audio = state->front.audio.data;
+
 	info(state, "SDL audio frontend finishing up");
 
+	if(audio != NULL)
+	{
+		SDL_CloseAudioDevice(audio->dev);
+		free(audio);
+		state->front.audio.data = NULL;
+	}
+
 	SDL_QuitSubSystem(SDL_INIT_AUDIO);
 }
 
 void sdl2_blit_canvas(emu_state *state)
 {
 	sdl2_video_data *video = state->front.video.data;
+	uint8_t line = 0, count;
+
+	// Identical frame: nothing to upload, nothing to present
+	if(!video->redraw && state->lcdc.frame_hash == video->last_hash)
+	{
+		lcdc_clear_dirty(state);
+		return;
+	}
+
+	// Convert straight into the texture, one run of changed lines at a time
+	while((count = lcdc_dirty_run(state, &line)) > 0)
+	{
+		SDL_Rect rect = { 0, line, WID, count };
+		uint8_t *pixels;
+		int pitch;
+
+		if(SDL_LockTexture(video->texture, &rect, (void **)&pixels, &pitch) != 0)
+		{
+			error(state, "Failed to lock texture: %s", SDL_GetError());
+			return;
+		}
+
+		for(uint8_t i = 0; i < count; i++)
+		{
+			lcdc_line_to_argb(state, line + i,
+					(uint32_t *)(pixels + (i * pitch)));
+		}
+
+		SDL_UnlockTexture(video->texture);
+
+		line += count;
+	}
+
+	lcdc_clear_dirty(state);
 
-	SDL_UpdateTexture(video->texture, NULL, state->lcdc.out,
-			WID * sizeof(uint32_t));
+	video->last_hash = state->lcdc.frame_hash;
+	video->redraw = false;
 
 	SDL_RenderCopy(video->render, video->texture, NULL, NULL);
 	SDL_RenderPresent(video->render);
 }
 
-void sdl2_get_key(emu_state *state UNUSED, frontend_input_return *ret)
+void sdl2_get_key(emu_state *state, frontend_input_return *ret)
 {
 	SDL_Event ev;
 	if(SDL_PollEvent(&ev) == 0)
@@ -208,7 +346,7 @@ void sdl2_get_key(emu_state *state UNUSED, frontend_input_return *ret)
 			break;
 
 		case SDLK_ESCAPE:
-			do_exit = true;
+			state->do_exit = true;
 
 		default:
 			ret->key = 0;
@@ -218,32 +356,190 @@ void sdl2_get_key(emu_state *state UNUSED, frontend_input_return *ret)
 	else if(ev.type == SDL_QUIT)
 	{
 		ret->key = 0;
-		do_exit = true;
+		state->do_exit = true;
+	}
+	else
+	{
+		ret->key = 0;
+
+		// Exposed or resized; the next frame must be presented
+		if(ev.type == SDL_WINDOWEVENT &&
+			state->front.video.init == &sdl2_init_video)
+		{
+			sdl2_video_data *video = state->front.video.data;
+			video->redraw = true;
+		}
+	}
+}
+
+/*!
+ * @brief	Queue a frame of audio for the device.
+ * @param	state	The emulator state.
+ * @param	samples	Interleaved stereo samples.
+ * @param	count	Number of stereo samples.
+ * @note	Also steers the resampler so the queue hovers around
+ * 		AUDIO_TARGET: fuller means produce a little less, and the
+ * 		other way round.  The change is small enough not to hear.
+ */
+void sdl2_output_sample(emu_state *state, const int16_t *samples, size_t count)
+{
+	sdl2_audio_data *audio = state->front.audio.data;
+	int32_t fill;
+
+	if(audio == NULL)
+	{
+		return;
+	}
+
+	// Drops the tail if the device has stalled; nothing better to do
+	sample_ring_write(&(audio->ring), samples, count * 2);
+
+	fill = (int32_t)sample_ring_used(&(audio->ring)) - AUDIO_TARGET;
+	sound_set_rate_skew(state, (fill * AUDIO_SKEW_MAX) / AUDIO_TARGET);
+}
+
+/*!
+ * @brief	Let the audio device set the pace.
+ * @param	state	The emulator state.
+ * @note	Sleeps while there is more than a frame's worth above the
+ * 		target queued, instead of running ahead or spinning.
+ */
+static void sdl2_audio_wait(emu_state *state)
+{
+	sdl2_audio_data *audio = state->front.audio.data;
+	uint32_t limit = AUDIO_TARGET + (state->snd.rate / 60) * 2;
+
+	while(sample_ring_used(&(audio->ring)) > limit && !state->do_exit)
+	{
+		SDL_Delay(1);
 	}
 }
 
-void sdl2_output_sample(emu_state *state UNUSED)
+/*! Speculative audio goes nowhere */
+static void sdl2_output_nothing(emu_state *state UNUSED,
+		const int16_t *samples UNUSED, size_t count UNUSED)
 {
-	// TODO
-	return;
+}
+
+/*!
+ * @brief	Run a frame, and show the one state->run_ahead frames after.
+ * @param	state	The emulator state.
+ * @param	ahead	From sdl2_event_loop; saved is NULL if not running ahead.
+ * @returns	false if state->do_exit was set during the real frame.
+ * @note	The frames ahead are run with the input held as it is now,
+ * 		then thrown away.  Only the last one is drawn and none are
+ * 		heard, so a game's own input lag is hidden at the cost of
+ * 		running the emulator run_ahead + 1 times as much.
+ */
+static bool sdl2_run_frame(emu_state *state, const sdl2_run_ahead *ahead)
+{
+	FILE *to_stdout = state->to_stdout;
+	size_t match_count = state->ser.match_count;
+	void (*output_sample)(emu_state *, const int16_t *, size_t) =
+		state->front.audio.output_sample;
+
+	if(ahead->saved == NULL)
+	{
+		return run_until_frame(state);
+	}
+
+	// The real frame is heard but never seen
+	set_render_policy(state, RENDER_NEVER, 0);
+	if(!run_until_frame(state))
+	{
+		return false;
+	}
+
+	savestate_save(state, ahead->saved, ahead->len);
+
+	// Serial output of the frames ahead is thrown away too, and a test
+	// ROM only gets to give its verdict in a real frame
+	state->front.audio.output_sample = &sdl2_output_nothing;
+	state->to_stdout = NULL;
+	state->ser.match_count = 0;
+
+	for(unsigned int i = 1; i <= state->run_ahead; i++)
+	{
+		if(i == state->run_ahead)
+		{
+			set_render_policy(state, ahead->render,
+				ahead->render_skip);
+		}
+
+		if(!run_until_frame(state))
+		{
+			break;
+		}
+	}
+
+	savestate_load(state, ahead->saved, ahead->len);
+
+	state->front.audio.output_sample = output_sample;
+	state->to_stdout = to_stdout;
+	state->ser.match_count = match_count;
+
+	// Likewise a fatal error; the real frames will get there themselves
+	if(state->fatal_code != 0)
+	{
+		state->fatal_code = 0;
+		state->do_exit = false;
+	}
+
+	return true;
 }
 
 int sdl2_event_loop(emu_state *state)
 {
+	bool paced = (state->front.audio.init == &sdl2_init_audio &&
+		state->front.audio.data != NULL);
+	rewind_buffer *rw = NULL;
+	sdl2_run_ahead ahead = { NULL, 0, state->render, state->render_skip };
 
 	debug(state, "Executing sdl event loop");
 
+	// Going back in time would tear a movie apart
+	if(state->movie == NULL)
+	{
+		rw = rewind_create(state, REWIND_BUDGET, REWIND_INTERVAL,
+			REWIND_KEYFRAMES);
+	}
+
+	// Nor can a link cable peer be run ahead of
+	if(state->run_ahead > 0 && state->movie == NULL && state->link == NULL)
+	{
+		ahead.len = savestate_size(state);
+		if((ahead.saved = malloc(ahead.len)) == NULL)
+		{
+			error(state, "sdl2: no memory to run ahead");
+		}
+	}
+
 	SDL_Init(0);
 
-	do
+	while(sdl2_run_frame(state, &ahead))
 	{
-		uint8_t mode = state->lcdc.stat.params.mode_flag;
-		uint_fast16_t clock = state->lcdc.curr_clk;
 		frontend_input_return ret;
 
-		step_emulator(state);
+		// Once a frame: hold back for audio, then poll input
+		if(paced)
+		{
+			sdl2_audio_wait(state);
+		}
 
-		if(unlikely(mode == 1 && clock == 1 && state->input.col))
+		// Hold R to run backwards
+		if(rw != NULL)
+		{
+			if(SDL_GetKeyboardState(NULL)[SDL_SCANCODE_R])
+			{
+				rewind_back(rw, state);
+			}
+			else
+			{
+				rewind_frame(rw, state);
+			}
+		}
+
+		if(state->input.col)
 		{
 			GET_KEY(state, &ret);
 			if(ret.key > 0)
@@ -251,7 +547,10 @@ int sdl2_event_loop(emu_state *state)
 				joypad_signal(state, ret.key, ret.press);
 			}
 		}
-	} while(!do_exit);
+	}
+
+	rewind_destroy(rw);
+	free(ahead.saved);
 
 	return 0;
 }
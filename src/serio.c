@@ -1,8 +1,105 @@
 #include "config.h"	// macros, bool
 
+#include "link.h"	// link_*
 #include "print.h"	// error
 #include "sgherm.h"	// emu_state
 
+#include <string.h>	// memcmp, memmove
+
+
+/*! Verdicts printed by blargg's and mooneye's test ROMs */
+const serial_match serial_default_matches[] =
+{
+	{ "Passed", 6, 0 },
+	{ "Failed", 6, 1 },
+	{ "\x03\x05\x08\x0D\x15\x22", 6, 0 },	/* mooneye: Fibonacci in B..L */
+	{ "\x42\x42\x42\x42\x42\x42", 6, 1 },	/* mooneye: 0x42 in B..L */
+};
+
+const size_t serial_default_match_count =
+	sizeof(serial_default_matches) / sizeof(serial_match);
+
+/*!
+ * @brief	Choose the patterns that end the run when seen on serial.
+ * @param	state	The emulator state to watch.
+ * @param	matches	The patterns to look for, or NULL for none.
+ * @param	count	The number of patterns.
+ * @note	The patterns are not copied, and must outlive the state.
+ */
+void serial_set_matches(emu_state *restrict state, const serial_match *matches,
+		size_t count)
+{
+	state->ser.matches = matches;
+	state->ser.match_count = count;
+}
+
+/*!
+ * @brief	Write out any buffered serial output.
+ * @param	state	The emulator state to flush.
+ */
+void serial_flush(emu_state *restrict state)
+{
+	if(state->ser.buf_len == 0 || state->to_stdout == NULL)
+	{
+		state->ser.buf_len = 0;
+		return;
+	}
+
+	fwrite(state->ser.buf, 1, state->ser.buf_len, state->to_stdout);
+	fflush(state->to_stdout);
+	state->ser.buf_len = 0;
+}
+
+/*! Buffer a byte sent over serial and check it against the patterns */
+static void serial_capture(emu_state *restrict state, uint8_t data)
+{
+	uint8_t *tail = state->ser.tail;
+
+	state->ser.buf[state->ser.buf_len++] = data;
+	if(data == '\n' || state->ser.buf_len == SERIAL_BUF_SIZE)
+	{
+		serial_flush(state);
+	}
+
+	if(state->ser.match_count == 0)
+	{
+		return;
+	}
+
+	memmove(tail, tail + 1, SERIAL_MATCH_MAX - 1);
+	tail[SERIAL_MATCH_MAX - 1] = data;
+
+	for(size_t i = 0; i < state->ser.match_count; i++)
+	{
+		const serial_match *match = &(state->ser.matches[i]);
+
+		if(match->len > SERIAL_MATCH_MAX)
+		{
+			continue;
+		}
+
+		if(memcmp(tail + SERIAL_MATCH_MAX - match->len,
+			match->pattern, match->len) == 0)
+		{
+			state->ser.matched = true;
+			state->ser.exit_code = match->exit_code;
+			serial_flush(state);
+			state->do_exit = true;
+			return;
+		}
+	}
+}
+
+/*!
+ * @brief	Set up the serial controller.
+ * @param	state	The emulator state to initialise.
+ */
+void init_serial(emu_state *restrict state)
+{
+	state->ser.next_event = SERIAL_NEVER;
+	state->ser.link_next = LINK_NEVER;
+}
+
 /*!
  * @brief	Read a register from the serial controller.
  * @param	state	The emulator state to use while reading.
@@ -40,13 +137,36 @@ void serial_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 	switch(reg)
 	{
 	case 0xFF01:	/* SB - data to write */
-		fprintf(to_stdout, "%c", data);
-		state->ser.cur_bit = 7;
+		serial_capture(state, data);
 		state->ser.out = data;
 		break;
 	case 0xFF02:	/* SC - serial control */
-		state->ser.enabled = (data && 0x80 == 0x80);
-		state->ser.use_internal = (data && 0x01 == 0x01);
+		state->ser.enabled = ((data & 0x80) == 0x80);
+		state->ser.use_internal = ((data & 0x01) == 0x01);
+		state->ser.next_event = SERIAL_NEVER;
+
+		/*
+		 * Only our own clock has a known end; an external clock
+		 * transfer ends when the other side says so (link_poll),
+		 * or never if there is no other side.
+		 */
+		if(state->ser.enabled && state->ser.use_internal)
+		{
+			uint16_t bit_clocks = SERIAL_BIT_CLOCKS;
+
+			if(state->system == SYSTEM_CGB && (data & 0x02))
+			{
+				bit_clocks = SERIAL_BIT_CLOCKS_FAST;
+			}
+
+			state->ser.next_event = state->cycles + (bit_clocks * 8);
+
+			// The other side hears about it now
+			if(state->link)
+			{
+				link_start(state, state->ser.out);
+			}
+		}
 		break;
 	default:
 		error(state, "serial: unknown register %04X (W)", reg);
@@ -55,38 +175,16 @@ void serial_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 }
 
 /*!
- * @brief	Advance the serial controller one clock pulse.
- * @param	state	The emulator state the clock pulse is occurring on.
- * @result	The serial controller acts on the clock pulse.
+ * @brief	Finish the transfer in progress.
+ * @param	state	The emulator state the transfer is on.
+ * @note	Only called once state->cycles reaches ser.next_event.
  */
 void serial_tick(emu_state *restrict state)
 {
-	uint16_t ticks;
-
-	/* we aren't active; we don't care */
-	if(!state->ser.enabled) return;
-
-	state->ser.curr_clk++;
-	/* XXX TODO FIXME this does NOT support external clocks */
-	if(state->ser.use_internal)
-	{
-		ticks = 512;
-	}
-	else
-	{
-		ticks = 8;
-	}
+	state->ser.next_event = SERIAL_NEVER;
 
-	if(state->ser.curr_clk % ticks == 0)
-	{
-		// TODO put out a bit.
-		// TODO take in a bit.
-		// sockets?  IPC?  something else?  all three?
-		if(state->ser.cur_bit-- == -1)
-		{
-			state->ser.enabled = false;
-			signal_interrupt(state, INT_SERIAL);
-			state->ser.curr_clk = 0;
-		}
-	}
+	// With nothing plugged in, the line floats high
+	state->ser.in = state->link ? link_finish(state) : 0xFF;
+	state->ser.enabled = false;
+	signal_interrupt(state, INT_SERIAL);
 }
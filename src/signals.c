@@ -6,7 +6,8 @@
 #include "sgherm.h"	// emu_state
 
 
-volatile bool do_exit = false;
+/*! The instance told to stop when we're signalled */
+static emu_state *volatile sig_state = NULL;
 
 #ifdef HAVE_POSIX
 
@@ -14,13 +15,18 @@ volatile bool do_exit = false;
 
 static void sig_handler(int signal UNUSED)
 {
-	do_exit = true;
+	if(sig_state != NULL)
+	{
+		sig_state->do_exit = true;
+	}
 }
 
-void register_handlers(void)
+void register_handlers(emu_state *state)
 {
 	struct sigaction sa;
 
+	sig_state = state;
+
 	sigemptyset(&sa.sa_mask);
 	sa.sa_handler = &sig_handler;
 	sa.sa_flags = 0;
@@ -62,7 +68,10 @@ BOOL WINAPI ctrl_event_handler(DWORD type)
 	case CTRL_C_EVENT:
 	case CTRL_BREAK_EVENT:
 	default:
-		do_exit = true;
+		if(sig_state != NULL)
+		{
+			sig_state->do_exit = true;
+		}
 		return TRUE;
 	case CTRL_CLOSE_EVENT:
 		// console window is closed
@@ -75,14 +84,15 @@ BOOL WINAPI ctrl_event_handler(DWORD type)
 	}
 }
 
-void register_handlers(void)
+void register_handlers(emu_state *state)
 {
+	sig_state = state;
 	SetConsoleCtrlHandler(ctrl_event_handler, TRUE);
 }
 
 #else /* !HAVE_POSIX, !_WIN32 */
 
-void register_handlers(void)
+void register_handlers(emu_state *state UNUSED)
 {
 	// TODO maybe some windows signal handling?
 }
@@ -0,0 +1,171 @@
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include "link.h"	// LINK_NEVER, LINK_POLL_CLOCKS
+#include "mixer.h"	// resampler_set_rate
+#include "serio.h"	// serial_flush
+#include "sgherm.h"	// emu_state
+#include "snapshot.h"	// prototypes
+#include "sound.h"	// SOUND_RATE
+
+#include <stddef.h>	// offsetof
+#include <stdlib.h>	// malloc, free
+#include <string.h>	// memcpy, memset
+
+
+/*
+ * Resetting to a snapshot over and over (as training jobs do) mostly
+ * copies memory that was never touched.  So every write to RAM, VRAM, OAM
+ * and cart RAM marks its 256-byte page in state->written, and a reset only
+ * copies back those pages, plus the few KiB of registers and timing.
+ *
+ * The marks are only good for the snapshot the instance was last reset to
+ * (or taken from).  Anything else that rewrites memory behind our back,
+ * like loading a save state, calls snapshot_forget so the next reset does
+ * all of it.
+ */
+
+struct snapshot_t
+{
+	emu_state saved;		/*! Only the parts below are used */
+};
+
+/*! Everything but memory that a reset puts back, in emu_state order */
+static const struct
+{
+	size_t start, end;
+} snapshot_spans[] =
+{
+	// registers to cycles, and count_cur_second to interrupts
+	{ offsetof(emu_state, registers), offsetof(emu_state, start_time) },
+	{ offsetof(emu_state, count_cur_second), offsetof(emu_state, render) },
+
+	// All of the LCDC but VRAM, OAM, and the output (see lcdc.h)
+	{ offsetof(emu_state, lcdc), offsetof(emu_state, lcdc.vram) },
+	{ offsetof(emu_state, lcdc.lcd_control), offsetof(emu_state, lcdc.out) },
+
+	// Sound up to its output (see sound.h)
+	{ offsetof(emu_state, snd), offsetof(emu_state, snd.chan_out) },
+
+	{ offsetof(emu_state, timer), offsetof(emu_state, input) },
+	{ offsetof(emu_state, input), offsetof(emu_state, ser) },
+
+	// Serial up to the host side (see serio.h)
+	{ offsetof(emu_state, ser), offsetof(emu_state, ser.matches) },
+};
+
+
+/*! Copy back the pages marked in words (count of them) */
+static void snapshot_copy_pages(uint8_t *restrict dst,
+		const uint8_t *restrict src, const uint32_t *restrict words,
+		size_t count)
+{
+	for(size_t word = 0; word < count; word++)
+	{
+		uint32_t pages = words[word];
+		size_t offset = word << SNAPSHOT_BANK_SHIFT;
+
+		for(; pages != 0; pages >>= 1, offset += 1 << SNAPSHOT_PAGE_SHIFT)
+		{
+			if(pages & 1)
+			{
+				memcpy(dst + offset, src + offset,
+					1 << SNAPSHOT_PAGE_SHIFT);
+			}
+		}
+	}
+}
+
+/*!
+ * @brief	Snapshot an instance, to reset it to later.
+ * @param	state	The instance.
+ * @returns	The snapshot, or NULL if out of memory.
+ * @note	Only the instance it was taken from (with the same ROM) can be
+ * 		reset to it.
+ */
+snapshot * snapshot_take(emu_state *restrict state)
+{
+	snapshot *snap = malloc(sizeof(snapshot));
+
+	if(snap == NULL)
+	{
+		return NULL;
+	}
+
+	// Pending output belongs to the present, not the snapshot
+	serial_flush(state);
+
+	memcpy(&(snap->saved), state, sizeof(emu_state));
+
+	memset(&(state->written), 0, sizeof(written_pages));
+	state->written.base = snap;
+
+	return snap;
+}
+
+/*!
+ * @brief	Put an instance back the way it was in a snapshot.
+ * @param	snap	The snapshot, from snapshot_take.
+ * @param	state	The instance it was taken from.
+ * @note	Only memory written since the last reset to snap is copied.
+ */
+void snapshot_reset(const snapshot *restrict snap, emu_state *restrict state)
+{
+	const emu_state *saved = &(snap->saved);
+	uint32_t rate = state->snd.rate;
+	int32_t skew = state->snd.skew;
+
+	serial_flush(state);
+
+	if(state->written.base != snap)
+	{
+		// Written since something else; all of it has to go back
+		memset(&(state->written), 0xFF, offsetof(written_pages, base));
+	}
+
+	snapshot_copy_pages(state->memory + 0x8000, saved->memory + 0x8000,
+		state->written.memory, sizeof(state->written.memory) /
+		sizeof(*state->written.memory));
+	snapshot_copy_pages((uint8_t *)state->lcdc.vram,
+		(const uint8_t *)saved->lcdc.vram, state->written.vram,
+		sizeof(state->lcdc.vram) / sizeof(*state->lcdc.vram));
+	snapshot_copy_pages((uint8_t *)state->cart_ram,
+		(const uint8_t *)saved->cart_ram, state->written.cart_ram,
+		sizeof(state->cart_ram) / sizeof(*state->cart_ram));
+
+	if(state->written.oam)
+	{
+		memcpy(state->lcdc.oam_ram, saved->lcdc.oam_ram,
+			sizeof(state->lcdc.oam_store));
+	}
+
+	for(size_t i = 0; i < sizeof(snapshot_spans) / sizeof(*snapshot_spans);
+		i++)
+	{
+		memcpy((uint8_t *)state + snapshot_spans[i].start,
+			(const uint8_t *)saved + snapshot_spans[i].start,
+			snapshot_spans[i].end - snapshot_spans[i].start);
+	}
+
+	memset(&(state->written), 0, sizeof(written_pages));
+	state->written.base = snap;
+
+	// The host's output rate and link cable stay as they are
+	state->snd.rate = rate;
+	state->snd.skew = skew;
+	resampler_set_rate(&(state->snd.rs), SOUND_RATE, rate, skew);
+
+	state->ser.link_pending = false;
+	state->ser.link_next = (state->link != NULL) ?
+		state->cycles + LINK_POLL_CLOCKS : LINK_NEVER;
+}
+
+void snapshot_free(snapshot *snap)
+{
+	free(snap);
+}
+
+/*! Memory was changed without marking pages; the next reset does it all */
+void snapshot_forget(emu_state *restrict state)
+{
+	state->written.base = NULL;
+}
@@ -2,72 +2,664 @@
 
 #include "print.h"
 #include "sgherm.h"	// emu_state
+#include "frontend.h"	// OUTPUT_SAMPLE
+#include "mixer.h"	// mix_channels, resample
+#include "util_thread.h"	// thread_once
 
-uint8_t sound_read(emu_state *restrict state, uint16_t reg)
+#include <string.h>	// memset
+
+
+/*! Duty cycles, one mask per step; ANDed with the 4-bit volume */
+static const uint8_t duty_table[4][8] =
 {
-	switch(reg)
+	{ 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0xF },	// 12.5%
+	{ 0xF, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0xF },	// 25%
+	{ 0xF, 0x0, 0x0, 0x0, 0x0, 0xF, 0xF, 0xF },	// 50%
+	{ 0x0, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0x0 },	// 75%
+};
+
+/*! Noise channel divisors, indexed by the dividing ratio code */
+static const uint8_t noise_divisor[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
+
+/*! Channel 3 output level codes, as right shifts of the sample */
+static const uint8_t wave_shift[4] = { 4, 0, 1, 2 };
+
+/*!
+ * Noise LFSR sequences, built once by sound_init_tables and then only read.
+ *
+ * Position n is the register n clocks after a trigger.  The slot after the
+ * last is the all-zero register, which a width change can leave behind and
+ * which never changes again.  In 7-bit mode only the low 7 bits matter for
+ * output; the rest of the register is kept as it settles after 8 clocks.
+ */
+static uint16_t lfsr15_state[LFSR15_PERIOD + 1];
+static uint16_t lfsr15_index[0x8000];
+static uint8_t lfsr15_out[(LFSR15_PERIOD + 8) / 8];	/*! Bit 0s, packed */
+static uint16_t lfsr7_state[LFSR7_PERIOD + 1];
+static uint8_t lfsr7_index[0x80];
+static uint8_t lfsr7_out[(LFSR7_PERIOD + 8) / 8];
+
+
+/*! Clock an LFSR register once, the slow way */
+static inline uint16_t lfsr_next(uint16_t lfsr, bool width7)
+{
+	uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+
+	lfsr = (lfsr >> 1) | (bit << 14);
+	if(width7)
 	{
-	/*! NR 10 - ch 1 - sweep */
-	case 0xFF10:
+		lfsr = (lfsr & ~0x40) | (bit << 6);
+	}
+
+	return lfsr;
+}
+
+static void sound_build_tables(void)
+{
+	uint16_t lfsr;
+
+	lfsr = 0x7FFF;
+	for(uint16_t i = 0; i < LFSR15_PERIOD; i++)
 	{
-		uint8_t val = (state->snd.ch1.sweep_time & 0x7) << 4;
-		val |= (state->snd.ch1.sweep_dec) << 3;
-		val |= (state->snd.ch1.shift & 0x7);
-		return val;
+		lfsr15_state[i] = lfsr;
+		lfsr15_index[lfsr] = i;
+		lfsr15_out[i >> 3] |= (lfsr & 1) << (i & 7);
+		lfsr = lfsr_next(lfsr, false);
 	}
-	/*! NR 11 - ch 1 - wave pattern duty */
-	case 0xFF11:
+
+	lfsr15_state[LFSR15_PERIOD] = 0;
+	lfsr15_index[0] = LFSR15_PERIOD;
+
+	lfsr = 0x7F;
+	for(uint16_t i = 0; i < LFSR7_PERIOD; i++)
 	{
-		return state->snd.ch1.wave_duty << 6;
+		lfsr7_state[i] = lfsr;
+		lfsr7_index[lfsr] = i;
+		lfsr7_out[i >> 3] |= (lfsr & 1) << (i & 7);
+		lfsr = lfsr_next(lfsr, true) & 0x7F;
 	}
-	/*! NR 12 - ch 1 - envelope */
-	case 0xFF12:
+
+	// Upper bits echo the low 7, plus the bit shifted out last clock
+	for(uint16_t i = 0; i < LFSR7_PERIOD; i++)
 	{
-		uint8_t val = (state->snd.ch1.envelope_volume << 4);
-		val |= (state->snd.ch1.envelope_amp) << 3;
-		val |= (state->snd.ch1.sweep & 0x7);
-		return val;
+		uint16_t low = lfsr7_state[i] & 0x7F;
+		uint16_t prev = lfsr7_state[(i + LFSR7_PERIOD - 1) % LFSR7_PERIOD];
+
+		lfsr7_state[i] = (low << 8) | ((prev & 1) << 7) | low;
 	}
-	/*! NR 13 - ch 1 - frequency LSB */
-	case 0xFF13:
+
+	lfsr7_state[LFSR7_PERIOD] = 0;
+	lfsr7_index[0] = LFSR7_PERIOD;
+}
+
+/*! Build the shared tables; safe from any number of instances at once */
+static void sound_init_tables(void)
+{
+	static thread_once_t once = THREAD_ONCE_INIT;
+
+	thread_once(&once, &sound_build_tables);
+}
+
+/*! Bit 0 of the noise register at a sequence position */
+static inline bool noise_bit(const uint8_t *out, uint16_t pos)
+{
+	return (out[pos >> 3] >> (pos & 7)) & 1;
+}
+
+/*! Find the same register in the other width's sequence */
+static inline uint16_t noise_convert(uint16_t pos, bool to_width7)
+{
+	if(to_width7)
 	{
-		error(state, "sound: read from write-only register FF13");
-		return 0xFF;
+		return lfsr7_index[lfsr15_state[pos] & 0x7F];
 	}
-	/*! NR 14 - ch 1 - misc */
-	case 0xFF14:
+
+	return lfsr15_index[lfsr7_state[pos]];
+}
+
+
+/*! Sample position of a cycle in the current frame */
+static inline uint32_t sound_pos(const emu_state *restrict state, uint64_t when)
+{
+	return (uint32_t)((when - state->snd.frame_start) * state->snd.factor) +
+		state->snd.frame_frac;
+}
+
+/*! Tell a channel's blip buffer its level from a point onwards */
+static inline void sound_level(emu_state *restrict state, uint8_t chan,
+		uint64_t when, uint8_t level)
+{
+	blip_set_level(&(state->snd.blip[chan]), sound_pos(state, when),
+			level << SOUND_LEVEL_SHIFT);
+}
+
+static inline uint8_t square_level(const struct snd_square_t *ch)
+{
+	if(!ch->enabled)
 	{
-		return state->snd.ch1.counter << 6;
+		return 0;
 	}
-	/*! NR 21 - ch 2 - wave pattern duty */
-	case 0xFF16:
+
+	return ch->volume & duty_table[ch->wave_duty][ch->duty_pos];
+}
+
+static inline uint8_t wave_level(const emu_state *restrict state)
+{
+	uint8_t sample;
+
+	if(!state->snd.ch3.enabled)
 	{
-		return state->snd.ch2.wave_duty << 6;
+		return 0;
 	}
-	/*! NR 22 - ch 2 - envelope */
-	case 0xFF17:
+
+	sample = state->snd.ch3.wave[state->snd.ch3.pos >> 1];
+	sample = (state->snd.ch3.pos & 1) ? (sample & 0xF) : (sample >> 4);
+
+	return sample >> wave_shift[state->snd.ch3.volume];
+}
+
+static inline uint8_t noise_level(const emu_state *restrict state)
+{
+	const uint8_t *out = state->snd.ch4.width7 ? lfsr7_out : lfsr15_out;
+
+	if(!state->snd.ch4.enabled || noise_bit(out, state->snd.ch4.lfsr_pos))
 	{
-		uint8_t val = (state->snd.ch2.envelope_volume << 4);
-		val |= (state->snd.ch2.envelope_amp) << 3;
-		val |= (state->snd.ch2.sweep & 0x7);
-		return val;
+		return 0;
 	}
-	/*! NR 23 - ch 2 - frequency LSB */
-	case 0xFF18:
+
+	return state->snd.ch4.volume;
+}
+
+/*! Recompute every channel's level at a point in time */
+static void sound_update_levels(emu_state *restrict state, uint64_t when)
+{
+	sound_level(state, 0, when, square_level(&(state->snd.ch1)));
+	sound_level(state, 1, when, square_level(&(state->snd.ch2)));
+	sound_level(state, 2, when, wave_level(state));
+	sound_level(state, 3, when, noise_level(state));
+}
+
+/*!
+ * @brief	Advance a timer without looking at each step.
+ * @param	timer	Clocks to the next step; updated.
+ * @param	period	Clocks between steps.
+ * @param	elapsed	Clocks to advance by.
+ * @returns	The number of steps taken.
+ */
+static inline uint32_t timer_skip(uint32_t *timer, uint32_t period,
+		uint64_t elapsed)
+{
+	uint64_t steps;
+
+	if(elapsed < *timer)
+	{
+		*timer -= elapsed;
+		return 0;
+	}
+
+	elapsed -= *timer;
+	steps = 1 + (elapsed / period);
+	*timer = period - (elapsed % period);
+
+	return (uint32_t)steps;
+}
+
+static void square_run(emu_state *restrict state, struct snd_square_t *ch,
+		uint8_t chan, uint64_t from, uint64_t to)
+{
+	uint32_t period = (2048 - ch->frequency) * 4;
+	uint32_t timer = ch->timer;
+
+	if(!ch->enabled)
+	{
+		return;
+	}
+
+	if(ch->volume == 0)
+	{
+		// Silent; only the phase matters
+		uint32_t steps = timer_skip(&timer, period, to - from);
+		ch->duty_pos = (ch->duty_pos + steps) & 7;
+	}
+	else
+	{
+		while(to - from >= timer)
+		{
+			from += timer;
+			timer = period;
+			ch->duty_pos = (ch->duty_pos + 1) & 7;
+			sound_level(state, chan, from, square_level(ch));
+		}
+
+		timer -= (to - from);
+	}
+
+	ch->timer = timer;
+}
+
+static void wave_run(emu_state *restrict state, uint64_t from, uint64_t to)
+{
+	uint32_t period = (2048 - state->snd.ch3.frequency) * 2;
+	uint32_t timer = state->snd.ch3.timer;
+
+	if(!state->snd.ch3.enabled)
+	{
+		return;
+	}
+
+	if(state->snd.ch3.volume == 0)
+	{
+		uint32_t steps = timer_skip(&timer, period, to - from);
+		state->snd.ch3.pos = (state->snd.ch3.pos + steps) & 31;
+	}
+	else
+	{
+		while(to - from >= timer)
+		{
+			from += timer;
+			timer = period;
+			state->snd.ch3.pos = (state->snd.ch3.pos + 1) & 31;
+			sound_level(state, 2, from, wave_level(state));
+		}
+
+		timer -= (to - from);
+	}
+
+	state->snd.ch3.timer = timer;
+}
+
+static void noise_run(emu_state *restrict state, uint64_t from, uint64_t to)
+{
+	uint32_t period = noise_divisor[state->snd.ch4.divisor] <<
+		state->snd.ch4.clock_shift;
+	uint32_t timer = state->snd.ch4.timer;
+	uint16_t pos = state->snd.ch4.lfsr_pos;
+	uint16_t seq = state->snd.ch4.width7 ? LFSR7_PERIOD : LFSR15_PERIOD;
+	const uint8_t *out = state->snd.ch4.width7 ? lfsr7_out : lfsr15_out;
+
+	// Shifts of 14 and 15 get no clocks at all
+	if(!state->snd.ch4.enabled || state->snd.ch4.clock_shift >= 14)
+	{
+		return;
+	}
+
+	if(state->snd.ch4.volume == 0 || pos == seq)
 	{
-		error(state, "sound: read from write-only register FF18");
+		// Silent or stuck; only the position matters
+		uint32_t steps = timer_skip(&timer, period, to - from);
+		if(pos != seq)
+		{
+			pos = (pos + steps) % seq;
+		}
+	}
+	else
+	{
+		bool bit = noise_bit(out, pos);
+
+		while(to - from >= timer)
+		{
+			from += timer;
+			timer = period;
+			if(++pos == seq)
+			{
+				pos = 0;
+			}
+
+			if(noise_bit(out, pos) != bit)
+			{
+				bit = !bit;
+				sound_level(state, 3, from,
+					bit ? 0 : state->snd.ch4.volume);
+			}
+		}
+
+		timer -= (to - from);
+	}
+
+	state->snd.ch4.lfsr_pos = pos;
+	state->snd.ch4.timer = timer;
+}
+
+/*! Length counter step for one channel; returns false if it ran out */
+static inline bool length_step(bool counter, uint16_t *length_counter)
+{
+	if(!counter || *length_counter == 0)
+	{
+		return true;
+	}
+
+	return (--(*length_counter) != 0);
+}
+
+static inline void envelope_step(uint8_t period, bool amp, uint8_t *timer,
+		uint8_t *volume)
+{
+	if(period == 0 || --(*timer) != 0)
+	{
+		return;
+	}
+
+	*timer = period;
+	if(amp && *volume < 15)
+	{
+		(*volume)++;
+	}
+	else if(!amp && *volume > 0)
+	{
+		(*volume)--;
+	}
+}
+
+/*! Work out the swept frequency; disables the channel on overflow */
+static uint16_t sweep_calc(emu_state *restrict state)
+{
+	struct snd_square_t *ch = &(state->snd.ch1);
+	uint16_t delta = ch->shadow_freq >> ch->shift;
+	uint16_t freq = ch->sweep_dec ? ch->shadow_freq - delta :
+		ch->shadow_freq + delta;
+
+	if(freq > 2047)
+	{
+		ch->enabled = false;
+	}
+
+	return freq;
+}
+
+static void sweep_step(emu_state *restrict state)
+{
+	struct snd_square_t *ch = &(state->snd.ch1);
+	uint16_t freq;
+
+	if(--ch->sweep_timer != 0)
+	{
+		return;
+	}
+
+	ch->sweep_timer = ch->sweep_time ? ch->sweep_time : 8;
+	if(!ch->sweep_enabled || ch->sweep_time == 0)
+	{
+		return;
+	}
+
+	freq = sweep_calc(state);
+	if(freq <= 2047 && ch->shift != 0)
+	{
+		ch->frequency = ch->shadow_freq = freq;
+		sweep_calc(state);
+	}
+}
+
+/*!
+ * @brief	Step the 512Hz frame sequencer.
+ * @param	state	The emulator state to step.
+ * @result	Length counters, the sweep and envelopes are clocked.
+ */
+static void sound_frame_sequencer(emu_state *restrict state)
+{
+	uint8_t step = state->snd.fs_step;
+
+	if((step & 1) == 0)
+	{
+		if(!length_step(state->snd.ch1.counter, &(state->snd.ch1.length_counter)))
+		{
+			state->snd.ch1.enabled = false;
+		}
+		if(!length_step(state->snd.ch2.counter, &(state->snd.ch2.length_counter)))
+		{
+			state->snd.ch2.enabled = false;
+		}
+		if(!length_step(state->snd.ch3.counter, &(state->snd.ch3.length_counter)))
+		{
+			state->snd.ch3.enabled = false;
+		}
+		if(!length_step(state->snd.ch4.counter, &(state->snd.ch4.length_counter)))
+		{
+			state->snd.ch4.enabled = false;
+		}
+	}
+
+	if(step == 2 || step == 6)
+	{
+		sweep_step(state);
+	}
+
+	if(step == 7)
+	{
+		envelope_step(state->snd.ch1.sweep, state->snd.ch1.envelope_amp,
+			&(state->snd.ch1.env_timer), &(state->snd.ch1.volume));
+		envelope_step(state->snd.ch2.sweep, state->snd.ch2.envelope_amp,
+			&(state->snd.ch2.env_timer), &(state->snd.ch2.volume));
+		envelope_step(state->snd.ch4.sweep, state->snd.ch4.envelope_amp,
+			&(state->snd.ch4.env_timer), &(state->snd.ch4.volume));
+	}
+
+	state->snd.fs_step = (step + 1) & 7;
+}
+
+/*!
+ * @brief	Run the channels up to a point in time.
+ * @param	state	The emulator state to run.
+ * @param	until	The cycle to run up to.
+ * @result	Level changes in between are in the blip buffers.
+ */
+static void sound_run(emu_state *restrict state, uint64_t until)
+{
+	while(state->snd.last < until)
+	{
+		uint64_t from = state->snd.last;
+		uint64_t to = until;
+		bool fs = false;
+
+		if(state->snd.fs_next <= to)
+		{
+			to = state->snd.fs_next;
+			fs = true;
+		}
+
+		square_run(state, &(state->snd.ch1), 0, from, to);
+		square_run(state, &(state->snd.ch2), 1, from, to);
+		wave_run(state, from, to);
+		noise_run(state, from, to);
+
+		state->snd.last = to;
+
+		if(fs)
+		{
+			state->snd.fs_next += SOUND_FS_CLOCKS;
+			sound_frame_sequencer(state);
+			sound_update_levels(state, to);
+		}
+	}
+}
+
+/*! Mix the channels into stereo, applying NR50/NR51, and resample */
+static void sound_mix(emu_state *restrict state, size_t count)
+{
+	const int16_t *const chans[MIXER_CHANNELS] = { state->snd.chan_out[0],
+		state->snd.chan_out[1], state->snd.chan_out[2],
+		state->snd.chan_out[3] };
+	int16_t lvol = state->snd.s02_volume + 1, rvol = state->snd.s01_volume + 1;
+	const int16_t left[MIXER_CHANNELS] = {
+		state->snd.ch1.s02 ? lvol : 0, state->snd.ch2.s02 ? lvol : 0,
+		state->snd.ch3.s02 ? lvol : 0, state->snd.ch4.s02 ? lvol : 0 };
+	const int16_t right[MIXER_CHANNELS] = {
+		state->snd.ch1.s01 ? rvol : 0, state->snd.ch2.s01 ? rvol : 0,
+		state->snd.ch3.s01 ? rvol : 0, state->snd.ch4.s01 ? rvol : 0 };
+	int16_t *mix = state->snd.mix;
+	int32_t *dc = state->snd.dc;
+
+	mix_channels(mix, chans, left, right, count);
+
+	// Levels are all positive; take out the DC like the real output
+	// capacitor does.  This one has to go a sample at a time.
+	for(size_t i = 0; i < count * 2; i += 2)
+	{
+		dc[0] += (mix[i] - dc[0]) >> 9;
+		dc[1] += (mix[i + 1] - dc[1]) >> 9;
+		mix[i] -= dc[0];
+		mix[i + 1] -= dc[1];
+	}
+
+	state->snd.out_len = resample(&(state->snd.rs), mix, count,
+			state->snd.out, SOUND_OUT_SIZE);
+}
+
+/*!
+ * @brief	Choose the rate samples are handed to the frontend at.
+ * @param	state	The emulator state to set the rate on.
+ * @param	rate	The rate in Hz, up to twice SOUND_RATE.
+ */
+void sound_set_output_rate(emu_state *restrict state, uint32_t rate)
+{
+	if(rate == 0 || rate > SOUND_RATE * 2)
+	{
+		error(state, "sound: unsupported output rate %u", rate);
+		return;
+	}
+
+	state->snd.rate = rate;
+	resampler_set_rate(&(state->snd.rs), SOUND_RATE, rate, state->snd.skew);
+}
+
+/*!
+ * @brief	Nudge the output rate to keep a frontend's buffer level.
+ * @param	state	The emulator state to adjust.
+ * @param	skew	Parts per million fewer samples to produce (may be
+ * 			negative); clamped to +/-1%.
+ */
+void sound_set_rate_skew(emu_state *restrict state, int32_t skew)
+{
+	if(skew > 10000) skew = 10000;
+	if(skew < -10000) skew = -10000;
+
+	state->snd.skew = skew;
+	resampler_set_rate(&(state->snd.rs), SOUND_RATE, state->snd.rate, skew);
+}
+
+/*!
+ * @brief	Finish the audio frame.
+ * @param	state	The emulator state to finish the frame on.
+ * @result	The frame is in snd.out, and the next one starts now.
+ */
+static void sound_end_frame(emu_state *restrict state)
+{
+	uint64_t now = state->snd.last;
+	uint64_t end = (uint64_t)sound_pos(state, now);
+	size_t count = end >> BLIP_FRAC_BITS;
+
+	if(count > BLIP_BUF_SIZE)
+	{
+		count = BLIP_BUF_SIZE;
+	}
+
+	for(uint8_t chan = 0; chan < 4; chan++)
+	{
+		blip_end_frame(&(state->snd.blip[chan]), state->snd.chan_out[chan],
+				count);
+	}
+
+	state->snd.frame_start = now;
+	state->snd.frame_frac = end & ((1 << BLIP_FRAC_BITS) - 1);
+	state->snd.next_event = now + SOUND_FRAME_CLOCKS;
+
+	sound_mix(state, count);
+}
+
+/*!
+ * @brief	Set up the APU as the boot ROM leaves it.
+ * @param	state	The emulator state to initialise.
+ */
+void init_sound(emu_state *restrict state)
+{
+	sound_init_tables();
+
+	sound_set_output_rate(state, SOUND_RATE);
+	state->snd.factor = (uint32_t)(((uint64_t)SOUND_RATE << BLIP_FRAC_BITS) /
+		CPU_FREQ_DMG);
+
+	state->snd.last = state->snd.frame_start = state->cycles;
+	state->snd.fs_next = state->cycles + SOUND_FS_CLOCKS;
+	state->snd.next_event = state->cycles + SOUND_FRAME_CLOCKS;
+
+	state->snd.ch4.lfsr_pos = 0;
+	state->snd.ch1.wave_duty = state->snd.ch2.wave_duty = 2;
+
+	// NR50 = 0x77, NR51 = 0xF3, NR52 = 0x80
+	state->snd.enabled = true;
+	state->snd.s01_volume = state->snd.s02_volume = 7;
+	state->snd.ch1.s01 = state->snd.ch2.s01 = true;
+	state->snd.ch1.s02 = state->snd.ch2.s02 = true;
+	state->snd.ch3.s02 = state->snd.ch4.s02 = true;
+}
+
+/*! Read NR x0-x4 of a square channel */
+static uint8_t square_read(const struct snd_square_t *ch, uint8_t reg)
+{
+	switch(reg)
+	{
+	case 0:	/* sweep */
+		return 0x80 | (ch->sweep_time << 4) | (ch->sweep_dec << 3) |
+			ch->shift;
+	case 1:	/* wave pattern duty */
+		return (ch->wave_duty << 6) | 0x3F;
+	case 2:	/* envelope */
+		return (ch->envelope_volume << 4) | (ch->envelope_amp << 3) |
+			ch->sweep;
+	case 3:	/* frequency LSB (write only) */
 		return 0xFF;
+	default: /* misc */
+		return (ch->counter << 6) | 0xBF;
 	}
-	/*! NR 24 - ch 2 - misc */
-	case 0xFF19:
+}
+
+uint8_t sound_read(emu_state *restrict state, uint16_t reg)
+{
+	// Length counters and the wave position depend on time
+	sound_run(state, state->cycles);
+
+	if(reg >= 0xFF30 && reg <= 0xFF3F)
 	{
-		return state->snd.ch2.counter << 6;
+		return state->snd.ch3.wave[reg - 0xFF30];
 	}
+
+	switch(reg)
+	{
+	/*! NR 10-14 - ch 1 */
+	case 0xFF10:
+	case 0xFF11:
+	case 0xFF12:
+	case 0xFF13:
+	case 0xFF14:
+		return square_read(&(state->snd.ch1), reg - 0xFF10);
+	/*! NR 21-24 - ch 2 (no sweep) */
+	case 0xFF16:
+	case 0xFF17:
+	case 0xFF18:
+	case 0xFF19:
+		return square_read(&(state->snd.ch2), reg - 0xFF15);
 	/*! NR 30 - ch 3 - enable */
 	case 0xFF1A:
-	{
-		return state->snd.ch3.enabled << 7;
-	}
+		return (state->snd.ch3.dac << 7) | 0x7F;
+	/*! NR 32 - ch 3 - output level */
+	case 0xFF1C:
+		return (state->snd.ch3.volume << 5) | 0x9F;
+	/*! NR 34 - ch 3 - misc */
+	case 0xFF1E:
+		return (state->snd.ch3.counter << 6) | 0xBF;
+	/*! NR 42 - ch 4 - envelope */
+	case 0xFF21:
+		return (state->snd.ch4.envelope_volume << 4) |
+			(state->snd.ch4.envelope_amp << 3) |
+			state->snd.ch4.sweep;
+	/*! NR 43 - ch 4 - polynomial counter */
+	case 0xFF22:
+		return (state->snd.ch4.clock_shift << 4) |
+			(state->snd.ch4.width7 << 3) |
+			state->snd.ch4.divisor;
+	/*! NR 44 - ch 4 - misc */
+	case 0xFF23:
+		return (state->snd.ch4.counter << 6) | 0xBF;
 	/*! NR 50 - ch control */
 	case 0xFF24:
 	{
@@ -91,7 +683,7 @@ uint8_t sound_read(emu_state *restrict state, uint16_t reg)
 	/*! NR 52 - ch status */
 	case 0xFF26:
 	{
-		return  (state->snd.enabled << 7) |
+		return  (state->snd.enabled << 7) | 0x70 |
 			(state->snd.ch4.enabled << 3) |
 			(state->snd.ch3.enabled << 2) |
 			(state->snd.ch2.enabled << 1) |
@@ -105,86 +697,208 @@ uint8_t sound_read(emu_state *restrict state, uint16_t reg)
 	}
 }
 
+/*! Write NR x0-x4 of a square channel */
+static void square_write(struct snd_square_t *ch, uint8_t reg, uint8_t data,
+		bool sweep)
+{
+	switch(reg)
+	{
+	case 0:	/* sweep */
+		ch->sweep_time = (data >> 4) & 0x7;
+		ch->sweep_dec = ((data & 0x08) == 0x08);
+		ch->shift = (data & 0x7);
+		break;
+	case 1:	/* length/duty */
+		ch->length = (data & 0x3F);
+		ch->wave_duty = (data >> 6);
+		ch->length_counter = 64 - ch->length;
+		break;
+	case 2:	/* envelope */
+		ch->envelope_volume = (data >> 4);
+		ch->envelope_amp = ((data & 0x08) == 0x08);
+		ch->sweep = (data & 0x7);
+
+		// DAC off
+		if((data & 0xF8) == 0)
+		{
+			ch->enabled = false;
+		}
+		break;
+	case 3:	/* frequency LSB */
+		ch->frequency = (ch->frequency & 0x700) | data;
+		break;
+	default: /* misc */
+		ch->frequency = (ch->frequency & 0x00FF) | ((data & 0x7) << 8);
+		ch->counter = ((data & 0x40) == 0x40);
+
+		if(data & 0x80)	/* trigger */
+		{
+			ch->enabled = (ch->envelope_volume != 0 || ch->envelope_amp);
+			if(ch->length_counter == 0)
+			{
+				ch->length_counter = 64;
+			}
+			ch->timer = (2048 - ch->frequency) * 4;
+			ch->volume = ch->envelope_volume;
+			ch->env_timer = ch->sweep;
+
+			if(sweep)
+			{
+				ch->shadow_freq = ch->frequency;
+				ch->sweep_timer = ch->sweep_time ? ch->sweep_time : 8;
+				ch->sweep_enabled = (ch->sweep_time || ch->shift);
+			}
+		}
+		break;
+	}
+}
+
 void sound_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 {
+	// Everything up to now happened with the old values
+	sound_run(state, state->cycles);
+
 	if(reg >= 0xFF30 && reg <= 0xFF3F)
 	{
 		state->snd.ch3.wave[reg - 0xFF30] = data;
 		return;
 	}
 
+	// Only NR52 can be written while the APU is off
+	if(!state->snd.enabled && reg != 0xFF26)
+	{
+		return;
+	}
+
 	switch(reg)
 	{
-	/*! NR 10 - ch 1 - sweep */
+	/*! NR 10-14 - ch 1 */
 	case 0xFF10:
+	case 0xFF11:
+	case 0xFF12:
+	case 0xFF13:
+	case 0xFF14:
 	{
-		state->snd.ch1.sweep_time = (data >> 4) & 0x7;
-		state->snd.ch1.sweep_dec = ((data & 0x08) == 0x08);
-		state->snd.ch1.shift = (data & 0x7);
+		square_write(&(state->snd.ch1), reg - 0xFF10, data, true);
+		if(reg == 0xFF14 && (data & 0x80) && state->snd.ch1.shift)
+		{
+			// Overflow check on trigger
+			sweep_calc(state);
+		}
 		break;
 	}
-	/*! NR 11 - ch 1 - legnth/duty */
-	case 0xFF11:
+	/*! NR 21-24 - ch 2 */
+	case 0xFF16:
+	case 0xFF17:
+	case 0xFF18:
+	case 0xFF19:
 	{
-		state->snd.ch1.length = (data & 0x3F);
-		state->snd.ch1.wave_duty = (data >> 6);
+		square_write(&(state->snd.ch2), reg - 0xFF15, data, false);
 		break;
 	}
-	/*! NR 12 - ch 1 - envelope */
-	case 0xFF12:
+	/*! NR 30 - ch 3 - enable */
+	case 0xFF1A:
 	{
-		state->snd.ch1.envelope_volume = (data >> 4);
-		state->snd.ch1.envelope_amp = ((data & 0x08) == 0x08);
-		state->snd.ch1.sweep = (data & 0x7);
+		state->snd.ch3.dac = ((data & 0x80) == 0x80);
+		if(!state->snd.ch3.dac)
+		{
+			state->snd.ch3.enabled = false;
+		}
 		break;
 	}
-	/*! NR 13 - ch 1 - frequency LSB */
-	case 0xFF13:
+	/*! NR 31 - ch 3 - length */
+	case 0xFF1B:
 	{
-		uint16_t val = state->snd.ch1.frequency & 0xFF00;
-		val |= data;
-		state->snd.ch1.frequency = val;
+		state->snd.ch3.length = data;
+		state->snd.ch3.length_counter = 256 - data;
 		break;
 	}
-	/*! NR 14 - ch 1 - misc */
-	case 0xFF14:
+	/*! NR 32 - ch 3 - output level */
+	case 0xFF1C:
 	{
-		uint16_t val = state->snd.ch1.frequency & 0x00FF;
-		val |= (data & 0x7) << 8;
-		state->snd.ch1.frequency = val;
-		state->snd.ch1.counter = ((data & 0x40) == 0x40);
+		state->snd.ch3.volume = (data >> 5) & 0x3;
 		break;
 	}
-	/*! NR 21 - ch 2 - legnth/duty */
-	case 0xFF16:
+	/*! NR 33 - ch 3 - frequency LSB */
+	case 0xFF1D:
 	{
-		state->snd.ch2.length = (data & 0x3F);
-		state->snd.ch2.wave_duty = (data >> 6);
+		state->snd.ch3.frequency = (state->snd.ch3.frequency & 0x700) | data;
 		break;
 	}
-	/*! NR 22 - ch 2 - envelope */
-	case 0xFF17:
+	/*! NR 34 - ch 3 - misc */
+	case 0xFF1E:
 	{
-		state->snd.ch2.envelope_volume = (data >> 4);
-		state->snd.ch2.envelope_amp = ((data & 0x08) == 0x08);
-		state->snd.ch2.sweep = (data & 0x7);
+		state->snd.ch3.frequency = (state->snd.ch3.frequency & 0xFF) |
+			((data & 0x7) << 8);
+		state->snd.ch3.counter = ((data & 0x40) == 0x40);
+
+		if(data & 0x80)
+		{
+			state->snd.ch3.enabled = state->snd.ch3.dac;
+			if(state->snd.ch3.length_counter == 0)
+			{
+				state->snd.ch3.length_counter = 256;
+			}
+			state->snd.ch3.timer = (2048 - state->snd.ch3.frequency) * 2;
+			state->snd.ch3.pos = 0;
+		}
 		break;
 	}
-	/*! NR 23 - ch 2 - frequency LSB */
-	case 0xFF18:
+	/*! NR 41 - ch 4 - length */
+	case 0xFF20:
 	{
-		uint16_t val = state->snd.ch2.frequency & 0xFF00;
-		val |= data;
-		state->snd.ch2.frequency = val;
+		state->snd.ch4.length = (data & 0x3F);
+		state->snd.ch4.length_counter = 64 - state->snd.ch4.length;
 		break;
 	}
-	/*! NR 24 - ch 2 - misc */
-	case 0xFF19:
+	/*! NR 42 - ch 4 - envelope */
+	case 0xFF21:
 	{
-		uint16_t val = state->snd.ch2.frequency & 0x00FF;
-		val |= (data & 0x7) << 8;
-		state->snd.ch2.frequency = val;
-		state->snd.ch2.counter = ((data & 0x40) == 0x40);
+		state->snd.ch4.envelope_volume = (data >> 4);
+		state->snd.ch4.envelope_amp = ((data & 0x08) == 0x08);
+		state->snd.ch4.sweep = (data & 0x7);
+		if((data & 0xF8) == 0)
+		{
+			state->snd.ch4.enabled = false;
+		}
+		break;
+	}
+	/*! NR 43 - ch 4 - polynomial counter */
+	case 0xFF22:
+	{
+		bool width7 = ((data & 0x08) == 0x08);
+
+		// Same register, different sequence
+		if(width7 != state->snd.ch4.width7)
+		{
+			state->snd.ch4.lfsr_pos = noise_convert(
+				state->snd.ch4.lfsr_pos, width7);
+		}
+
+		state->snd.ch4.clock_shift = (data >> 4);
+		state->snd.ch4.width7 = width7;
+		state->snd.ch4.divisor = (data & 0x7);
+		break;
+	}
+	/*! NR 44 - ch 4 - misc */
+	case 0xFF23:
+	{
+		state->snd.ch4.counter = ((data & 0x40) == 0x40);
+
+		if(data & 0x80)
+		{
+			state->snd.ch4.enabled = (state->snd.ch4.envelope_volume != 0 ||
+				state->snd.ch4.envelope_amp);
+			if(state->snd.ch4.length_counter == 0)
+			{
+				state->snd.ch4.length_counter = 64;
+			}
+			state->snd.ch4.timer = noise_divisor[state->snd.ch4.divisor] <<
+				state->snd.ch4.clock_shift;
+			state->snd.ch4.lfsr_pos = 0;
+			state->snd.ch4.volume = state->snd.ch4.envelope_volume;
+			state->snd.ch4.env_timer = state->snd.ch4.sweep;
+		}
 		break;
 	}
 	/*! NR 50 - ch control */
@@ -212,20 +926,66 @@ void sound_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 	/*! NR 52 - sound enable */
 	case 0xFF26:
 	{
-		state->snd.enabled = ((data & 0x80) == 0x80);
+		bool enabled = ((data & 0x80) == 0x80);
+
+		if(state->snd.enabled && !enabled)
+		{
+			// Powering off clears every register but wave RAM
+			uint8_t wave[16];
+
+			memcpy(wave, state->snd.ch3.wave, sizeof(wave));
+			memset(&(state->snd.ch1), 0, sizeof(state->snd.ch1));
+			memset(&(state->snd.ch2), 0, sizeof(state->snd.ch2));
+			memset(&(state->snd.ch3), 0, sizeof(state->snd.ch3));
+			memset(&(state->snd.ch4), 0, sizeof(state->snd.ch4));
+			memcpy(state->snd.ch3.wave, wave, sizeof(wave));
+
+			state->snd.s01 = state->snd.s02 = false;
+			state->snd.s01_volume = state->snd.s02_volume = 0;
+		}
+		else if(!state->snd.enabled && enabled)
+		{
+			state->snd.fs_step = 0;
+		}
+
+		state->snd.enabled = enabled;
 		break;
 	}
 	default:
 		//error(state, "sound: unrecognised register %04X (W)", reg);
 		break;
 	}
+
+	sound_update_levels(state, state->cycles);
 }
 
+/*!
+ * @brief	Get the samples produced since the last call.
+ * @param	state	The emulator state to take samples from.
+ * @param	samples	Set to the stereo interleaved samples.
+ * @returns	The number of stereo samples.
+ * @note	For frontends that pull audio; the samples stay valid until
+ * 		the next frame ends.
+ */
+size_t sound_output(emu_state *restrict state, const int16_t **samples)
+{
+	sound_run(state, state->cycles);
+	sound_end_frame(state);
+
+	*samples = state->snd.out;
+	return state->snd.out_len;
+}
+
+/*!
+ * @brief	End an audio frame nobody asked for and push it out.
+ * @param	state	The emulator state to run the APU on.
+ * @note	Only called once state->cycles reaches snd.next_event, so
+ * 		the blip buffers never overflow.  Between frames the channels
+ * 		only catch up when a sound register is touched.
+ */
 void sound_tick(emu_state *restrict state)
 {
-	/* no point if we're disabled. */
-	if(!state->snd.enabled)
-	{
-		return;
-	}
+	sound_run(state, state->cycles);
+	sound_end_frame(state);
+	OUTPUT_SAMPLE(state, state->snd.out, state->snd.out_len);
 }
@@ -3,6 +3,75 @@
 #include "ctl_unit.h"	// signal_interrupt, INT_TIMER
 #include "print.h"	// error
 #include "sgherm.h"	// emu_state
+#include "util.h"	// likely/unlikely
+
+
+/*! Clocks per TIMA increment, indexed by the low bits of TAC */
+const uint16_t timer_ticks[4] = { 1024, 16, 64, 256 };
+
+/*! Number of TIMA increments between the last DIV reset and when */
+static inline uint64_t timer_count(const emu_state *restrict state, uint64_t when)
+{
+	return (when - state->timer.div_base) / state->timer.ticks_per_tima;
+}
+
+/*!
+ * @brief	Bring TIMA up to the current cycle.
+ * @param	state	The emulator state the timer is in.
+ * @result	tima and tima_base are current; an overflow in the meantime
+ * 		reloads from TMA and raises INT_TIMER.
+ */
+static void timer_sync(emu_state *restrict state)
+{
+	uint64_t now = state->cycles;
+	uint64_t total;
+
+	if(!state->timer.enabled)
+	{
+		state->timer.tima_base = now;
+		return;
+	}
+
+	total = state->timer.tima + timer_count(state, now) -
+		timer_count(state, state->timer.tima_base);
+	state->timer.tima_base = now;
+
+	if(unlikely(total > 0xFF))	/* overflow! */
+	{
+		uint16_t range = 0x100 - state->timer.tma;
+
+		total = state->timer.tma + ((total - 0x100) % range);
+		signal_interrupt(state, INT_TIMER);
+	}
+
+	state->timer.tima = total;
+}
+
+/*!
+ * @brief	Work out when TIMA will next overflow.
+ * @param	state	The emulator state the timer is in (must be synced).
+ */
+static void timer_schedule(emu_state *restrict state)
+{
+	uint64_t count;
+
+	if(!state->timer.enabled)
+	{
+		state->timer.next_event = TIMER_NEVER;
+		return;
+	}
+
+	count = timer_count(state, state->cycles) + (0x100 - state->timer.tima);
+	state->timer.next_event = state->timer.div_base +
+		(count * state->timer.ticks_per_tima);
+}
+
+void init_timer(emu_state *restrict state)
+{
+	state->timer.div_base = state->timer.tima_base = state->cycles;
+	state->timer.ticks_per_tima = timer_ticks[0];
+	state->timer.next_event = TIMER_NEVER;
+}
 
 uint8_t timer_read(emu_state *restrict state, uint16_t reg)
 {
@@ -15,17 +84,18 @@ uint8_t timer_read(emu_state *restrict state, uint16_t reg)
 	 * this way.  So it's here.
 	 */
 	case 0xFF04:
-		return state->timer.div;
+		return (state->cycles - state->timer.div_base) / TIMER_DIV_CLOCKS;
 	/*
 	 * TIMA - stepper (inc'd once every timer tick)
 	 */
 	case 0xFF05:
+		timer_sync(state);
 		return state->timer.tima;
 	/*
-	 * TMA - how many times has TIMA overflowed?
+	 * TMA - value TIMA is reloaded with on overflow
 	 */
 	case 0xFF06:
-		return state->timer.rounds;
+		return state->timer.tma;
 	/*
 	 * TAC - timer control
 	 */
@@ -35,17 +105,13 @@ uint8_t timer_read(emu_state *restrict state, uint16_t reg)
 
 		if(state->timer.enabled) res |= 0x04;
 
-		switch(state->timer.ticks_per_tima)
+		for(uint8_t rate = 0; rate < 4; rate++)
 		{
-		case 1024:
-			break;
-			/* fall through on purpose; it's fun! */
-		case 128:
-			res++;		/* 16.384KHz = 3 */
-		case 64:
-			res++;		/* 65.536KHz = 2 */
-		case 16:
-			res++;		/* 262.14KHz = 1 */
+			if(timer_ticks[rate] == state->timer.ticks_per_tima)
+			{
+				res |= rate;
+				break;
+			}
 		}
 
 		return res;
@@ -58,6 +124,9 @@ uint8_t timer_read(emu_state *restrict state, uint16_t reg)
 
 void timer_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 {
+	// Everything below re-bases the timer; account for time so far
+	timer_sync(state);
+
 	switch(reg)
 	{
 	/*
@@ -65,59 +134,44 @@ void timer_write(emu_state *restrict state, uint16_t reg, uint8_t data)
 	 */
 	case 0xFF04:
 		/* nope, data is ignored.  reset to 0. */
-		state->timer.div = 0;
-		return;
+		state->timer.div_base = state->cycles;
+		break;
 	/*
 	 * TIMA - XXX FIXME does any game do this?
 	 * should it reset to 0 ala DIV or does it keep data?
 	 */
 	case 0xFF05:
 		state->timer.tima = data;
-		return;
+		break;
 	/*
 	 * TMA - I guess writing to this maybe makes sense
 	 * maybe...
 	 */
 	case 0xFF06:
-		state->timer.rounds = data;
+		state->timer.tma = data;
 		return;
 	/*
 	 * TAC - timer control
 	 */
 	case 0xFF07:
-	{
-		static const uint16_t ticks[4] = { 1024, 16, 64, 128 };
-
 		state->timer.enabled = ((data & 0x04) == 0x04);
-		state->timer.ticks_per_tima = ticks[(data & 3)];
-
-		return;
-	}
+		state->timer.ticks_per_tima = timer_ticks[(data & 3)];
+		break;
 	default:
 		error(state, "timer: unrecognised register %04X (W)", reg);
+		return;
 	}
+
+	timer_schedule(state);
 }
 
+/*!
+ * @brief	Handle a TIMA overflow.
+ * @param	state	The emulator state the timer is in.
+ * @note	Only called once state->cycles reaches timer.next_event.
+ */
 void timer_tick(emu_state *restrict state)
 {
-	/* DIV increases even if the timer is disabled */
-	if(++state->timer.curr_clk % 128 == 0)
-	{
-		state->timer.div++;
-	}
-
-	/* but nothing else does. */
-	if(!state->timer.enabled)
-	{
-		return;
-	}
-
-	if(state->timer.curr_clk % state->timer.ticks_per_tima == 0)
-	{
-		if(++state->timer.tima == 0)	/* overflow! */
-		{
-			state->timer.rounds++;
-			signal_interrupt(state, INT_TIMER);
-		}
-	}
+	timer_sync(state);
+	timer_schedule(state);
 }
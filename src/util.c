@@ -1,4 +1,5 @@
 #include "config.h"	// bool, uint[XX]_t
+#include "util.h"	// prototypes
 
 
 // Taken from the bit twiddling hacks
@@ -69,3 +70,17 @@ void interleaved_to_buf(uint32_t z, uint8_t *buf)
 	buf[1]  = z & 0x30000000;
 	buf[0]  = z & 0xC0000000;
 }
+
+/*! FNV-1a hash, start with FNV1A_INIT or a previous result to continue */
+uint32_t fnv1a(const void *data, size_t len, uint32_t hash)
+{
+	const uint8_t *bytes = data;
+
+	while(len--)
+	{
+		hash ^= *bytes++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
@@ -0,0 +1,460 @@
+#define _GNU_SOURCE		// sched_getaffinity, via util_thread.h
+
+#include "config.h"	// macros, bool, uint[XX]_t
+
+#include "frontend.h"	// FRONT_NULL
+#include "input.h"	// joypad_signal, input_key
+#include "lcdc.h"	// lcdc_line_to_index, set_render_policy
+#include "memory.h"	// mem_read8
+#include "savestate.h"	// savestate_load_file
+#include "sgherm.h"	// emu_state, create_emulator, run_until_frame
+#include "snapshot.h"	// snapshot_*
+#include "util_thread.h"	// thread_*
+#include "vecenv.h"	// prototypes
+
+#include <stdlib.h>	// calloc, free
+#include <string.h>	// memcpy
+
+
+/*
+ * A vector of instances of one ROM, stepped together for training.
+ *
+ * Every step, each instance holds its action's buttons for a number of
+ * frames, and only the last frame is drawn.  Then its screen goes into
+ * its slice of one count x LCDC_HEIGHT x LCDC_WIDTH buffer (a shade, or a
+ * grey level on CGB, per byte; see lcdc_line_to_index), and the bytes at
+ * the probe addresses go into a count x probe_count buffer.  An instance
+ * that stops (fatal on a bad opcode, say) is marked in a byte per
+ * instance and isn't stepped again until it is reset.  The buffers are
+ * made up front, so a step allocates nothing.
+ *
+ * The workers live as long as the vecenv.  A step bumps a generation
+ * number to wake them, and everyone, the caller included, takes instances
+ * off a shared counter until they run out.  Reset goes back to a snapshot
+ * of the start, so it only copies what the instance changed.
+ */
+
+/*! Action bit n is this key */
+static const input_key vecenv_keys[8] =
+{
+	INPUT_RIGHT, INPUT_LEFT, INPUT_UP, INPUT_DOWN,
+	INPUT_A, INPUT_B, INPUT_SELECT, INPUT_START,
+};
+
+#define VECENV_SCREEN	(LCDC_HEIGHT * LCDC_WIDTH)
+
+struct vecenv_t
+{
+	uint32_t count;			/*! Instances */
+	emu_state **states;
+	snapshot **starts;		/*! Where each resets to */
+	uint8_t *held;			/*! Buttons each has down */
+	uint8_t *stopped;		/*! 1 once each has stopped */
+
+	uint8_t *obs;			/*! count x LCDC_HEIGHT x LCDC_WIDTH */
+	uint8_t *start_obs;		/*! Screen at the start */
+	uint16_t *probes;		/*! Addresses to read */
+	unsigned int probe_count;
+	uint8_t *probe_out;		/*! count x probe_count */
+
+	const uint8_t *actions;		/*! This step's, one per instance */
+	unsigned int frames;		/*! This step's length */
+
+	alignment(64) volatile uint32_t next;	/*! Next instance to step */
+	alignment(64) volatile uint32_t finished;	/*! Workers done */
+
+	thread_mutex_t lock;		/*! Guards the rest */
+	thread_cond_t start;		/*! generation moved on, or stop */
+	thread_cond_t done;		/*! done_generation caught up */
+	uint32_t generation;
+	uint32_t done_generation;
+	bool stop;
+
+	unsigned int thread_count;	/*! Workers besides the caller */
+	thread_t *threads;
+};
+
+
+/*! Write out instance i's screen and probes */
+static void vecenv_observe(vecenv *restrict env, uint32_t i)
+{
+	emu_state *state = env->states[i];
+	uint8_t *obs = env->obs + (size_t)i * VECENV_SCREEN;
+	uint8_t *probe_out = env->probe_out + (size_t)i * env->probe_count;
+
+	for(uint8_t line = 0; line < LCDC_HEIGHT; line++)
+	{
+		lcdc_line_to_index(state, line, obs + line * LCDC_WIDTH);
+	}
+
+	for(unsigned int p = 0; p < env->probe_count; p++)
+	{
+		probe_out[p] = mem_read8(state, env->probes[p]);
+	}
+}
+
+static void vecenv_step_one(vecenv *restrict env, uint32_t i)
+{
+	emu_state *state = env->states[i];
+	uint8_t action = env->actions[i];
+	uint8_t changed = action ^ env->held[i];
+
+	// Only changes are signalled; a held button isn't pressed again
+	for(unsigned int bit = 0; changed != 0; bit++, changed >>= 1)
+	{
+		if(changed & 1)
+		{
+			joypad_signal(state, vecenv_keys[bit],
+				(action >> bit) & 1);
+		}
+	}
+	env->held[i] = action;
+
+	if(env->stopped[i])
+	{
+		return;
+	}
+
+	for(unsigned int frame = 1; frame <= env->frames; frame++)
+	{
+		if(frame == env->frames)
+		{
+			set_render_policy(state, RENDER_ALWAYS, 0);
+		}
+
+		if(unlikely(!run_until_frame(state)))
+		{
+			env->stopped[i] = 1;
+			break;
+		}
+	}
+	set_render_policy(state, RENDER_NEVER, 0);
+
+	if(env->frames > 0)
+	{
+		vecenv_observe(env, i);
+	}
+}
+
+/*! Step instances until there are none left in this step */
+static void vecenv_work(vecenv *restrict env)
+{
+	uint32_t i;
+
+	while((i = atomic_inc(&(env->next)) - 1) < env->count)
+	{
+		vecenv_step_one(env, i);
+	}
+}
+
+static void vecenv_worker(void *data)
+{
+	vecenv *env = data;
+	uint32_t seen = 0;
+
+	for(;;)
+	{
+		thread_mutex_lock(&(env->lock));
+		while(env->generation == seen && !env->stop)
+		{
+			thread_cond_wait(&(env->start), &(env->lock));
+		}
+
+		if(env->stop)
+		{
+			thread_mutex_unlock(&(env->lock));
+			return;
+		}
+
+		seen = env->generation;
+		thread_mutex_unlock(&(env->lock));
+
+		vecenv_work(env);
+
+		// The last one out tells the caller
+		if(atomic_inc(&(env->finished)) == env->thread_count)
+		{
+			thread_mutex_lock(&(env->lock));
+			env->done_generation = seen;
+			thread_cond_broadcast(&(env->done));
+			thread_mutex_unlock(&(env->lock));
+		}
+	}
+}
+
+/*!
+ * @brief	Make a vector of instances of a ROM.
+ * @param	rom_path	The ROM.
+ * @param	state_path	Save state they all start from, or NULL for
+ * 		power-on.
+ * @param	count	How many instances.
+ * @param	threads	Threads to step them on, the caller's included; 0
+ * 		for one per CPU.
+ * @param	probes	Addresses to read after every step (may be NULL).
+ * @param	probe_count	How many.
+ * @returns	The vecenv, or NULL if anything failed.
+ * @note	Instances have null frontends, and print nothing.  They start
+ * 		(and reset to) one frame in, so there is a screen to observe.
+ */
+vecenv * vecenv_create(const char *rom_path, const char *state_path,
+		uint32_t count, unsigned int threads, const uint16_t *probes,
+		unsigned int probe_count)
+{
+	vecenv *env = calloc(1, sizeof(vecenv));
+
+	if(env == NULL || count == 0)
+	{
+		free(env);
+		return NULL;
+	}
+
+	env->count = count;
+	env->probe_count = probe_count;
+
+	env->states = calloc(count, sizeof(emu_state *));
+	env->starts = calloc(count, sizeof(snapshot *));
+	env->held = calloc(count, 1);
+	env->stopped = calloc(count, 1);
+	env->obs = calloc(count, VECENV_SCREEN);
+	env->start_obs = calloc(1, VECENV_SCREEN);
+	env->probes = calloc(probe_count + 1, sizeof(uint16_t));
+	env->probe_out = calloc((size_t)count * probe_count + 1, 1);
+
+	thread_mutex_init(&(env->lock));
+	thread_cond_init(&(env->start));
+	thread_cond_init(&(env->done));
+
+	if(env->states == NULL || env->starts == NULL || env->held == NULL ||
+		env->stopped == NULL || env->obs == NULL || env->start_obs == NULL ||
+		env->probes == NULL || env->probe_out == NULL)
+	{
+		vecenv_destroy(env);
+		return NULL;
+	}
+
+	if(probe_count > 0)
+	{
+		memcpy(env->probes, probes, probe_count * sizeof(uint16_t));
+	}
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		emu_state *state = create_emulator(FRONT_NULL, FRONT_NULL,
+				FRONT_NULL, FRONT_NULL);
+
+		if((env->states[i] = state) == NULL)
+		{
+			vecenv_destroy(env);
+			return NULL;
+		}
+
+		state->to_stdout = state->to_stderr = NULL;
+
+		if(!load_rom(state, rom_path) || (state_path != NULL &&
+			!savestate_load_file(state, state_path)))
+		{
+			vecenv_destroy(env);
+			return NULL;
+		}
+
+		// Start with nothing held, whatever the state had
+		for(unsigned int bit = 0; bit < 8; bit++)
+		{
+			joypad_signal(state, vecenv_keys[bit], false);
+		}
+
+		// Nothing is on screen until a frame has been drawn
+		set_render_policy(state, RENDER_ALWAYS, 0);
+		if(!run_until_frame(state))
+		{
+			vecenv_destroy(env);
+			return NULL;
+		}
+		set_render_policy(state, RENDER_NEVER, 0);
+
+		if((env->starts[i] = snapshot_take(state)) == NULL)
+		{
+			vecenv_destroy(env);
+			return NULL;
+		}
+	}
+
+	// They all start the same, so one screen does for every reset
+	vecenv_observe(env, 0);
+	memcpy(env->start_obs, env->obs, VECENV_SCREEN);
+	vecenv_reset(env, VECENV_ALL);
+
+	if(threads == 0)
+	{
+		threads = thread_cpu_count();
+	}
+	if(threads > count)
+	{
+		threads = count;
+	}
+
+	if(threads > 1 && (env->threads = calloc(threads - 1,
+		sizeof(thread_t))) != NULL)
+	{
+		// With fewer workers than asked for, the caller does more
+		for(; env->thread_count < threads - 1; env->thread_count++)
+		{
+			if(!thread_create(&(env->threads[env->thread_count]),
+				&vecenv_worker, env))
+			{
+				break;
+			}
+		}
+	}
+
+	return env;
+}
+
+void vecenv_destroy(vecenv *env)
+{
+	if(env == NULL)
+	{
+		return;
+	}
+
+	thread_mutex_lock(&(env->lock));
+	env->stop = true;
+	thread_cond_broadcast(&(env->start));
+	thread_mutex_unlock(&(env->lock));
+
+	for(unsigned int t = 0; t < env->thread_count; t++)
+	{
+		thread_join(&(env->threads[t]));
+	}
+	free(env->threads);
+
+	for(uint32_t i = 0; env->states != NULL && i < env->count; i++)
+	{
+		if(env->starts != NULL)
+		{
+			snapshot_free(env->starts[i]);
+		}
+
+		if(env->states[i] != NULL)
+		{
+			free(env->states[i]->cart_data);
+			free(env->states[i]);
+		}
+	}
+
+	thread_cond_destroy(&(env->done));
+	thread_cond_destroy(&(env->start));
+	thread_mutex_destroy(&(env->lock));
+
+	free(env->states);
+	free(env->starts);
+	free(env->held);
+	free(env->stopped);
+	free(env->obs);
+	free(env->start_obs);
+	free(env->probes);
+	free(env->probe_out);
+	free(env);
+}
+
+/*!
+ * @brief	Step every instance at once.
+ * @param	env	The vecenv.
+ * @param	actions	One per instance; VECENV_* bits.
+ * @param	frames	Frames to hold the actions for.
+ * @note	Returns once all are done; vecenv_observations,
+ * 		vecenv_probes and vecenv_done then hold the results.  With
+ * 		frames == 0 only the buttons change.  An instance that stops
+ * 		part way keeps the screen and probes from where it stopped.
+ */
+void vecenv_step(vecenv *restrict env, const uint8_t *restrict actions,
+		unsigned int frames)
+{
+	env->actions = actions;
+	env->frames = frames;
+	env->next = 0;
+	env->finished = 0;
+
+	if(env->thread_count > 0)
+	{
+		thread_mutex_lock(&(env->lock));
+		env->generation++;
+		thread_cond_broadcast(&(env->start));
+		thread_mutex_unlock(&(env->lock));
+	}
+
+	vecenv_work(env);
+
+	if(env->thread_count > 0)
+	{
+		thread_mutex_lock(&(env->lock));
+		while(env->done_generation != env->generation)
+		{
+			thread_cond_wait(&(env->done), &(env->lock));
+		}
+		thread_mutex_unlock(&(env->lock));
+	}
+}
+
+/*!
+ * @brief	Put instances back where they started.
+ * @param	env	The vecenv.
+ * @param	index	Which instance, or VECENV_ALL.
+ * @note	Not to be called during vecenv_step.  The observation becomes
+ * 		the screen drawn at the start; the probes are read again.  An
+ * 		instance that had stopped runs again.
+ */
+void vecenv_reset(vecenv *restrict env, uint32_t index)
+{
+	uint32_t i = (index == VECENV_ALL) ? 0 : index;
+	uint32_t end = (index == VECENV_ALL) ? env->count : index + 1;
+
+	for(; i < end && i < env->count; i++)
+	{
+		uint8_t *probe_out = env->probe_out +
+			(size_t)i * env->probe_count;
+
+		snapshot_reset(env->starts[i], env->states[i]);
+		env->states[i]->fatal_code = 0;
+		env->states[i]->do_exit = false;
+		env->held[i] = 0;
+		env->stopped[i] = 0;
+
+		memcpy(env->obs + (size_t)i * VECENV_SCREEN, env->start_obs,
+			VECENV_SCREEN);
+
+		for(unsigned int p = 0; p < env->probe_count; p++)
+		{
+			probe_out[p] = mem_read8(env->states[i], env->probes[p]);
+		}
+	}
+}
+
+/*! Screens after the last step: count x LCDC_HEIGHT x LCDC_WIDTH bytes */
+const uint8_t * vecenv_observations(const vecenv *restrict env)
+{
+	return env->obs;
+}
+
+/*! Probe values after the last step: count x probe_count bytes */
+const uint8_t * vecenv_probes(const vecenv *restrict env)
+{
+	return env->probe_out;
+}
+
+/*! Whether each instance has stopped and needs a reset: count bytes */
+const uint8_t * vecenv_done(const vecenv *restrict env)
+{
+	return env->stopped;
+}
+
+uint32_t vecenv_count(const vecenv *restrict env)
+{
+	return env->count;
+}
+
+/*! One of the instances, to look at or poke between steps */
+emu_state * vecenv_instance(vecenv *restrict env, uint32_t index)
+{
+	return (index < env->count) ? env->states[index] : NULL;
+}
@@ -4,12 +4,12 @@
 LRESULT CALLBACK VViewProc(HWND hWnd, UINT iMsg, WPARAM wParam, LPARAM lParam);
 LRESULT CALLBACK HermProc(HWND hWnd, UINT iMsg, WPARAM wParam, LPARAM lParam);
 
-emu_state *g_state;
+/*! The window procedures have no other way to find it */
+static emu_state *g_state;
 
 #include "print.h"	// debug
 #include "frontend.h"	// frontend
 
-extern bool do_exit;
 
 typedef struct video_state
 {
@@ -25,6 +25,8 @@ typedef struct video_state
 	HWND vramWindow;
 	/*! vram viewer bitmap */
 	HBITMAP vramBM;
+	/*! converted screen, copied to bm every vblank */
+	uint32_t fb[144][160];
 } video_state;
 
 bool w32_init_video(emu_state *state)
@@ -34,6 +36,7 @@ bool w32_init_video(emu_state *state)
 	HDC hdc;
 	video_state *s;
 
+	g_state = state;
 	s = (video_state *)state->front.video.data = calloc(sizeof(video_state), 1);
 
 	ZeroMemory(&wndcl, sizeof(wndcl));
@@ -167,7 +170,12 @@ void w32_blit_canvas(emu_state *state)
 	video_state *s = (video_state *)state->front.video.data;
 	HDC hdc = GetDC(s->hWnd);
 
-	SetBitmapBits(s->bm, 92960, (LPVOID)state->lcdc.out);
+	for(uint8_t line = 0; line < 144; line++)
+	{
+		lcdc_line_to_argb(state, line, s->fb[line]);
+	}
+
+	SetBitmapBits(s->bm, sizeof(s->fb), (LPVOID)s->fb);
 
 	BitBlt(hdc, 0, 0, 160, 144, s->mem, 0, 0, SRCCOPY);
 
@@ -267,10 +275,9 @@ int w32_event_loop(emu_state *state)
 	video_state *s = (video_state *)state->front.video.data;
 	MSG msg;
 
-	while(!do_exit)
+	while(run_until_frame(state))
 	{
-		StepEmulator(g_state);
-		if(PeekMessage(&msg, s->hWnd, 0, 0, PM_REMOVE) > 0x0)
+		while(PeekMessage(&msg, s->hWnd, 0, 0, PM_REMOVE) > 0x0)
 		{
 			TranslateMessage(&msg);
 			DispatchMessage(&msg);
@@ -294,58 +301,6 @@ const frontend_input w32_frontend_input = {
 	NULL
 };
 
-char *AskUserForROMPath(void)
-{
-	char szROMName[MAX_PATH];
-
-	OPENFILENAME ofn;
-	ZeroMemory(&szROMName, sizeof(szROMName));
-	ZeroMemory(&ofn, sizeof(OPENFILENAME));
-	ofn.lStructSize = sizeof(OPENFILENAME);
-	ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST | OFN_EXPLORER;
-	//ofn.hwndOwner = hwnd;
-	ofn.lpstrFile = szROMName;
-	ofn.lpstrFilter = "All Game Boy ROMs\0*.gb;*.gbc\0Original Game Boy (DMG) ROMs\0*.gb\0";
-	ofn.lpstrTitle = "Open Game!";
-	ofn.nMaxFile = sizeof(szROMName);
-
-	if(!GetOpenFileName(&ofn))
-	{
-		return NULL;
-	}
-	else
-	{
-		return strdup(szROMName);
-	}
-}
-
-int WINAPI WinMain(HINSTANCE hInstance UNUSED, HINSTANCE hPrevInstance UNUSED, char *szCmdLine, int iCmdShow UNUSED)
-{
-	char *rom_path;
-
-	AllocConsole();
-	to_stdout = freopen("CONOUT$", "w", stdout);
-	to_stderr = freopen("CONOUT$", "w", stderr);
-
-	if(szCmdLine == NULL || strlen(szCmdLine) == 0)
-	{
-		rom_path = AskUserForROMPath();
-	} else {
-		rom_path = strdup(szCmdLine);
-	}
-
-	if((g_state = init_emulator(rom_path, FRONT_WIN32, FRONT_NULL,
-		FRONT_WIN32, FRONT_WIN32)) == NULL)
-	{
-		return -1;
-	}
-
-	free(rom_path);
-
-	return main_common(g_state);
-}
-
-
 LRESULT CALLBACK VViewProc(HWND hWnd, UINT iMsg, WPARAM wParam, LPARAM lParam)
 {
 	switch(iMsg)
@@ -397,7 +352,7 @@ LRESULT CALLBACK HermProc(HWND hWnd, UINT iMsg, WPARAM wParam, LPARAM lParam)
 		g_state->front.input.data = NULL;
 		return 0;
 	case WM_CLOSE:
-		do_exit = true;
+		g_state->do_exit = true;
 		return 0;
 	default:
 		return DefWindowProc(hWnd, iMsg, wParam, lParam);